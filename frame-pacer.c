@@ -0,0 +1,115 @@
+/** @file frame-pacer.c
+ *
+ * @brief Drive rendering at a fixed frame rate and measure frame times
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <errno.h>
+
+#include "frame-pacer.h"
+#include "monotonic.h"
+
+double frame_pacer_now(void)
+{
+    return monotonic_now();
+}
+
+static void sleep_until(double t)
+{
+    struct timespec ts;
+    ts.tv_sec = (time_t)t;
+    ts.tv_nsec = (long)((t - ts.tv_sec) * 1e9);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+    }
+}
+
+void frame_pacer_init(frame_pacer_t *p, int fps, unsigned int sample_rate)
+{
+    memset(p, 0, sizeof(*p));
+    p->fps = fps;
+    p->sample_rate = sample_rate;
+    p->period = fps > 0 ? 1.0 / fps : 0.0;
+    p->origin = frame_pacer_now();
+    p->slot = -1;
+    p->hop_slot = -1;
+}
+
+int frame_pacer_wait(frame_pacer_t *p)
+{
+    double t = frame_pacer_now();
+    long next = p->slot + 1;
+    int slots = 1;
+
+    if (p->period > 0) {
+        /* the slot we are in right now, if that is past the next one
+         * we are late and skip everything in between
+         */
+        long current = (long)floor((t - p->origin) / p->period);
+        if (current >= next) {
+            slots = (int)(current - p->slot);
+            p->dropped += slots - 1;
+            next = current;
+        } else {
+            sleep_until(p->origin + next * p->period);
+        }
+        t = frame_pacer_now();
+    }
+    p->slot = next;
+
+    if (p->frame_start > 0) {
+        p->interval[p->intervals++ % FRAME_PACER_HISTORY] = t - p->frame_start;
+    }
+    p->frame_start = t;
+    return slots;
+}
+
+void frame_pacer_done(frame_pacer_t *p)
+{
+    p->render[p->frames++ % FRAME_PACER_HISTORY] = frame_pacer_now() - p->frame_start;
+}
+
+unsigned int frame_pacer_hop(frame_pacer_t *p)
+{
+    /* audio frames from slot 0 up to the end of a slot, exact integers */
+    unsigned long long begin, end;
+
+    if (p->fps <= 0) {
+        return 0;
+    }
+    begin = (unsigned long long)(p->hop_slot + 1) * p->sample_rate / p->fps;
+    end = (unsigned long long)(p->slot + 1) * p->sample_rate / p->fps;
+    p->hop_slot = p->slot;
+    return (unsigned int)(end - begin);
+}
+
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void percentiles(const double *values, unsigned long total, double *p50, double *p99)
+{
+    double sorted[FRAME_PACER_HISTORY];
+    unsigned int count = total < FRAME_PACER_HISTORY ? total : FRAME_PACER_HISTORY;
+
+    if (count == 0) {
+        *p50 = *p99 = 0.0;
+        return;
+    }
+    memcpy(sorted, values, count * sizeof(double));
+    qsort(sorted, count, sizeof(double), compare_double);
+    *p50 = sorted[(count - 1) * 50 / 100];
+    *p99 = sorted[(count - 1) * 99 / 100];
+}
+
+void frame_pacer_stats(frame_pacer_t *p, frame_pacer_stats_t *stats)
+{
+    percentiles(p->interval, p->intervals, &stats->p50, &stats->p99);
+    percentiles(p->render, p->frames, &stats->render_p50, &stats->render_p99);
+    stats->frames = p->frames;
+    stats->dropped = p->dropped;
+}
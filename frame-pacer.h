@@ -0,0 +1,73 @@
+/** @file frame-pacer.h
+ *
+ * @brief Drive rendering at a fixed frame rate and measure frame times
+ *
+ * Frames are scheduled on a fixed grid of 1/fps seconds starting at
+ * frame_pacer_init().  frame_pacer_wait() sleeps until the next slot on
+ * the grid.  When rendering falls behind, the slots that were missed are
+ * skipped (never rendered late in a burst), so the cadence stays
+ * deterministic and the grid never drifts.
+ *
+ * The pacer also knows the audio sample rate: frame_pacer_hop() tells
+ * how many audio frames belong to the slots since the last call, so
+ * audio and video stay aligned even when frames are skipped.
+ *
+ * With fps == 0 the pacer does not sleep (vsync or "as fast as
+ * possible") and only measures.
+ */
+
+#ifndef FRAME_PACER_H
+#define FRAME_PACER_H
+
+#define FRAME_PACER_HISTORY 1024
+
+typedef struct frame_pacer_stats {
+    double p50;                 /* frame interval, seconds */
+    double p99;
+    double render_p50;          /* time between frame_pacer_wait() returning */
+    double render_p99;          /* and frame_pacer_done(), seconds */
+    unsigned long frames;       /* frames rendered */
+    unsigned long dropped;      /* slots skipped because we were late */
+} frame_pacer_stats_t;
+
+typedef struct frame_pacer {
+    int fps;
+    unsigned int sample_rate;
+    double period;
+    double origin;              /* time of slot 0 */
+    long slot;                  /* slot of the current frame */
+    long hop_slot;              /* slot up to which audio was handed out */
+    double frame_start;         /* 0 before the first frame */
+    unsigned long frames;
+    unsigned long intervals;
+    unsigned long dropped;
+    double interval[FRAME_PACER_HISTORY];
+    double render[FRAME_PACER_HISTORY];
+} frame_pacer_t;
+
+/** fps == 0 disables sleeping, sample_rate is used by frame_pacer_hop() */
+void frame_pacer_init(frame_pacer_t *p, int fps, unsigned int sample_rate);
+
+/**
+ * Sleep until the next slot and mark the start of a frame.
+ * Returns the number of slots that passed since the previous frame,
+ * 1 when on time, more when slots were skipped.
+ */
+int frame_pacer_wait(frame_pacer_t *p);
+
+/** Mark the end of the frame started by frame_pacer_wait(). */
+void frame_pacer_done(frame_pacer_t *p);
+
+/**
+ * Audio frames that belong to the slots since the last call, rounded
+ * so the sum over many frames is exact.  0 when fps == 0.
+ */
+unsigned int frame_pacer_hop(frame_pacer_t *p);
+
+/** Percentiles over the last FRAME_PACER_HISTORY frames plus counters. */
+void frame_pacer_stats(frame_pacer_t *p, frame_pacer_stats_t *stats);
+
+/** Monotonic clock in seconds. */
+double frame_pacer_now(void);
+
+#endif /* FRAME_PACER_H */
@@ -0,0 +1,102 @@
+/** @file gradient-bench.c
+ *
+ * @brief Compare the gradient generators from 256 to 8192 pixels
+ *
+ * Prints the time per image of every row kernel the CPU supports, on
+ * one thread and row-parallel, checks each against the scalar kernel,
+ * and shows what a cache hit costs compared to generating the image.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "gradient-gen.h"
+#include "monotonic.h"
+
+#define BENCH_SECONDS 0.5
+
+int main(void)
+{
+    gradient_params_t params = gradient_params_default();
+    gradient_kernel_t kernels[3];
+    size_t nkernels = gradient_kernels(kernels, 3);
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int threads = cpus < 1 ? 1 : cpus > 8 ? 8 : (int)cpus;
+    size_t max_bytes = (size_t)8192 * 8192 * 3;
+    uint8_t *expect = malloc(max_bytes);
+    uint8_t *dst = malloc(max_bytes);
+    gradient_cache_t cache;
+    int size;
+    size_t k;
+
+    if (!expect || !dst) {
+        fprintf(stderr, "ERROR: out of memory\n");
+        exit(1);
+    }
+    memset(&cache, 0, sizeof(cache));
+
+    printf("%6s %8s %8s %10s %10s\n", "size", "kernel", "threads", "ms/image", "MB/s");
+    for (size = 256; size <= 8192; size *= 2) {
+        size_t bytes = (size_t)size * size * 3;
+        const uint8_t *cached;
+        double start, elapsed;
+        long images = 0;
+
+        gradient_generate(gradient_row_scalar, expect, size, &params, 1);
+        /* the corners are exact at every size */
+        if (expect[2] != 255 || expect[3 * (size - 1) + 1] != 255 ||
+            expect[bytes - 3] != 255 || expect[bytes - 2] != 255) {
+            fprintf(stderr, "ERROR: wrong corner colors at size %d\n", size);
+            exit(1);
+        }
+
+        for (k = 0; k < nkernels; k++) {
+            int t;
+            for (t = 1; t <= threads; t = (t == threads) ? t + 1 : threads) {
+                images = 0;
+                memset(dst, 0, bytes);
+                gradient_generate(kernels[k].fn, dst, size, &params, t);
+                if (memcmp(dst, expect, bytes)) {
+                    fprintf(stderr, "ERROR: %s output differs from scalar\n",
+                            kernels[k].name);
+                    exit(1);
+                }
+
+                start = monotonic_now();
+                do {
+                    gradient_generate(kernels[k].fn, dst, size, &params, t);
+                    /* keep the compiler from dropping the calls */
+                    __asm__ __volatile__("" : : "r"(dst) : "memory");
+                    images++;
+                    elapsed = monotonic_now() - start;
+                } while (elapsed < BENCH_SECONDS);
+
+                printf("%6d %8s %8d %10.3f %10.1f\n", size, kernels[k].name, t,
+                       elapsed * 1e3 / images, bytes * images / elapsed / 1e6);
+            }
+        }
+
+        cached = gradient_cache_get(&cache, size, &params);
+        if (!cached || memcmp(cached, expect, bytes)) {
+            fprintf(stderr, "ERROR: cached image differs from scalar\n");
+            exit(1);
+        }
+        images = 0;
+        start = monotonic_now();
+        do {
+            cached = gradient_cache_get(&cache, size, &params);
+            __asm__ __volatile__("" : : "r"(cached) : "memory");
+            images++;
+            elapsed = monotonic_now() - start;
+        } while (elapsed < BENCH_SECONDS);
+        printf("%6d %8s %8s %10.6f\n", size, "cached", "-", elapsed * 1e3 / images);
+    }
+    printf("cache: %lu hits, %lu misses\n", cache.hits, cache.misses);
+
+    gradient_cache_free(&cache);
+    free(expect);
+    free(dst);
+    return 0;
+}
@@ -0,0 +1,324 @@
+/** @file gradient-gen.c
+ *
+ * @brief Generate RGB color gradient images on the CPU, with a cache
+ *
+ * Every row is a linear ramp between its left and right end, which are
+ * themselves ramps down the left and right edge.  All of it is done in
+ * 16.16 fixed point, so the kernels only add and shift.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "gradient-gen.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+# define HAVE_X86 1
+# include <immintrin.h>
+#endif
+
+/* images smaller than this are not worth a thread */
+#define GRADIENT_MIN_THREAD_BYTES (1024 * 1024)
+#define GRADIENT_MAX_THREADS 16
+
+gradient_params_t gradient_params_default(void)
+{
+    gradient_params_t params = {
+        { {0, 0, 255}, {0, 255, 255}, {255, 0, 0}, {255, 255, 0} }
+    };
+    return params;
+}
+
+static inline uint8_t fixed_to_u8(int32_t v)
+{
+    v = (v + 0x8000) >> 16;
+    return v < 0 ? 0 : v > 255 ? 255 : (uint8_t)v;
+}
+
+void gradient_row_scalar(uint8_t *dst, const int32_t start[3],
+                         const int32_t step[3], int width)
+{
+    int j;
+    for (j = 0; j < width; j++, dst += 3) {
+        dst[0] = fixed_to_u8(start[0] + j * step[0]);
+        dst[1] = fixed_to_u8(start[1] + j * step[1]);
+        dst[2] = fixed_to_u8(start[2] + j * step[2]);
+    }
+}
+
+#ifdef HAVE_X86
+/* start values of the remaining pixels after 'done' pixels */
+static void advance(int32_t out[3], const int32_t start[3],
+                    const int32_t step[3], int done)
+{
+    out[0] = start[0] + done * step[0];
+    out[1] = start[1] + done * step[1];
+    out[2] = start[2] + done * step[2];
+}
+
+/* value of byte k (channel k % 3 of pixel k / 3) */
+#define LANE(k) (start[(k) % 3] + (k) / 3 * step[(k) % 3])
+#define INC(k, n) ((n) * step[(k) % 3])
+
+__attribute__((target("sse2")))
+static void gradient_row_sse2(uint8_t *dst, const int32_t start[3],
+                              const int32_t step[3], int width)
+{
+    /* 4 pixels = 12 bytes = 3 vectors of 32 bit lanes */
+    __m128i a0 = _mm_setr_epi32(LANE(0), LANE(1), LANE(2), LANE(3));
+    __m128i a1 = _mm_setr_epi32(LANE(4), LANE(5), LANE(6), LANE(7));
+    __m128i a2 = _mm_setr_epi32(LANE(8), LANE(9), LANE(10), LANE(11));
+    const __m128i i0 = _mm_setr_epi32(INC(0, 4), INC(1, 4), INC(2, 4), INC(3, 4));
+    const __m128i i1 = _mm_setr_epi32(INC(4, 4), INC(5, 4), INC(6, 4), INC(7, 4));
+    const __m128i i2 = _mm_setr_epi32(INC(8, 4), INC(9, 4), INC(10, 4), INC(11, 4));
+    const __m128i half = _mm_set1_epi32(0x8000);
+    int32_t rest[3];
+    int j;
+
+    /* each store writes 16 bytes of which 12 are ours, keep it in bounds */
+    for (j = 0; j + 6 <= width; j += 4) {
+        __m128i v0 = _mm_srai_epi32(_mm_add_epi32(a0, half), 16);
+        __m128i v1 = _mm_srai_epi32(_mm_add_epi32(a1, half), 16);
+        __m128i v2 = _mm_srai_epi32(_mm_add_epi32(a2, half), 16);
+        __m128i bytes = _mm_packus_epi16(_mm_packs_epi32(v0, v1),
+                                         _mm_packs_epi32(v2, v2));
+        _mm_storeu_si128((__m128i *)(dst + 3*j), bytes);
+        a0 = _mm_add_epi32(a0, i0);
+        a1 = _mm_add_epi32(a1, i1);
+        a2 = _mm_add_epi32(a2, i2);
+    }
+    advance(rest, start, step, j);
+    gradient_row_scalar(dst + 3*j, rest, step, width - j);
+}
+
+__attribute__((target("avx2")))
+static void gradient_row_avx2(uint8_t *dst, const int32_t start[3],
+                              const int32_t step[3], int width)
+{
+    /* 8 pixels = 24 bytes = 3 vectors of 32 bit lanes */
+    __m256i a0 = _mm256_setr_epi32(LANE(0), LANE(1), LANE(2), LANE(3),
+                                   LANE(4), LANE(5), LANE(6), LANE(7));
+    __m256i a1 = _mm256_setr_epi32(LANE(8), LANE(9), LANE(10), LANE(11),
+                                   LANE(12), LANE(13), LANE(14), LANE(15));
+    __m256i a2 = _mm256_setr_epi32(LANE(16), LANE(17), LANE(18), LANE(19),
+                                   LANE(20), LANE(21), LANE(22), LANE(23));
+    const __m256i i0 = _mm256_setr_epi32(INC(0, 8), INC(1, 8), INC(2, 8), INC(3, 8),
+                                         INC(4, 8), INC(5, 8), INC(6, 8), INC(7, 8));
+    const __m256i i1 = _mm256_setr_epi32(INC(8, 8), INC(9, 8), INC(10, 8), INC(11, 8),
+                                         INC(12, 8), INC(13, 8), INC(14, 8), INC(15, 8));
+    const __m256i i2 = _mm256_setr_epi32(INC(16, 8), INC(17, 8), INC(18, 8), INC(19, 8),
+                                         INC(20, 8), INC(21, 8), INC(22, 8), INC(23, 8));
+    const __m256i half = _mm256_set1_epi32(0x8000);
+    int32_t rest[3];
+    int j;
+
+    /* each store writes 32 bytes of which 24 are ours */
+    for (j = 0; j + 11 <= width; j += 8) {
+        __m256i v0 = _mm256_srai_epi32(_mm256_add_epi32(a0, half), 16);
+        __m256i v1 = _mm256_srai_epi32(_mm256_add_epi32(a1, half), 16);
+        __m256i v2 = _mm256_srai_epi32(_mm256_add_epi32(a2, half), 16);
+        /* the packs work per 128 bit lane, put the quarters back in order */
+        __m256i w01 = _mm256_permute4x64_epi64(_mm256_packs_epi32(v0, v1), 0xd8);
+        __m256i w22 = _mm256_permute4x64_epi64(_mm256_packs_epi32(v2, v2), 0xd8);
+        __m256i bytes = _mm256_permute4x64_epi64(_mm256_packus_epi16(w01, w22), 0xd8);
+        _mm256_storeu_si256((__m256i *)(dst + 3*j), bytes);
+        a0 = _mm256_add_epi32(a0, i0);
+        a1 = _mm256_add_epi32(a1, i1);
+        a2 = _mm256_add_epi32(a2, i2);
+    }
+    advance(rest, start, step, j);
+    gradient_row_sse2(dst + 3*j, rest, step, width - j);
+}
+#endif
+
+size_t gradient_kernels(gradient_kernel_t *kernels, size_t max)
+{
+    size_t n = 0;
+
+    if (n < max) {
+        kernels[n].name = "scalar";
+        kernels[n++].fn = gradient_row_scalar;
+    }
+#ifdef HAVE_X86
+    __builtin_cpu_init();
+    if (n < max && __builtin_cpu_supports("sse2")) {
+        kernels[n].name = "sse2";
+        kernels[n++].fn = gradient_row_sse2;
+    }
+    if (n < max && __builtin_cpu_supports("avx2")) {
+        kernels[n].name = "avx2";
+        kernels[n++].fn = gradient_row_avx2;
+    }
+#endif
+    return n;
+}
+
+gradient_kernel_t gradient_select(void)
+{
+    gradient_kernel_t kernels[3];
+    size_t n = gradient_kernels(kernels, 3);
+    return kernels[n - 1];
+}
+
+/* 16.16 ramp from corner a to corner b, value at position i of size */
+static int32_t ramp(int a, int b, int i, int size)
+{
+    int m = size > 1 ? size - 1 : 1;
+    return a * 65536 + (int32_t)((int64_t)i * ((b - a) * 65536 / m));
+}
+
+typedef struct gradient_slice {
+    gradient_row_fn fn;
+    uint8_t *dst;
+    int size;
+    const gradient_params_t *params;
+    int begin;
+    int end;
+} gradient_slice_t;
+
+static void *generate_rows(void *arg)
+{
+    gradient_slice_t *slice = arg;
+    const gradient_params_t *p = slice->params;
+    int size = slice->size;
+    int m = size > 1 ? size - 1 : 1;
+    int32_t start[3], step[3];
+    int i, c;
+
+    for (i = slice->begin; i < slice->end; i++) {
+        for (c = 0; c < 3; c++) {
+            int32_t left = ramp(p->corner[0][c], p->corner[2][c], i, size);
+            int32_t right = ramp(p->corner[1][c], p->corner[3][c], i, size);
+            start[c] = left;
+            step[c] = (right - left) / m;
+        }
+        slice->fn(slice->dst + (size_t)i * size * 3, start, step, size);
+    }
+    return NULL;
+}
+
+static int gradient_threads(void)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus < 1) {
+        return 1;
+    }
+    return cpus > 8 ? 8 : (int)cpus;
+}
+
+void gradient_generate(gradient_row_fn fn, uint8_t *dst, int size,
+                       const gradient_params_t *params, int threads)
+{
+    gradient_slice_t slices[GRADIENT_MAX_THREADS];
+    pthread_t thread[GRADIENT_MAX_THREADS];
+    int started[GRADIENT_MAX_THREADS];
+    size_t bytes = (size_t)size * size * 3;
+    int i;
+
+    if (threads > GRADIENT_MAX_THREADS) {
+        threads = GRADIENT_MAX_THREADS;
+    }
+    if ((size_t)threads > bytes / GRADIENT_MIN_THREAD_BYTES) {
+        threads = (int)(bytes / GRADIENT_MIN_THREAD_BYTES);
+    }
+    if (threads < 1) {
+        threads = 1;
+    }
+
+    for (i = 0; i < threads; i++) {
+        slices[i].fn = fn;
+        slices[i].dst = dst;
+        slices[i].size = size;
+        slices[i].params = params;
+        slices[i].begin = (int)((int64_t)size * i / threads);
+        slices[i].end = (int)((int64_t)size * (i + 1) / threads);
+    }
+    /* the calling thread does the first slice itself */
+    for (i = 1; i < threads; i++) {
+        started[i] = pthread_create(&thread[i], NULL, generate_rows, &slices[i]) == 0;
+        if (!started[i]) {
+            generate_rows(&slices[i]);
+        }
+    }
+    generate_rows(&slices[0]);
+    for (i = 1; i < threads; i++) {
+        if (started[i]) {
+            pthread_join(thread[i], NULL);
+        }
+    }
+}
+
+/*-----------------------------------------------------------------------------
+ * Cache
+ * ---------------------------------------------------------------------------*/
+static void evict(gradient_cache_entry_t *entry)
+{
+    free(entry->data);
+    memset(entry, 0, sizeof(*entry));
+}
+
+const uint8_t *gradient_cache_get(gradient_cache_t *cache, int size,
+                                  const gradient_params_t *params)
+{
+    size_t bytes = (size_t)size * size * 3;
+    gradient_cache_entry_t *slot = NULL;
+    int i;
+
+    if (size <= 0) {
+        return NULL;
+    }
+    for (i = 0; i < GRADIENT_CACHE_ENTRIES; i++) {
+        gradient_cache_entry_t *e = &cache->entry[i];
+        if (e->data && e->size == size &&
+            memcmp(&e->params, params, sizeof(*params)) == 0) {
+            e->last_use = ++cache->clock;
+            cache->hits++;
+            return e->data;
+        }
+    }
+    cache->misses++;
+
+    /* make room: a free slot, and the byte budget for the new image */
+    for (;;) {
+        gradient_cache_entry_t *oldest = NULL;
+        size_t used = 0;
+
+        slot = NULL;
+        for (i = 0; i < GRADIENT_CACHE_ENTRIES; i++) {
+            gradient_cache_entry_t *e = &cache->entry[i];
+            if (!e->data) {
+                slot = e;
+                continue;
+            }
+            used += (size_t)e->size * e->size * 3;
+            if (!oldest || e->last_use < oldest->last_use) {
+                oldest = e;
+            }
+        }
+        if (slot && (used + bytes <= GRADIENT_CACHE_BYTES || !oldest)) {
+            break;
+        }
+        evict(oldest);
+    }
+
+    slot->data = malloc(bytes);
+    if (!slot->data) {
+        return NULL;
+    }
+    gradient_generate(gradient_select().fn, slot->data, size, params,
+                      gradient_threads());
+    slot->size = size;
+    slot->params = *params;
+    slot->last_use = ++cache->clock;
+    return slot->data;
+}
+
+void gradient_cache_free(gradient_cache_t *cache)
+{
+    int i;
+    for (i = 0; i < GRADIENT_CACHE_ENTRIES; i++) {
+        evict(&cache->entry[i]);
+    }
+}
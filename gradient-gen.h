@@ -0,0 +1,89 @@
+/** @file gradient-gen.h
+ *
+ * @brief Generate RGB color gradient images on the CPU, with a cache
+ *
+ * The gradient is bilinear between four corner colors and scales to
+ * any size: the first and last row and column always hit the corner
+ * colors exactly.  The default corners reproduce the test image the
+ * texture clients always used (red grows down the rows, green along
+ * the columns, blue fades out down the rows), which used to wrap
+ * around for sizes above 256.
+ *
+ * Rows are generated with SSE2 or AVX2 where available and split
+ * across threads for large images.  All kernels produce bit identical
+ * output.
+ */
+
+#ifndef GRADIENT_GEN_H
+#define GRADIENT_GEN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* cached images, at most this many and this many bytes */
+#define GRADIENT_CACHE_ENTRIES 4
+#define GRADIENT_CACHE_BYTES (256 * 1024 * 1024)
+
+typedef struct gradient_params {
+    /* RGB of the corners: top left, top right, bottom left, bottom right */
+    uint8_t corner[4][3];
+} gradient_params_t;
+
+/**
+ * One row of the gradient: 3 * width bytes, channel c of pixel j is
+ * (start[c] + j * step[c] + 0x8000) >> 16.
+ */
+typedef void (*gradient_row_fn)(uint8_t *dst, const int32_t start[3],
+                                const int32_t step[3], int width);
+
+typedef struct gradient_kernel {
+    const char *name;
+    gradient_row_fn fn;
+} gradient_kernel_t;
+
+typedef struct gradient_cache_entry {
+    int size;
+    gradient_params_t params;
+    uint8_t *data;
+    unsigned long last_use;
+} gradient_cache_entry_t;
+
+/** zero initialized is an empty cache */
+typedef struct gradient_cache {
+    gradient_cache_entry_t entry[GRADIENT_CACHE_ENTRIES];
+    unsigned long clock;
+    unsigned long hits;
+    unsigned long misses;
+} gradient_cache_t;
+
+/** The corners of the classic test image. */
+gradient_params_t gradient_params_default(void);
+
+void gradient_row_scalar(uint8_t *dst, const int32_t start[3],
+                         const int32_t step[3], int width);
+
+/** The fastest row kernel the running CPU supports. */
+gradient_kernel_t gradient_select(void);
+
+/** All row kernels the running CPU supports, scalar first. */
+size_t gradient_kernels(gradient_kernel_t *kernels, size_t max);
+
+/**
+ * Fill dst (size * size * 3 bytes, RGB, rows top down) using up to
+ * threads threads, including the calling one.
+ */
+void gradient_generate(gradient_row_fn fn, uint8_t *dst, int size,
+                       const gradient_params_t *params, int threads);
+
+/**
+ * The image for size and params, generated on a miss with the fastest
+ * kernel on all CPUs.  The cache owns the buffer; it stays valid until
+ * a later call evicts it.  Returns NULL when out of memory.
+ */
+const uint8_t *gradient_cache_get(gradient_cache_t *cache, int size,
+                                  const gradient_params_t *params);
+
+/** Free every cached image. */
+void gradient_cache_free(gradient_cache_t *cache);
+
+#endif /* GRADIENT_GEN_H */
@@ -0,0 +1,265 @@
+/** @file headless.c
+ *
+ * @brief Offscreen OpenGL context for machines without a display
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#define GL_GLEXT_PROTOTYPES 1
+#include "headless.h"
+#include <GL/glext.h>
+
+#ifndef HEADLESS_OSMESA
+# include <EGL/eglext.h>
+#endif
+
+/*-----------------------------------------------------------------------------
+ * Framebuffer object, used when the context has no default framebuffer
+ * ---------------------------------------------------------------------------*/
+static int create_fbo(headless_t *h)
+{
+    glGenRenderbuffers(1, &h->color);
+    glBindRenderbuffer(GL_RENDERBUFFER, h->color);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, h->width, h->height);
+
+    glGenRenderbuffers(1, &h->depth);
+    glBindRenderbuffer(GL_RENDERBUFFER, h->depth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, h->width, h->height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glGenFramebuffers(1, &h->fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, h->fbo);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                              GL_RENDERBUFFER, h->color);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT,
+                              GL_RENDERBUFFER, h->depth);
+
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        fprintf(stderr, "ERROR: offscreen framebuffer incomplete\n");
+        return -1;
+    }
+    return 0;
+}
+
+static void destroy_fbo(headless_t *h)
+{
+    if (h->fbo) {
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glDeleteFramebuffers(1, &h->fbo);
+        glDeleteRenderbuffers(1, &h->color);
+        glDeleteRenderbuffers(1, &h->depth);
+        h->fbo = h->color = h->depth = 0;
+    }
+}
+
+#ifdef HEADLESS_OSMESA
+/*-----------------------------------------------------------------------------
+ * OSMesa backend
+ * ---------------------------------------------------------------------------*/
+int headless_init(headless_t *h, int width, int height)
+{
+    const int attribs[] = {
+        OSMESA_FORMAT, OSMESA_RGBA,
+        OSMESA_DEPTH_BITS, 24,
+        OSMESA_STENCIL_BITS, 8,
+        OSMESA_PROFILE, OSMESA_CORE_PROFILE,
+        OSMESA_CONTEXT_MAJOR_VERSION, 3,
+        OSMESA_CONTEXT_MINOR_VERSION, 3,
+        0
+    };
+
+    memset(h, 0, sizeof(*h));
+    h->width = width;
+    h->height = height;
+
+    h->context = OSMesaCreateContextAttribs(attribs, NULL);
+    if (h->context == NULL) {
+        fprintf(stderr, "ERROR: OSMesaCreateContextAttribs() failed\n");
+        return -1;
+    }
+    h->buffer = malloc((size_t)width * height * 4);
+    if (h->buffer == NULL) {
+        fprintf(stderr, "ERROR: cannot allocate OSMesa buffer\n");
+        return -1;
+    }
+    if (!OSMesaMakeCurrent(h->context, h->buffer, GL_UNSIGNED_BYTE, width, height)) {
+        fprintf(stderr, "ERROR: OSMesaMakeCurrent() failed\n");
+        return -1;
+    }
+    glViewport(0, 0, width, height);
+    return 0;
+}
+
+void headless_destroy(headless_t *h)
+{
+    destroy_fbo(h);
+    if (h->context) {
+        OSMesaDestroyContext(h->context);
+        h->context = NULL;
+    }
+    free(h->buffer);
+    h->buffer = NULL;
+}
+
+const char *headless_backend(headless_t *h)
+{
+    return "OSMesa";
+}
+
+int headless_make_current(headless_t *h)
+{
+    if (OSMesaGetCurrentContext() == h->context) {
+        return 0;
+    }
+    return OSMesaMakeCurrent(h->context, h->buffer, GL_UNSIGNED_BYTE,
+                             h->width, h->height) ? 0 : -1;
+}
+
+#else
+/*-----------------------------------------------------------------------------
+ * EGL backend
+ * ---------------------------------------------------------------------------*/
+/* eglTerminate() is not reference counted, the last context does it */
+static pthread_mutex_t display_lock = PTHREAD_MUTEX_INITIALIZER;
+static int display_users;
+
+static EGLDisplay open_display(void)
+{
+    PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay;
+    const char *extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+
+    /* prefer the surfaceless platform, it never touches X11 or a DRM node */
+    getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)
+        eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if (getPlatformDisplay && extensions
+        && strstr(extensions, "EGL_MESA_platform_surfaceless")) {
+        EGLDisplay display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA,
+                                                EGL_DEFAULT_DISPLAY, NULL);
+        if (display != EGL_NO_DISPLAY) {
+            return display;
+        }
+    }
+    return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+}
+
+int headless_init(headless_t *h, int width, int height)
+{
+    EGLint major, minor, count;
+    EGLint config_attribs[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RED_SIZE, 8,
+        EGL_GREEN_SIZE, 8,
+        EGL_BLUE_SIZE, 8,
+        EGL_ALPHA_SIZE, 8,
+        EGL_DEPTH_SIZE, 24,
+        EGL_STENCIL_SIZE, 8,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_NONE
+    };
+    const EGLint pbuffer_attribs[] = {
+        EGL_WIDTH, width,
+        EGL_HEIGHT, height,
+        EGL_NONE
+    };
+    const EGLint context_attribs[] = {
+        EGL_CONTEXT_MAJOR_VERSION, 3,
+        EGL_CONTEXT_MINOR_VERSION, 3,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE
+    };
+
+    memset(h, 0, sizeof(*h));
+    h->width = width;
+    h->height = height;
+    h->surface = EGL_NO_SURFACE;
+    h->context = EGL_NO_CONTEXT;
+
+    pthread_mutex_lock(&display_lock);
+    h->display = open_display();
+    if (h->display == EGL_NO_DISPLAY || !eglInitialize(h->display, &major, &minor)) {
+        pthread_mutex_unlock(&display_lock);
+        fprintf(stderr, "ERROR: cannot initialize EGL display\n");
+        h->display = EGL_NO_DISPLAY;
+        return -1;
+    }
+    display_users++;
+    pthread_mutex_unlock(&display_lock);
+    if (!eglBindAPI(EGL_OPENGL_API)) {
+        fprintf(stderr, "ERROR: EGL has no desktop OpenGL support\n");
+        return -1;
+    }
+
+    /* a pbuffer gives projectM a default framebuffer to draw into,
+     * without one we fall back to a surfaceless context plus an FBO
+     */
+    if (!eglChooseConfig(h->display, config_attribs, &h->config, 1, &count) || count == 0) {
+        config_attribs[1] = 0;
+        if (!eglChooseConfig(h->display, config_attribs, &h->config, 1, &count) || count == 0) {
+            fprintf(stderr, "ERROR: no suitable EGL config\n");
+            return -1;
+        }
+    } else {
+        h->surface = eglCreatePbufferSurface(h->display, h->config, pbuffer_attribs);
+    }
+
+    h->context = eglCreateContext(h->display, h->config, EGL_NO_CONTEXT, context_attribs);
+    if (h->context == EGL_NO_CONTEXT) {
+        fprintf(stderr, "ERROR: eglCreateContext() failed: 0x%x\n", eglGetError());
+        return -1;
+    }
+    if (!eglMakeCurrent(h->display, h->surface, h->surface, h->context)) {
+        fprintf(stderr, "ERROR: eglMakeCurrent() failed: 0x%x\n", eglGetError());
+        return -1;
+    }
+
+    if (h->surface == EGL_NO_SURFACE && create_fbo(h)) {
+        return -1;
+    }
+    glViewport(0, 0, width, height);
+    return 0;
+}
+
+void headless_destroy(headless_t *h)
+{
+    if (h->context != EGL_NO_CONTEXT) {
+        destroy_fbo(h);
+        eglMakeCurrent(h->display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        eglDestroyContext(h->display, h->context);
+        h->context = EGL_NO_CONTEXT;
+    }
+    if (h->surface != EGL_NO_SURFACE) {
+        eglDestroySurface(h->display, h->surface);
+        h->surface = EGL_NO_SURFACE;
+    }
+    if (h->display != EGL_NO_DISPLAY) {
+        pthread_mutex_lock(&display_lock);
+        if (--display_users == 0) {
+            eglTerminate(h->display);
+        }
+        pthread_mutex_unlock(&display_lock);
+        h->display = EGL_NO_DISPLAY;
+    }
+}
+
+int headless_make_current(headless_t *h)
+{
+    if (eglGetCurrentContext() == h->context) {
+        return 0;
+    }
+    return eglMakeCurrent(h->display, h->surface, h->surface, h->context) ? 0 : -1;
+}
+
+const char *headless_backend(headless_t *h)
+{
+    return h->surface == EGL_NO_SURFACE ? "EGL surfaceless + FBO" : "EGL pbuffer";
+}
+#endif
+
+void headless_bind(headless_t *h)
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, h->fbo);
+    glViewport(0, 0, h->width, h->height);
+}
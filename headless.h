@@ -0,0 +1,68 @@
+/** @file headless.h
+ *
+ * @brief Offscreen OpenGL context for machines without a display
+ *
+ * Creates an OpenGL 3.3 core context without a window, either through
+ * EGL (a pbuffer surface, or surfaceless with a framebuffer object when
+ * the driver offers no pbuffer config) or, when built with
+ * -DHEADLESS_OSMESA, through OSMesa (llvmpipe, no GPU needed).
+ *
+ * After headless_init() the context is current and its framebuffer is
+ * bound, so projectm_render_frame() draws into it exactly as it would
+ * into a GLUT window.
+ *
+ * Several contexts may exist at once, e.g. one per thread; the EGL
+ * display they share is only terminated with the last one.
+ */
+
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+#ifdef HEADLESS_OSMESA
+# include <GL/osmesa.h>
+#else
+# include <EGL/egl.h>
+#endif
+#include <GL/gl.h>
+
+typedef struct headless {
+    int width;
+    int height;
+#ifdef HEADLESS_OSMESA
+    OSMesaContext context;
+    void *buffer;
+#else
+    EGLDisplay display;
+    EGLConfig config;
+    EGLContext context;
+    EGLSurface surface;  /* EGL_NO_SURFACE when surfaceless */
+#endif
+    GLuint fbo;          /* 0 when rendering to the pbuffer/OSMesa buffer */
+    GLuint color;
+    GLuint depth;
+} headless_t;
+
+/**
+ * Create the context and a framebuffer of width x height pixels, make
+ * both current.  Returns 0 on success, -1 on failure (the reason is
+ * printed to stderr).
+ */
+int headless_init(headless_t *h, int width, int height);
+
+/** Bind the offscreen framebuffer again, e.g. after a library unbound it. */
+void headless_bind(headless_t *h);
+
+/**
+ * Make the context current on the calling thread, e.g. when another
+ * thread created it.  A context can only be current on one thread at a
+ * time.  Returns 0 on success, -1 on failure.
+ */
+int headless_make_current(headless_t *h);
+
+/** Release the framebuffer and the context. */
+void headless_destroy(headless_t *h);
+
+/** Human readable name of the backend in use, for the INFO output. */
+const char *headless_backend(headless_t *h);
+
+#endif /* HEADLESS_H */
@@ -0,0 +1,74 @@
+/** @file interleave-bench.c
+ *
+ * @brief Compare the stereo interleave kernels at JACK period sizes
+ *
+ * Prints the time per call and the throughput of every kernel the
+ * CPU supports for periods from 64 to 4096 frames, and checks that
+ * each kernel produces the same output as the scalar one.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pcm-interleave.h"
+#include "monotonic.h"
+
+#define MAX_FRAMES 4096
+#define TOTAL_FRAMES (64 * 1024 * 1024)
+
+int main(void)
+{
+    pcm_interleave_kernel_t kernels[4];
+    size_t nkernels = pcm_interleave_kernels(kernels, 4);
+    float *left = malloc(MAX_FRAMES * sizeof(float));
+    float *right = malloc(MAX_FRAMES * sizeof(float));
+    float *expect = malloc(2 * MAX_FRAMES * sizeof(float));
+    float *dst = malloc(2 * MAX_FRAMES * sizeof(float));
+    size_t frames, k, i;
+
+    if (!left || !right || !expect || !dst) {
+        fprintf(stderr, "ERROR: out of memory\n");
+        exit(1);
+    }
+    for (i = 0; i < MAX_FRAMES; i++) {
+        left[i] = (float)i;
+        right[i] = -(float)i;
+    }
+
+    printf("%8s %8s %12s %10s\n", "frames", "kernel", "ns/call", "GB/s");
+    for (frames = 64; frames <= MAX_FRAMES; frames *= 2) {
+        size_t iterations = TOTAL_FRAMES / frames;
+        pcm_interleave_scalar(expect, left, right, frames);
+
+        for (k = 0; k < nkernels; k++) {
+            double start, elapsed;
+
+            memset(dst, 0, 2 * frames * sizeof(float));
+            kernels[k].fn(dst, left, right, frames);
+            if (memcmp(dst, expect, 2 * frames * sizeof(float))) {
+                fprintf(stderr, "ERROR: %s output differs from scalar\n",
+                        kernels[k].name);
+                exit(1);
+            }
+
+            start = monotonic_now();
+            for (i = 0; i < iterations; i++) {
+                kernels[k].fn(dst, left, right, frames);
+                /* keep the compiler from dropping the calls */
+                __asm__ __volatile__("" : : "r"(dst) : "memory");
+            }
+            elapsed = monotonic_now() - start;
+
+            printf("%8zu %8s %12.1f %10.2f\n", frames, kernels[k].name,
+                   elapsed * 1e9 / iterations,
+                   4.0 * sizeof(float) * TOTAL_FRAMES / elapsed * 1e-9);
+        }
+    }
+
+    free(left);
+    free(right);
+    free(expect);
+    free(dst);
+    return 0;
+}
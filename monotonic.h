@@ -0,0 +1,31 @@
+/** @file monotonic.h
+ *
+ * @brief The monotonic clock every module and benchmark times with
+ *
+ * Header only, so the standalone benchmarks need nothing more on their
+ * build lines.
+ */
+
+#ifndef MONOTONIC_H
+#define MONOTONIC_H
+
+#include <stdint.h>
+#include <time.h>
+
+/** CLOCK_MONOTONIC in nanoseconds. */
+static inline uint64_t monotonic_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+/** CLOCK_MONOTONIC in seconds. */
+static inline double monotonic_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+#endif /* MONOTONIC_H */
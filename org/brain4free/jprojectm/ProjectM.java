@@ -23,6 +23,9 @@
 package org.brain4free.jprojectm;
 
 import java.io.IOException;
+import java.util.concurrent.CompletableFuture;
+import java.util.concurrent.ConcurrentHashMap;
+import java.util.concurrent.atomic.AtomicLong;
 
 /**
  * <p>
@@ -50,33 +53,142 @@ public class ProjectM {
         System.loadLibrary("projectmjni");
     }
     
-    public static void open() {
-        new ProjectM().initJackPorts();
-        new ProjectM().initShaders();
-        new ProjectM().initTexture(256);
-        new ProjectM().initProjectm();
+    /* native context of this visualizer: projectM, GL objects, audio ring */
+    private long handle;
+    
+    /* command types of the render thread, see org_brain4free_jprojectm_ProjectM.c */
+    private static final int COMMAND_INIT = 0;
+    private static final int COMMAND_LOAD_PRESET = 1;
+    private static final int COMMAND_RESIZE = 2;
+    private static final int COMMAND_RENDER = 3;
+    private static final int COMMAND_SHUTDOWN = 4;
+    
+    /* commands posted to the render thread that did not complete yet */
+    private final ConcurrentHashMap<Long, CompletableFuture<Long>> pending =
+        new ConcurrentHashMap<Long, CompletableFuture<Long>>();
+    private final AtomicLong nextCommand = new AtomicLong(1);
+    
+    public ProjectM() {
+        handle = create();
+        if (handle == 0) {
+            throw new OutOfMemoryError("cannot create the native projectM context");
+        }
+    }
+    
+    public void open() {
+        initJackPorts();
+        initShaders();
+        initTexture(256);
+        initProjectm();
     }
     
-    public static void close() {
-        new ProjectM().destroyJack();
-        new ProjectM().destroyGl();
-        new ProjectM().destroyProjectm();
+    /* release everything, the object cannot be used afterwards */
+    public void close() {
+        if (handle == 0) {
+            return;
+        }
+        stopRenderThread();
+        destroyJack();
+        destroyGl();
+        destroyProjectm();
+        dispose(handle);
+        handle = 0;
     }
         
+    /**
+     * Start a thread that owns a headless GL context of width x height
+     * and runs every command posted with the post methods below, in
+     * order.  Use this instead of initHeadless()/initGlWindow() and the
+     * init methods when the caller must not block on rendering; the
+     * other GL methods fail on any thread but the render thread from
+     * now on.  The futures complete on the render thread, so keep their
+     * callbacks short.
+     *
+     * @return completes when the GL context, shaders, texture and
+     *         projectM are set up; with -1 if that failed, exceptionally
+     *         if the thread cannot be started or attached to the JVM
+     */
+    public CompletableFuture<Long> startRenderThread(int width, int height) {
+        long id = nextCommand.getAndIncrement();
+        CompletableFuture<Long> future = new CompletableFuture<Long>();
+        pending.put(id, future);
+        if (startRenderThread(id, width, height)) {
+            pending.remove(id);
+            future.completeExceptionally(new IllegalStateException("cannot start the render thread"));
+        }
+        return future;
+    }
+    
+    /**
+     * loadPreset() on the render thread, completes with 0 or -1 once
+     * the preset is queued for loading.
+     */
+    public CompletableFuture<Long> postLoadPreset(String presetUrl) {
+        return post(COMMAND_LOAD_PRESET, 0, 0, presetUrl);
+    }
+    
+    /** loadPreset(int) on the render thread, completes like postLoadPreset(String). */
+    public CompletableFuture<Long> postLoadPreset(int index) {
+        return post(COMMAND_LOAD_PRESET, index, 0, null);
+    }
+    
+    /** Resize the rendered frames, completes with 0. */
+    public CompletableFuture<Long> postResize(int width, int height) {
+        return post(COMMAND_RESIZE, width, height, null);
+    }
+    
+    /**
+     * renderInto(pixels) on the render thread.  Do not touch pixels
+     * before the future completes.
+     *
+     * @return completes with the frame number renderInto() returned
+     */
+    public CompletableFuture<Long> postRenderInto(java.nio.ByteBuffer pixels) {
+        return post(COMMAND_RENDER, 0, 0, pixels);
+    }
+    
+    /**
+     * Release GL and projectM on the render thread and let it end;
+     * commands posted afterwards fail.  close() does this as well.
+     */
+    public CompletableFuture<Long> postShutdown() {
+        return post(COMMAND_SHUTDOWN, 0, 0, null);
+    }
+    
+    private CompletableFuture<Long> post(int type, int width, int height, Object arg) {
+        long id = nextCommand.getAndIncrement();
+        CompletableFuture<Long> future = new CompletableFuture<Long>();
+        pending.put(id, future);
+        if (postCommand(type, id, width, height, arg)) {
+            pending.remove(id);
+            future.completeExceptionally(new IllegalStateException(
+                "render thread not running or its queue is full"));
+        }
+        return future;
+    }
+    
+    /* called from the render thread when command id is done */
+    private void completed(long id, long result) {
+        CompletableFuture<Long> future = pending.remove(id);
+        if (future != null) {
+            future.complete(result);
+        }
+    }
     
     public static void main(String[] args) {
+        ProjectM projectM = new ProjectM();
         System.out.println("Start");
-        new ProjectM().initGlWindow();
-        new ProjectM().open();
-        //new ProjectM().initJackPorts();
+        projectM.initGlWindow();
+        projectM.open();
+        //projectM.initJackPorts();
         //
-        //new ProjectM().initShaders();
-        //new ProjectM().initTexture(256);
-        //new ProjectM().initProjectm();
+        //projectM.initShaders();
+        //projectM.initTexture(256);
+        //projectM.initProjectm();
         
-        new ProjectM().render();
-        new ProjectM().loadPreset("/home/chrigi/Projects/milkdrop/MilkdropVLCPresets/yin - 311 - Ocean of Light (bouncing off mix).milk");
-        new ProjectM().render();
+        projectM.render();
+        projectM.loadPreset("/home/chrigi/Projects/milkdrop/MilkdropVLCPresets/yin - 311 - Ocean of Light (bouncing off mix).milk");
+        projectM.render();
         
         try {
             System.out.println("Wait, press any key to continue");
@@ -89,12 +201,18 @@ public class ProjectM {
             
         
         System.out.println("Stop");
-        new ProjectM().close();
-        //new ProjectM().destroyJack();
-        //new ProjectM().destroyGl();
-        //new ProjectM().destroyProjectm();
+        projectM.close();
+        //projectM.destroyJack();
+        //projectM.destroyGl();
+        //projectM.destroyProjectm();
     }
 
+    // Allocate a native context, 0 when out of memory
+    private static native long create();
+    
+    // Free a native context after everything in it was destroyed
+    private static native void dispose(long handle);
+
     // Declare a native method init() that receives no arguments and returns void
     public native void init();
     
@@ -107,6 +225,14 @@ public class ProjectM {
     //
     public native boolean initGlWindow();
     
+    /**
+     * Create an offscreen GL context for this instance instead of the
+     * GLUT window, e.g. to run several instances on separate threads.
+     * The context is made current on whichever thread calls in, so an
+     * instance must only be used by one thread at a time.
+     */
+    public native boolean initHeadless(int width, int height);
+    
     //
     public native boolean initTexture(int size);
     
@@ -116,9 +242,42 @@ public class ProjectM {
     //
     public native boolean initShaders();
     
-    //
+    /**
+     * Switch to a preset without waiting for it: the file is read on a
+     * background thread and handed to projectM before the next frame
+     * that finds it complete.  When called again before that, only the
+     * newest preset is loaded.  Does not need the GL context, so it can
+     * be called from any thread as long as calls to the instance do not
+     * overlap; after startRenderThread() only the render thread may call
+     * it, use postLoadPreset().
+     *
+     * @return true on error, e.g. projectM is not initialized
+     */
     public native boolean loadPreset(String presetUrl);
     
+    /**
+     * Index the .milk files below directory for loadPreset(int).  The
+     * index (path, size, mtime, content hash) is kept in a file in the
+     * directory and reused on the next start, so only changed presets
+     * are read.  loadPreset() serves presets in the directory from
+     * memory-mapped texts and prefetches the ones that follow, so
+     * switching through the directory in order does not touch the
+     * filesystem.  A thread with its own GL context compiles the
+     * shaders of the presets after the one last loaded, so switching to
+     * them does not stall on the compiler.  Can be called once per
+     * instance.
+     *
+     * @return number of presets found, -1 on error
+     */
+    public native int openPresetDirectory(String directory);
+    
+    /**
+     * Like loadPreset(String) for preset number index of the directory
+     * opened with openPresetDirectory(), in path order.  Not available
+     * once the render thread runs, use postLoadPreset(int).
+     */
+    public native boolean loadPreset(int index);
+    
     //
     public native void destroyJack();
     
@@ -137,9 +296,61 @@ public class ProjectM {
     //
     public native void reshape(int w, int h);
     
+    /**
+     * Render one frame offscreen at the current size (see reshape()) and
+     * copy an earlier, finished frame into pixels: width*height*4 bytes
+     * of RGBA, bottom row first.  The frames are read back asynchronously,
+     * so the one copied was rendered two calls earlier.  pixels must be
+     * a direct ByteBuffer; nothing is allocated per call.
+     *
+     * @return number of the frame copied into pixels, -1 while the
+     *         pipeline is still filling or on error
+     */
+    public native long renderInto(java.nio.ByteBuffer pixels);
+    
+    /**
+     * Queue audio for projectM when no JACK connection is used.  samples
+     * holds frames*channels interleaved floats; mono is duplicated to
+     * both channels, channels beyond the second are ignored.  The audio
+     * goes into a lock-free ring that render() and renderInto() drain
+     * before each frame.  Call from one thread at a time; nothing is
+     * allocated or copied on the Java side.
+     *
+     * @param samples direct FloatBuffer in native byte order, e.g.
+     *        ByteBuffer.allocateDirect(n * 4).order(ByteOrder.nativeOrder()).asFloatBuffer()
+     * @return number of frames queued, less than frames when the ring
+     *         is full, -1 on error
+     */
+    public native int addAudio(java.nio.FloatBuffer samples, int frames, int channels);
+    
+    /**
+     * Like addAudio(FloatBuffer, int, int), the array is pinned for the
+     * duration of the call instead of copied.
+     */
+    public native int addAudio(float[] samples, int frames, int channels);
+    
+    /**
+     * CPU and GPU time of the stages of the frames rendered so far:
+     * audio drain, projectM (or the test triangle), readback and buffer
+     * swap, as mean/p50/p99/max over the last 512 frames plus a
+     * histogram in power of two microsecond buckets.  GPU times come
+     * from GL timer queries read once one more frame has been
+     * rendered, so rendering never waits for them.  Can be called from any thread.
+     *
+     * @return one line per stage and one per histogram, null on error
+     */
+    public native String getStats();
+    
+    // Spawn the render thread and queue its init command, true on error
+    private native boolean startRenderThread(long id, int width, int height);
+    
+    // Queue a command for the render thread, true on error
+    private native boolean postCommand(int type, long id, int width, int height, Object arg);
+    
+    // Shut the render thread down if it runs and wait for it to end
+    private native void stopRenderThread();
+    
     
-    // TODO: Add methods to send audio from Java when no JACK connection is used
-    //public native void addAudio(float samples[]);
     
     //
     private native boolean startMainLoop();
@@ -0,0 +1,316 @@
+/* Java wrapper to use libprojectm
+ *
+ * DO NOT ALTER OR REMOVE COPYRIGHT NOTICES OR THIS HEADER.
+ *
+ * Copyright 2022 Christoph Zimmermann.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ * See 'LICENSE' included within this release
+ */
+ 
+package org.brain4free.jprojectm;
+
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+import java.nio.FloatBuffer;
+import java.util.Arrays;
+import java.util.concurrent.CompletableFuture;
+import java.util.concurrent.ExecutionException;
+
+/**
+ * <p>
+ * Benchmarks of the native binding, run with:
+   java -cp . -Djava.library.path=org/brain4free/jprojectm/ org.brain4free.jprojectm.ProjectMBench [instances [N] | latency]
+ * </p>
+ *
+ * <p>
+ * frames: renderInto() throughput at 720p and 1080p
+ * </p>
+ *
+ * <p>
+ * audio: addAudio() calls per second with 512 frame stereo chunks, for
+ * the direct FloatBuffer and the float[] variant.  Measured JMH style:
+ * warm-up iterations first, then the mean and standard deviation over
+ * the measurement iterations.  The main thread keeps rendering, so the
+ * ring is drained the way it is in an application.
+ * </p>
+ *
+ * <p>
+ * instances N: N independent instances (default: one per core), each
+ * with its own headless context, projectM and thread, render at the
+ * same time.  Checks that every instance delivers all its frames and
+ * reports the per-instance and the total frame rate.  Exits with 1 on
+ * failure.
+ * </p>
+ *
+ * <p>
+ * latency: round trip of render thread commands, posting one and
+ * waiting for its future before the next, at 720p.  Reports the
+ * median, 99th percentile and maximum for resize (to the same size)
+ * and render-to-buffer commands.  Exits with 1 on failure.
+ * </p>
+ */
+
+public class ProjectMBench {
+
+    static final double SECONDS = 5.0;
+    static final int WARMUP = 30;
+
+    static final int AUDIO_FRAMES = 512;
+    static final int AUDIO_WARMUP_ITERATIONS = 5;
+    static final int AUDIO_ITERATIONS = 10;
+    static final double AUDIO_ITERATION_SECONDS = 1.0;
+
+    static final int INSTANCE_WIDTH = 640;
+    static final int INSTANCE_HEIGHT = 360;
+    static final int INSTANCE_FRAMES = 300;
+
+    static final int LATENCY_COMMANDS = 1000;
+
+    /* frames per second of renderInto() at w x h */
+    static double frames(ProjectM projectM, int w, int h) {
+        ByteBuffer pixels = ByteBuffer.allocateDirect(w * h * 4);
+        long frames = 0;
+        long start, elapsed;
+
+        projectM.reshape(w, h);
+        for (int i = 0; i < WARMUP; i++) {
+            projectM.renderInto(pixels);
+        }
+        start = System.nanoTime();
+        do {
+            if (projectM.renderInto(pixels) < 0) {
+                System.err.println("ERROR: renderInto() failed at " + w + "x" + h);
+                return 0;
+            }
+            frames++;
+            elapsed = System.nanoTime() - start;
+        } while (elapsed < SECONDS * 1e9);
+        return frames / (elapsed * 1e-9);
+    }
+
+    /* one addAudio() call, with either buffer kind */
+    interface AudioCall {
+        int add(ProjectM projectM);
+    }
+
+    /* addAudio() calls per second; renders on this thread meanwhile */
+    static void audio(final ProjectM projectM, String name, final AudioCall call)
+        throws InterruptedException {
+        final int iterations = AUDIO_WARMUP_ITERATIONS + AUDIO_ITERATIONS;
+        final double[] rates = new double[iterations];
+        final long[] dropped = new long[1];
+        Thread producer = new Thread() {
+            public void run() {
+                for (int i = 0; i < iterations; i++) {
+                    long calls = 0;
+                    long start = System.nanoTime(), elapsed;
+                    do {
+                        dropped[0] += AUDIO_FRAMES - call.add(projectM);
+                        calls++;
+                        elapsed = System.nanoTime() - start;
+                    } while (elapsed < AUDIO_ITERATION_SECONDS * 1e9);
+                    rates[i] = calls / (elapsed * 1e-9);
+                }
+            }
+        };
+        ByteBuffer pixels = ByteBuffer.allocateDirect(320 * 240 * 4);
+        double mean = 0, variance = 0;
+
+        projectM.reshape(320, 240);
+        producer.start();
+        while (producer.isAlive()) {
+            projectM.renderInto(pixels);
+        }
+        producer.join();
+
+        for (int i = AUDIO_WARMUP_ITERATIONS; i < iterations; i++) {
+            mean += rates[i] / AUDIO_ITERATIONS;
+        }
+        for (int i = AUDIO_WARMUP_ITERATIONS; i < iterations; i++) {
+            variance += (rates[i] - mean) * (rates[i] - mean) / (AUDIO_ITERATIONS - 1);
+        }
+        System.out.printf("addAudio %s, %d frames: %.0f +- %.0f calls/s, %.1f Msamples/s, %d frames dropped%n",
+                          name, AUDIO_FRAMES, mean, Math.sqrt(variance),
+                          mean * AUDIO_FRAMES * 2 / 1e6, dropped[0]);
+    }
+
+    /* one headless instance on its own thread; fps, or -1 on failure */
+    static double instance(int n) {
+        ProjectM projectM = new ProjectM();
+        ByteBuffer pixels = ByteBuffer.allocateDirect(INSTANCE_WIDTH * INSTANCE_HEIGHT * 4);
+        long delivered = 0, last = -1, start, elapsed;
+        boolean drawn = false;
+
+        try {
+            if (projectM.initHeadless(INSTANCE_WIDTH, INSTANCE_HEIGHT)
+                || projectM.initShaders()
+                || projectM.initTexture(256)
+                || projectM.initProjectm()) {
+                System.err.println("ERROR: instance " + n + " failed to initialize");
+                return -1;
+            }
+            start = System.nanoTime();
+            for (int i = 0; i < INSTANCE_FRAMES; i++) {
+                long frame = projectM.renderInto(pixels);
+                if (frame >= 0) {
+                    if (frame != last + 1) {
+                        System.err.println("ERROR: instance " + n + " skipped from frame "
+                                           + last + " to " + frame);
+                        return -1;
+                    }
+                    last = frame;
+                    delivered++;
+                }
+            }
+            elapsed = System.nanoTime() - start;
+            for (int i = 0; i < pixels.capacity() && !drawn; i++) {
+                drawn = pixels.get(i) != 0;
+            }
+            if (delivered == 0 || !drawn) {
+                System.err.println("ERROR: instance " + n + " delivered no image");
+                return -1;
+            }
+            return delivered / (elapsed * 1e-9);
+        } finally {
+            projectM.close();
+        }
+    }
+
+    /* N instances rendering concurrently, false if any of them failed */
+    static boolean instances(int count) throws InterruptedException {
+        final double[] fps = new double[count];
+        Thread[] threads = new Thread[count];
+        double total = 0;
+        boolean ok = true;
+
+        for (int i = 0; i < count; i++) {
+            final int n = i;
+            threads[i] = new Thread() {
+                public void run() {
+                    fps[n] = instance(n);
+                }
+            };
+            threads[i].start();
+        }
+        for (int i = 0; i < count; i++) {
+            threads[i].join();
+            if (fps[i] < 0) {
+                ok = false;
+            } else {
+                System.out.printf("instance %d: %.1f fps%n", i, fps[i]);
+                total += fps[i];
+            }
+        }
+        System.out.printf("%d instances %dx%d: %.1f fps total%n",
+                          count, INSTANCE_WIDTH, INSTANCE_HEIGHT, total);
+        return ok;
+    }
+
+    /* command round trips, posted by post, in microseconds sorted */
+    interface Command {
+        CompletableFuture<Long> post(ProjectM projectM);
+    }
+
+    static double[] roundTrips(ProjectM projectM, Command command)
+        throws InterruptedException, ExecutionException {
+        double[] micros = new double[LATENCY_COMMANDS];
+
+        for (int i = 0; i < WARMUP; i++) {
+            command.post(projectM).get();
+        }
+        for (int i = 0; i < LATENCY_COMMANDS; i++) {
+            long start = System.nanoTime();
+            command.post(projectM).get();
+            micros[i] = (System.nanoTime() - start) / 1e3;
+        }
+        Arrays.sort(micros);
+        return micros;
+    }
+
+    static void printLatency(String name, double[] micros) {
+        System.out.printf("%s: p50 %.0f us, p99 %.0f us, max %.0f us (%d commands)%n",
+                          name, micros[micros.length / 2],
+                          micros[micros.length * 99 / 100],
+                          micros[micros.length - 1], micros.length);
+    }
+
+    /* render thread round trips at 720p, false on failure */
+    static boolean latency() throws InterruptedException {
+        final int w = 1280, h = 720;
+        final ByteBuffer pixels = ByteBuffer.allocateDirect(w * h * 4);
+        ProjectM projectM = new ProjectM();
+
+        try {
+            if (projectM.startRenderThread(w, h).get() != 0) {
+                System.err.println("ERROR: the render thread failed to initialize");
+                return false;
+            }
+            printLatency("resize", roundTrips(projectM, new Command() {
+                public CompletableFuture<Long> post(ProjectM p) { return p.postResize(w, h); }
+            }));
+            printLatency("render " + w + "x" + h, roundTrips(projectM, new Command() {
+                public CompletableFuture<Long> post(ProjectM p) { return p.postRenderInto(pixels); }
+            }));
+            return true;
+        } catch (ExecutionException e) {
+            System.err.println("ERROR: " + e.getCause().getMessage());
+            return false;
+        } finally {
+            projectM.close();
+        }
+    }
+
+    public static void main(String[] args) throws InterruptedException {
+        if (args.length > 0 && args[0].equals("latency")) {
+            System.exit(latency() ? 0 : 1);
+        }
+        if (args.length > 0 && args[0].equals("instances")) {
+            int count = args.length > 1 ? Integer.parseInt(args[1])
+                                        : Runtime.getRuntime().availableProcessors();
+            System.exit(instances(count) ? 0 : 1);
+        }
+
+        ProjectM projectM = new ProjectM();
+        int[][] sizes = { {1280, 720}, {1920, 1080} };
+
+        projectM.initGlWindow();
+        projectM.initShaders();
+        projectM.initTexture(256);
+
+        for (int[] size : sizes) {
+            double fps = frames(projectM, size[0], size[1]);
+            System.out.printf("renderInto %dx%d: %.1f fps, %.1f MB/s%n",
+                              size[0], size[1], fps,
+                              fps * size[0] * size[1] * 4 / 1e6);
+        }
+
+        final FloatBuffer buffer = ByteBuffer.allocateDirect(AUDIO_FRAMES * 2 * 4)
+            .order(ByteOrder.nativeOrder()).asFloatBuffer();
+        final float[] array = new float[AUDIO_FRAMES * 2];
+        for (int i = 0; i < AUDIO_FRAMES * 2; i++) {
+            array[i] = (float)Math.sin(i * 0.05);
+            buffer.put(i, array[i]);
+        }
+        audio(projectM, "FloatBuffer", new AudioCall() {
+            public int add(ProjectM p) { return p.addAudio(buffer, AUDIO_FRAMES, 2); }
+        });
+        audio(projectM, "float[]", new AudioCall() {
+            public int add(ProjectM p) { return p.addAudio(array, AUDIO_FRAMES, 2); }
+        });
+
+        projectM.close();
+    }
+}
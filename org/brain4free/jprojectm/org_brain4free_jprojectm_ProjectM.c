@@ -28,6 +28,8 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
+#include <limits.h>
 
 /* TODO: Make JACK optional with define */
 #include <jack/jack.h>
@@ -36,28 +38,131 @@
 #include <GL/freeglut.h>
 #include <libprojectM/projectM.h>
 
+#include "gradient-gen.h"
+#include "headless.h"
+#include "pcm-ring.h"
+#include "preset-cache.h"
+#include "preset-loader.h"
+#include "preset-warmup.h"
+#include "program-cache.h"
+#include "readback.h"
+#include "stage-timer.h"
 #include "org_brain4free_jprojectm_ProjectM.h"
 
+/*-----------------------------------------------------------------------------
+ * Native context, one per Java ProjectM object
+ * ---------------------------------------------------------------------------*/
+/* audio from addAudio(), interleaved stereo, drained before each frame */
+#define AUDIO_RING_SAMPLES (1 << 17)
+#define AUDIO_CHUNK_FRAMES 1024
+
+/* frames in flight between rendering and renderInto() delivering them */
+#define EXPORT_READBACK_DEPTH 3
+
+/* frame budget for counting the frames a preset switch stalls */
+#define PRESET_FRAME_PERIOD (1.0 / 60)
+
+/* commands for the render thread, the values match ProjectM.java */
+#define COMMAND_QUEUE_SIZE 64
+enum {
+    COMMAND_INIT = 0,
+    COMMAND_LOAD_PRESET = 1,
+    COMMAND_RESIZE = 2,
+    COMMAND_RENDER = 3,
+    COMMAND_SHUTDOWN = 4
+};
+
+typedef struct render_command {
+    int type;
+    jlong id;                   /* handed back to ProjectM.completed() */
+    jint width;
+    jint height;
+    jobject arg;                /* global ref: preset url or ByteBuffer */
+} render_command_t;
+
+/**
+ * Everything one visualizer owns.  Java keeps the pointer in the long
+ * field "handle" of its ProjectM object, so any number of them can live
+ * in one JVM.  Each instance is used from one thread at a time; its GL
+ * context is made current on whichever thread calls in.
+ */
+typedef struct projectm_context {
+    jack_port_t *input_port1;
+    jack_port_t *input_port2;
+    jack_port_t *output_port1;
+    jack_port_t *output_port2;
+    jack_client_t *client;
+
+    projectm_handle projectm;
+    preset_loader_t preset_loader;
+    preset_cache_t preset_cache;    /* see openPresetDirectory() */
+    preset_warmup_t preset_warmup;  /* compiles the presets after loadPreset(int) */
+
+    pcm_ring_t audio_ring;
+    float audio_chunk[2 * AUDIO_CHUNK_FRAMES];
+    float *audio_drain_buffer;
+    unsigned int audio_drain_size;
+
+    /* GL context: the GLUT window, or an offscreen one from initHeadless() */
+    int window;
+    int headless;
+    headless_t offscreen;
+
+    GLuint vao;
+    GLuint vbo;
+    GLuint idx;
+    GLuint texture_id;
+    gradient_cache_t gradient_cache;
+    GLuint program;
+    int width;
+    int height;
+
+    /* offscreen target of renderInto(), created at the current size */
+    GLuint export_fbo;
+    GLuint export_color;
+    GLuint export_depth;
+    int export_width;
+    int export_height;
+    readback_t export_readback;
+    uint8_t *export_buffer;
+    long export_frame;
+
+    /* CPU/GPU time per stage of the frame, see getStats() */
+    stage_timer_t stage_timer;
+
+    /* render thread that owns the GL context, see startRenderThread() */
+    pthread_t thread;
+    int thread_started;         /* joinable, GL belongs to the thread */
+    int thread_stopping;        /* shutdown posted, no more commands */
+    int thread_attached;        /* 1 attached to the JVM, -1 failed, 0 not yet */
+    pthread_mutex_t queue_lock;
+    pthread_cond_t queue_cond;
+    render_command_t queue[COMMAND_QUEUE_SIZE];
+    unsigned int queue_head;
+    unsigned int queue_tail;
+    JavaVM *vm;
+    jobject object;             /* global ref to the Java ProjectM */
+} projectm_context_t;
+
+void drawFrame(projectm_context_t *ctx);
+void resize(projectm_context_t *ctx, int w, int h);
+
 /*-----------------------------------------------------------------------------
  * Global variables
  * ---------------------------------------------------------------------------*/
-jack_port_t *input_port1;
-jack_port_t *input_port2;
-jack_port_t *output_port1;
-jack_port_t *output_port2;
-jack_client_t *client;
-
-projectm_handle projectm;
-
-GLuint vao;
-GLuint vbo;
-GLuint idx;
-GLuint texture_id;
-GLuint vertexShader;
-GLuint fragmentShader;
-GLuint program;
-int width = 320;
-int height = 240;
+/* field ProjectM.handle and method ProjectM.completed(), looked up
+ * once in JNI_OnLoad() */
+jfieldID handle_field;
+jmethodID completed_method;
+
+/* the context whose render thread this is, NULL on other threads */
+__thread projectm_context_t *render_thread_context;
+
+/* GLUT has one window per process and its callbacks take no argument */
+projectm_context_t *glut_context;
+
+/* glewInit() fills in global function pointers */
+pthread_mutex_t glew_lock = PTHREAD_MUTEX_INITIALIZER;
 
 /*-----------------------------------------------------------------------------
  * Shaders (to be removed)
@@ -102,14 +207,15 @@ unsigned int indices[] = { 0, 1, 2 };
  */
 int process (jack_nframes_t nframes, void *arg)
 {
+	projectm_context_t *ctx = arg;
 	jack_default_audio_sample_t *in, *out;
 	
-	in = jack_port_get_buffer (input_port1, nframes);
-	out = jack_port_get_buffer (output_port1, nframes);
+	in = jack_port_get_buffer (ctx->input_port1, nframes);
+	out = jack_port_get_buffer (ctx->output_port1, nframes);
 	memcpy (out, in,
 		sizeof (jack_default_audio_sample_t) * nframes);
-    in = jack_port_get_buffer (input_port2, nframes);
-	out = jack_port_get_buffer (output_port2, nframes);
+    in = jack_port_get_buffer (ctx->input_port2, nframes);
+	out = jack_port_get_buffer (ctx->output_port2, nframes);
 	memcpy (out, in,
 		sizeof (jack_default_audio_sample_t) * nframes);
 	return 0;
@@ -126,20 +232,21 @@ void jack_shutdown (void *arg)
 
 void render(void)
 {
-    //projectm_render_frame(projectm);
-    glBindTexture(GL_TEXTURE_2D, texture_id);
-    glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
-    glClear(GL_COLOR_BUFFER_BIT);
-    glUseProgram(program);
-    glDrawElements(GL_TRIANGLES, 3, GL_UNSIGNED_INT, (void *)0);
+    if (glut_context == NULL) {
+        return;
+    }
+    drawFrame(glut_context);
+    stage_timer_begin(&glut_context->stage_timer, STAGE_SWAP);
     glutSwapBuffers();
+    stage_timer_end(&glut_context->stage_timer, STAGE_SWAP);
 }
 
 void reshape(int w, int h)
 {
-	width = w; height = h;
-    glViewport(0, 0, (GLsizei)w, (GLsizei)h);
-    //projectm_set_window_size(projectm, x, y);
+    if (glut_context == NULL) {
+        return;
+    }
+    resize(glut_context, w, h);
 }
 
 /*-----------------------------------------------------------------------------
@@ -153,51 +260,433 @@ void printError(const char *context)
   }
 }
 
-void printStatus(const char *step, GLuint context, GLuint status)
+/**
+ * Copy frames of interleaved audio with any channel count into the
+ * stereo ring: mono is duplicated, channels beyond the second dropped.
+ * Returns the number of frames the ring took.
+ */
+size_t pushAudio(projectm_context_t *ctx, const float *samples, size_t frames, int channels)
 {
-  GLint result = GL_FALSE;
-  if (status == GL_COMPILE_STATUS)
-    glGetShaderiv(context, status, &result);
-  else
-    glGetProgramiv(context, status, &result);
-  if (result == GL_FALSE) {
-    char buffer[1024];
-    if (status == GL_COMPILE_STATUS)
-      glGetShaderInfoLog(context, 1024, NULL, buffer);
-    else
-      glGetProgramInfoLog(context, 1024, NULL, buffer);
-    if (buffer[0]) {
-      fprintf(stderr, "%s: %s\n", step, buffer);
+    size_t done = 0, i, n;
+
+    if (channels == 2) {
+        return pcm_ring_write(&ctx->audio_ring, samples, 2 * frames) / 2;
+    }
+    while (done < frames) {
+        n = frames - done < AUDIO_CHUNK_FRAMES ? frames - done : AUDIO_CHUNK_FRAMES;
+        for (i = 0; i < n; i++) {
+            const float *frame = samples + (done + i) * channels;
+            ctx->audio_chunk[2 * i] = frame[0];
+            ctx->audio_chunk[2 * i + 1] = frame[channels > 1 ? 1 : 0];
+        }
+        i = pcm_ring_write(&ctx->audio_ring, ctx->audio_chunk, 2 * n) / 2;
+        done += i;
+        if (i < n) {
+            break;
+        }
+    }
+    return done;
+}
+
+/* feed everything addAudio() queued to projectM, in chunks it accepts */
+void drainAudio(projectm_context_t *ctx)
+{
+    size_t n;
+
+    if (ctx->audio_drain_buffer == NULL) {
+        return;
+    }
+    while ((n = pcm_ring_read(&ctx->audio_ring, ctx->audio_drain_buffer,
+                              2 * ctx->audio_drain_size)) > 0) {
+        if (ctx->projectm != NULL) {
+            projectm_pcm_add_float(ctx->projectm, ctx->audio_drain_buffer, n / 2, PROJECTM_STEREO);
+        }
+    }
+}
+
+/**
+ * Hand a preset the loader thread finished reading to projectM, between
+ * two frames, so loadPreset() never waits for the file.
+ */
+void applyPreset(projectm_context_t *ctx)
+{
+    preset_buffer_t *preset;
+    preset_loader_stats_t stats;
+    double start;
+
+    if (ctx->projectm == NULL ||
+        (preset = preset_loader_poll(&ctx->preset_loader)) == NULL) {
+        return;
+    }
+    printf("INFO: New preset %s\n", preset->url);
+    start = preset_loader_now();
+    projectm_load_preset_data(ctx->projectm, preset->data, false);
+    projectm_lock_preset(ctx->projectm, true);
+    preset_loader_applied(&ctx->preset_loader, preset, preset_loader_now() - start,
+                          PRESET_FRAME_PERIOD);
+
+    preset_loader_stats(&ctx->preset_loader, &stats);
+    printf("INFO: preset read in %.2f ms off the render thread, applied in %.2f ms, "
+           "%.1f ms after the request, %lu frames stalled\n",
+           stats.last_read * 1e3, stats.last_apply * 1e3, stats.last_latency * 1e3,
+           stats.last_stalled);
+}
+
+/* draw one frame into the currently bound framebuffer */
+void drawFrame(projectm_context_t *ctx)
+{
+    stage_timer_frame(&ctx->stage_timer);
+    applyPreset(ctx);
+    stage_timer_begin(&ctx->stage_timer, STAGE_AUDIO);
+    drainAudio(ctx);
+    stage_timer_end(&ctx->stage_timer, STAGE_AUDIO);
+    glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    if (ctx->projectm != NULL) {
+        stage_timer_begin(&ctx->stage_timer, STAGE_RENDER);
+        projectm_render_frame(ctx->projectm);
+        stage_timer_end(&ctx->stage_timer, STAGE_RENDER);
+    } else {
+        stage_timer_begin(&ctx->stage_timer, STAGE_DRAW);
+        glBindTexture(GL_TEXTURE_2D, ctx->texture_id);
+        glUseProgram(ctx->program);
+        glBindVertexArray(ctx->vao);
+        glDrawElements(GL_TRIANGLES, 3, GL_UNSIGNED_INT, (void *)0);
+        stage_timer_end(&ctx->stage_timer, STAGE_DRAW);
+    }
+}
+
+/* readback callback: copy the finished frame into the caller's buffer */
+void exportFrame(const uint8_t *pixels, int w, int h, long frame, void *user)
+{
+    projectm_context_t *ctx = user;
+
+    memcpy(ctx->export_buffer, pixels, (size_t)w * h * 4);
+    ctx->export_frame = frame;
+}
+
+void destroyExport(projectm_context_t *ctx)
+{
+    if (ctx->export_fbo == 0) {
+        return;
+    }
+    readback_destroy(&ctx->export_readback);
+    glDeleteFramebuffers(1, &ctx->export_fbo);
+    glDeleteRenderbuffers(1, &ctx->export_color);
+    glDeleteRenderbuffers(1, &ctx->export_depth);
+    ctx->export_fbo = ctx->export_color = ctx->export_depth = 0;
+    ctx->export_width = ctx->export_height = 0;
+}
+
+/* (re)create the offscreen framebuffer and its readback ring for w x h */
+int setupExport(projectm_context_t *ctx, int w, int h)
+{
+    destroyExport(ctx);
+
+    glGenRenderbuffers(1, &ctx->export_color);
+    glBindRenderbuffer(GL_RENDERBUFFER, ctx->export_color);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, w, h);
+    glGenRenderbuffers(1, &ctx->export_depth);
+    glBindRenderbuffer(GL_RENDERBUFFER, ctx->export_depth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, w, h);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glGenFramebuffers(1, &ctx->export_fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, ctx->export_fbo);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                              GL_RENDERBUFFER, ctx->export_color);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT,
+                              GL_RENDERBUFFER, ctx->export_depth);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        fprintf(stderr, "ERROR: offscreen framebuffer %dx%d incomplete\n", w, h);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        destroyExport(ctx);
+        return -1;
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    ctx->export_width = w;
+    ctx->export_height = h;
+    if (readback_init(&ctx->export_readback, w, h, EXPORT_READBACK_DEPTH,
+                      exportFrame, ctx)) {
+        destroyExport(ctx);
+        return -1;
+    }
+    printf("INFO: offscreen export %dx%d, %d frames in flight\n",
+           w, h, EXPORT_READBACK_DEPTH);
+    return 0;
+}
+
+/* the context of a Java ProjectM object, NULL after close() */
+projectm_context_t *getContext(JNIEnv *env, jobject thisObject)
+{
+    return (projectm_context_t *)(intptr_t)
+        (*env)->GetLongField(env, thisObject, handle_field);
+}
+
+/**
+ * Once the render thread runs, only it may use the instance.
+ * Returns -1 on any other thread.
+ */
+int checkThread(projectm_context_t *ctx)
+{
+    if (ctx->thread_started && render_thread_context != ctx) {
+        fprintf(stderr, "ERROR: the render thread owns this instance, post a command instead\n");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Make the instance's GL context current on the calling thread.
+ * Returns -1 when it has none yet.
+ */
+int makeCurrent(projectm_context_t *ctx)
+{
+    if (checkThread(ctx)) {
+        return -1;
+    }
+    if (ctx->headless) {
+        return headless_make_current(&ctx->offscreen);
+    }
+    return ctx->window ? 0 : -1;
+}
+
+void resize(projectm_context_t *ctx, int w, int h)
+{
+    ctx->width = w; ctx->height = h;
+    glViewport(0, 0, (GLsizei)w, (GLsizei)h);
+    if (ctx->projectm != NULL) {
+        projectm_set_window_size(ctx->projectm, w, h);
     }
-  }
 }
 
-void printCompileStatus(const char *step, GLuint context)
+/*-----------------------------------------------------------------------------
+ * Render thread
+ * ---------------------------------------------------------------------------*/
+/**
+ * Queue a command for the render thread.  Called with queue_lock held.
+ * Returns -1 when the queue is full or the thread is shutting down.
+ */
+int queueCommand(projectm_context_t *ctx, int type, jlong id,
+                 jint w, jint h, jobject arg)
 {
-  printStatus(step, context, GL_COMPILE_STATUS);
+    render_command_t *command;
+
+    if (ctx->thread_stopping ||
+        ctx->queue_head - ctx->queue_tail == COMMAND_QUEUE_SIZE) {
+        return -1;
+    }
+    command = &ctx->queue[ctx->queue_head % COMMAND_QUEUE_SIZE];
+    command->type = type;
+    command->id = id;
+    command->width = w;
+    command->height = h;
+    command->arg = arg;
+    ctx->queue_head++;
+    if (type == COMMAND_SHUTDOWN) {
+        ctx->thread_stopping = 1;
+    }
+    pthread_cond_signal(&ctx->queue_cond);
+    return 0;
 }
 
-void printLinkStatus(const char *step, GLuint context)
+/**
+ * Owns the instance's headless GL context and runs the commands Java
+ * posts, in order.  Every command is answered with a call to
+ * ProjectM.completed(id, result) from this thread.  The commands call
+ * the same natives Java would, with this thread's JNIEnv.
+ */
+void *renderThread(void *arg)
 {
-  printStatus(step, context, GL_LINK_STATUS);
+    projectm_context_t *ctx = arg;
+    jobject self = ctx->object;
+    render_command_t command;
+    JNIEnv *env;
+    jlong result;
+    int done = 0, failed;
+
+    /* startRenderThread() waits for this, it answers for us if it fails */
+    failed = (*ctx->vm)->AttachCurrentThread(ctx->vm, (void **)&env, NULL) != JNI_OK;
+    pthread_mutex_lock(&ctx->queue_lock);
+    ctx->thread_attached = failed ? -1 : 1;
+    pthread_cond_broadcast(&ctx->queue_cond);
+    pthread_mutex_unlock(&ctx->queue_lock);
+    if (failed) {
+        fprintf(stderr, "ERROR: cannot attach the render thread to the JVM\n");
+        return NULL;
+    }
+    render_thread_context = ctx;
+
+    while (!done) {
+        pthread_mutex_lock(&ctx->queue_lock);
+        while (ctx->queue_head == ctx->queue_tail) {
+            pthread_cond_wait(&ctx->queue_cond, &ctx->queue_lock);
+        }
+        command = ctx->queue[ctx->queue_tail % COMMAND_QUEUE_SIZE];
+        ctx->queue_tail++;
+        pthread_mutex_unlock(&ctx->queue_lock);
+
+        result = 0;
+        switch (command.type) {
+        case COMMAND_INIT:
+            if (Java_org_brain4free_jprojectm_ProjectM_initHeadless(env, self, command.width, command.height)
+                || Java_org_brain4free_jprojectm_ProjectM_initShaders(env, self)
+                || Java_org_brain4free_jprojectm_ProjectM_initTexture(env, self, 256)
+                || Java_org_brain4free_jprojectm_ProjectM_initProjectm(env, self)) {
+                result = -1;
+            }
+            break;
+        case COMMAND_LOAD_PRESET:
+            /* a preset url, or without one preset number width of the directory */
+            if (command.arg != NULL
+                ? Java_org_brain4free_jprojectm_ProjectM_loadPreset__Ljava_lang_String_2(env, self, command.arg)
+                : Java_org_brain4free_jprojectm_ProjectM_loadPreset__I(env, self, command.width)) {
+                result = -1;
+            }
+            break;
+        case COMMAND_RESIZE:
+            Java_org_brain4free_jprojectm_ProjectM_reshape(env, self, command.width, command.height);
+            break;
+        case COMMAND_RENDER:
+            result = Java_org_brain4free_jprojectm_ProjectM_renderInto(env, self, command.arg);
+            break;
+        case COMMAND_SHUTDOWN:
+            Java_org_brain4free_jprojectm_ProjectM_destroyGl(env, self);
+            Java_org_brain4free_jprojectm_ProjectM_destroyProjectm(env, self);
+            if (ctx->headless) {
+                headless_destroy(&ctx->offscreen);
+                ctx->headless = 0;
+            }
+            done = 1;
+            break;
+        }
+
+        if (command.arg != NULL) {
+            (*env)->DeleteGlobalRef(env, command.arg);
+        }
+        (*env)->CallVoidMethod(env, self, completed_method, command.id, result);
+        if ((*env)->ExceptionCheck(env)) {
+            (*env)->ExceptionDescribe(env);
+            (*env)->ExceptionClear(env);
+        }
+    }
+
+    render_thread_context = NULL;
+    (*ctx->vm)->DetachCurrentThread(ctx->vm);
+    return NULL;
 }
 
 /*-----------------------------------------------------------------------------
  * Functions exported to Java
  * ---------------------------------------------------------------------------*/
+JNIEXPORT jint JNICALL JNI_OnLoad(JavaVM *vm, void *reserved)
+{
+    JNIEnv *env;
+    jclass cls;
+
+    if ((*vm)->GetEnv(vm, (void **)&env, JNI_VERSION_1_6) != JNI_OK) {
+        return JNI_ERR;
+    }
+    cls = (*env)->FindClass(env, "org/brain4free/jprojectm/ProjectM");
+    if (cls == NULL) {
+        return JNI_ERR;
+    }
+    handle_field = (*env)->GetFieldID(env, cls, "handle", "J");
+    completed_method = (*env)->GetMethodID(env, cls, "completed", "(JJ)V");
+    if (handle_field == NULL || completed_method == NULL) {
+        return JNI_ERR;
+    }
+    return JNI_VERSION_1_6;
+}
+
+JNIEXPORT jlong JNICALL Java_org_brain4free_jprojectm_ProjectM_create
+  (JNIEnv* env, jclass cls)
+{
+    /* the audio ring is cache line aligned, so the context must be too */
+    size_t size = (sizeof(projectm_context_t) + PCM_RING_CACHE_LINE - 1)
+                  & ~(size_t)(PCM_RING_CACHE_LINE - 1);
+    projectm_context_t *ctx = aligned_alloc(PCM_RING_CACHE_LINE, size);
+
+    if (ctx == NULL) {
+        fprintf(stderr, "ERROR: cannot allocate projectM context\n");
+        return 0;
+    }
+    memset(ctx, 0, sizeof(projectm_context_t));
+    pthread_mutex_init(&ctx->queue_lock, NULL);
+    pthread_cond_init(&ctx->queue_cond, NULL);
+    ctx->width = 320;
+    ctx->height = 240;
+
+    /* allocate the audio ring up front, addAudio() may come before
+     * anything else and must not allocate */
+    if (pcm_ring_init(&ctx->audio_ring, AUDIO_RING_SAMPLES, 2)) {
+        fprintf(stderr, "ERROR: cannot allocate audio ring\n");
+        free(ctx);
+        return 0;
+    }
+    ctx->audio_drain_size = projectm_pcm_get_max_samples();
+    ctx->audio_drain_buffer = malloc(2 * ctx->audio_drain_size * sizeof(float));
+    if (ctx->audio_drain_buffer == NULL) {
+        fprintf(stderr, "ERROR: cannot allocate audio buffer\n");
+        pcm_ring_free(&ctx->audio_ring);
+        free(ctx);
+        return 0;
+    }
+    stage_timer_init(&ctx->stage_timer);
+    return (jlong)(intptr_t)ctx;
+}
+
+JNIEXPORT void JNICALL Java_org_brain4free_jprojectm_ProjectM_dispose
+  (JNIEnv* env, jclass cls, jlong handle)
+{
+    projectm_context_t *ctx = (projectm_context_t *)(intptr_t)handle;
+
+    if (ctx == NULL) {
+        return;
+    }
+    if (ctx->headless) {
+        headless_destroy(&ctx->offscreen);
+    }
+    if (glut_context == ctx) {
+        glut_context = NULL;
+    }
+    if (ctx->preset_warmup.running) {
+        preset_warmup_stats_t stats;
+        preset_warmup_stats(&ctx->preset_warmup, &stats);
+        printf("INFO: %d of %d presets warmed up in %.1f ms%s\n", stats.warm,
+               stats.presets, stats.seconds * 1e3,
+               stats.parallel ? " with parallel shader compile" : "");
+    }
+    preset_warmup_free(&ctx->preset_warmup);
+    preset_loader_free(&ctx->preset_loader);
+    preset_cache_close(&ctx->preset_cache);
+    free(ctx->audio_drain_buffer);
+    pcm_ring_free(&ctx->audio_ring);
+    stage_timer_free(&ctx->stage_timer);
+    pthread_mutex_destroy(&ctx->queue_lock);
+    pthread_cond_destroy(&ctx->queue_cond);
+    free(ctx);
+}
+
 JNIEXPORT jboolean JNICALL Java_org_brain4free_jprojectm_ProjectM_initJackPorts
   (JNIEnv* env, jobject thisObject)
 {
+	projectm_context_t *ctx = getContext(env, thisObject);
 	const char **ports;
 	const char *client_name = "projectM-jack";
 	const char *server_name = NULL;
 	jack_options_t options = JackNullOption;
 	jack_status_t status;
 	
+	if (ctx == NULL) {
+		return(JNI_TRUE);
+	}
+
 	/* open a client connection to the JACK server */
 
-	client = jack_client_open (client_name, options, &status, server_name);
-	if (client == NULL) {
+	ctx->client = jack_client_open (client_name, options, &status, server_name);
+	if (ctx->client == NULL) {
 		fprintf (stderr, "ERROR: jack_client_open() failed, "
 			 "status = 0x%2.0x\n", status);
 		if (status & JackServerFailed) {
@@ -209,7 +698,7 @@ JNIEXPORT jboolean JNICALL Java_org_brain4free_jprojectm_ProjectM_initJackPorts
 		fprintf (stderr, "INFO: JACK server started\n");
 	}
 	if (status & JackNameNotUnique) {
-		client_name = jack_get_client_name(client);
+		client_name = jack_get_client_name(ctx->client);
 		fprintf (stderr, "ERROR: unique name `%s' assigned\n", client_name);
 	}
 
@@ -217,42 +706,42 @@ JNIEXPORT jboolean JNICALL Java_org_brain4free_jprojectm_ProjectM_initJackPorts
 	   there is work to be done.
 	*/
 
-	jack_set_process_callback (client, process, 0);
+	jack_set_process_callback (ctx->client, process, ctx);
 
 	/* tell the JACK server to call `jack_shutdown()' if
 	   it ever shuts down, either entirely, or if it
 	   just decides to stop calling us.
 	*/
 
-	jack_on_shutdown (client, jack_shutdown, 0);
+	jack_on_shutdown (ctx->client, jack_shutdown, 0);
 
 	/* display the current sample rate. 
 	 */ 
 
 	printf ("INFO: engine sample rate: %" PRIu32 "\n",
-		jack_get_sample_rate (client));
+		jack_get_sample_rate (ctx->client));
 
 	/* create two ports */
 
-	input_port1 = jack_port_register (client, "input_FL",
+	ctx->input_port1 = jack_port_register (ctx->client, "input_FL",
 					 JACK_DEFAULT_AUDIO_TYPE,
 					 JackPortIsInput, 0);
-    input_port2 = jack_port_register (client, "input_FR",
+    ctx->input_port2 = jack_port_register (ctx->client, "input_FR",
 					 JACK_DEFAULT_AUDIO_TYPE,
 					 JackPortIsInput, 0);
-	output_port1 = jack_port_register (client, "output_FL",
+	ctx->output_port1 = jack_port_register (ctx->client, "output_FL",
 					  JACK_DEFAULT_AUDIO_TYPE,
 					  JackPortIsOutput, 0);
-    output_port2 = jack_port_register (client, "output_FR",
+    ctx->output_port2 = jack_port_register (ctx->client, "output_FR",
 					  JACK_DEFAULT_AUDIO_TYPE,
 					  JackPortIsOutput, 0);
 
-	if ((input_port1 == NULL) || (output_port1 == NULL)) {
+	if ((ctx->input_port1 == NULL) || (ctx->output_port1 == NULL)) {
 		fprintf(stderr, "ERROR: no more JACK ports available\n");
 		return(JNI_TRUE);
 	}
 	
-	if ((input_port2 == NULL) || (output_port2 == NULL)) {
+	if ((ctx->input_port2 == NULL) || (ctx->output_port2 == NULL)) {
 		fprintf(stderr, "ERROR: no more JACK ports available\n");
 		return(JNI_TRUE);
 	}
@@ -260,7 +749,7 @@ JNIEXPORT jboolean JNICALL Java_org_brain4free_jprojectm_ProjectM_initJackPorts
 	/* Tell the JACK server that we are ready to roll.  Our
 	 * process() callback will start running now. */
 
-	if (jack_activate (client)) {
+	if (jack_activate (ctx->client)) {
 		fprintf (stderr, "ERROR: cannot activate client");
 		return(JNI_TRUE);
 	}
@@ -273,33 +762,33 @@ JNIEXPORT jboolean JNICALL Java_org_brain4free_jprojectm_ProjectM_initJackPorts
 	 * it.
 	 */
 
-	ports = jack_get_ports (client, NULL, NULL,
+	ports = jack_get_ports (ctx->client, NULL, NULL,
 				JackPortIsPhysical|JackPortIsOutput);
 	if (ports == NULL) {
 		fprintf(stderr, "ERROR: no physical capture ports\n");
 		return(JNI_TRUE);
 	}
 
-	if (jack_connect (client, ports[0], jack_port_name (input_port1))) {
+	if (jack_connect (ctx->client, ports[0], jack_port_name (ctx->input_port1))) {
 		fprintf (stderr, "ERROR: cannot connect input port1\n");
 	}
-	if (jack_connect (client, ports[1], jack_port_name (input_port2))) {
+	if (jack_connect (ctx->client, ports[1], jack_port_name (ctx->input_port2))) {
 		fprintf (stderr, "ERROR: cannot connect input port2\n");
 	}
 
 	free (ports);
 	
-	ports = jack_get_ports (client, NULL, NULL,
+	ports = jack_get_ports (ctx->client, NULL, NULL,
 				JackPortIsPhysical|JackPortIsInput);
 	if (ports == NULL) {
 		fprintf(stderr, "ERROR: no physical playback ports\n");
 		return(JNI_TRUE);
 	}
 
-	if (jack_connect (client, jack_port_name (output_port1), ports[0])) {
+	if (jack_connect (ctx->client, jack_port_name (ctx->output_port1), ports[0])) {
 		fprintf (stderr, "ERROR: cannot connect output port1\n");
 	}
-	if (jack_connect (client, jack_port_name (output_port2), ports[1])) {
+	if (jack_connect (ctx->client, jack_port_name (ctx->output_port2), ports[1])) {
 		fprintf (stderr, "ERROR: cannot connect output port2\n");
 	}
     
@@ -311,11 +800,22 @@ JNIEXPORT jboolean JNICALL Java_org_brain4free_jprojectm_ProjectM_initJackPorts
 JNIEXPORT jboolean JNICALL Java_org_brain4free_jprojectm_ProjectM_initGlWindow
   (JNIEnv* env, jobject thisObject)
 {
+    projectm_context_t *ctx = getContext(env, thisObject);
     int argc = 1;
     char arg[] = "libjprojectm";
     char *argv;
     argv = arg;
 
+    if (ctx == NULL) {
+        return(JNI_TRUE);
+    }
+    if (glut_context != NULL) {
+        fprintf(stderr, "ERROR: only one GLUT window per process, use initHeadless()\n");
+        return(JNI_TRUE);
+    }
+    glut_context = ctx;
+    ctx->window = 1;
+
     /* Initialize GLUT */
 	glutInit(&argc, &argv);
     glutInitContextVersion(3, 3);
@@ -323,15 +823,46 @@ JNIEXPORT jboolean JNICALL Java_org_brain4free_jprojectm_ProjectM_initGlWindow
     
 	//Create a window with rendering context and everything else we need
     glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGB);
-	glutInitWindowSize(width, height);
+	glutInitWindowSize(ctx->width, ctx->height);
 	glutCreateWindow("projectM-jack");
     printf("INFO: GL_VERSION: %s\n", glGetString(GL_VERSION));
     printf("INFO: GL_SHADING_LANGUAGE_VERSION: %s\n", glGetString(GL_SHADING_LANGUAGE_VERSION));
     printf("INFO: GL_VENDOR: %s\n", glGetString(GL_VENDOR));
 
     
+    pthread_mutex_lock(&glew_lock);
+    glewExperimental = GL_TRUE;
+    glewInit();
+    pthread_mutex_unlock(&glew_lock);
+
+    return(JNI_FALSE);
+}
+
+JNIEXPORT jboolean JNICALL Java_org_brain4free_jprojectm_ProjectM_initHeadless
+  (JNIEnv* env, jobject thisObject, jint w, jint h)
+{
+    projectm_context_t *ctx = getContext(env, thisObject);
+
+    if (ctx == NULL || ctx->window || ctx->headless) {
+        fprintf(stderr, "ERROR: this instance already has a GL context\n");
+        return(JNI_TRUE);
+    }
+    if (headless_init(&ctx->offscreen, w, h)) {
+        fprintf(stderr, "ERROR: cannot create headless context\n");
+        headless_destroy(&ctx->offscreen);
+        return(JNI_TRUE);
+    }
+    ctx->headless = 1;
+    ctx->width = w;
+    ctx->height = h;
+    printf("INFO: headless %dx%d, %s, %s\n", w, h,
+           headless_backend(&ctx->offscreen), glGetString(GL_RENDERER));
+
+    /* no GLX here; glewInit() still loads the GL entry points */
+    pthread_mutex_lock(&glew_lock);
     glewExperimental = GL_TRUE;
     glewInit();
+    pthread_mutex_unlock(&glew_lock);
 
     return(JNI_FALSE);
 }
@@ -339,46 +870,44 @@ JNIEXPORT jboolean JNICALL Java_org_brain4free_jprojectm_ProjectM_initGlWindow
 JNIEXPORT jboolean JNICALL Java_org_brain4free_jprojectm_ProjectM_initShaders
   (JNIEnv* env, jobject thisObject)
 {
-    vertexShader = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vertexShader, 1, &vertexSource, NULL);
-    glCompileShader(vertexShader);
-    printCompileStatus("Vertex shader", vertexShader);
+    projectm_context_t *ctx = getContext(env, thisObject);
 
-    fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fragmentShader, 1, &fragmentSource, NULL);
-    glCompileShader(fragmentShader);
-    printCompileStatus("Fragment shader", fragmentShader);
+    if (ctx == NULL || makeCurrent(ctx)) {
+        fprintf(stderr, "ERROR: initShaders() needs a GL context\n");
+        return(JNI_TRUE);
+    }
 
-    program = glCreateProgram();
-    glAttachShader(program, vertexShader);
-    glAttachShader(program, fragmentShader);
-    glLinkProgram(program);
-    printLinkStatus("Shader program", program);
+    ctx->program = program_cache_build("Shader", vertexSource, fragmentSource, NULL);
+    if (ctx->program == 0) {
+        return(JNI_TRUE);
+    }
 
-    glGenVertexArrays(1, &vao);
-    glBindVertexArray(vao);
+    glGenVertexArrays(1, &ctx->vao);
+    glBindVertexArray(ctx->vao);
 
-    glGenBuffers(1, &vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glGenBuffers(1, &ctx->vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, ctx->vbo);
     glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
 
-    glGenBuffers(1, &idx);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, idx);
+    glGenBuffers(1, &ctx->idx);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ctx->idx);
     glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
 
-    glVertexAttribPointer(glGetAttribLocation(program, "point"), 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void *)0);
-    glVertexAttribPointer(glGetAttribLocation(program, "texcoord"), 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void *)(3 * sizeof(float)));
+    glVertexAttribPointer(glGetAttribLocation(ctx->program, "point"), 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void *)0);
+    glVertexAttribPointer(glGetAttribLocation(ctx->program, "texcoord"), 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void *)(3 * sizeof(float)));
 
     glEnable(GL_DEPTH_TEST);
 
-    glUseProgram(program);
+    glUseProgram(ctx->program);
 
     glEnableVertexAttribArray(0);
     glEnableVertexAttribArray(1);
   
 	//Assign the two used Msg-routines
-	glutDisplayFunc(render);
-	glutReshapeFunc(reshape);
+	if (ctx->window) {
+		glutDisplayFunc(render);
+		glutReshapeFunc(reshape);
+	}
     
     return(JNI_FALSE);
 }
@@ -386,26 +915,30 @@ JNIEXPORT jboolean JNICALL Java_org_brain4free_jprojectm_ProjectM_initShaders
 JNIEXPORT jboolean JNICALL Java_org_brain4free_jprojectm_ProjectM_initTexture
   (JNIEnv* env, jobject thisObject, jint image_size)
 {
-    /* Create some dummy image with a color gradient */
-    uint8_t *image_data = malloc(image_size * image_size * 3 * sizeof(uint8_t));
-    for(int i=0;i<image_size;i++) {
-       for(int j=0;j<image_size;j++) {
-           int p = 3*(i*image_size+j);
-           image_data[p+0] = i;
-           image_data[p+1] = j;
-           image_data[p+2] = 255-i;
-       }
+    projectm_context_t *ctx = getContext(env, thisObject);
+
+    if (ctx == NULL || makeCurrent(ctx)) {
+        fprintf(stderr, "ERROR: initTexture() needs a GL context\n");
+        return(JNI_TRUE);
+    }
+
+    /* Get the dummy image with a color gradient, generated once per size */
+    gradient_params_t gradient = gradient_params_default();
+    const uint8_t *image_data = gradient_cache_get(&ctx->gradient_cache, image_size, &gradient);
+    if (image_data == NULL) {
+        fprintf(stderr, "ERROR: no memory for a %dx%d texture\n", image_size, image_size);
+        return(JNI_TRUE);
     }
     
     /* load a texture */
         
     /* Create one OpenGL texture */
-    glGenTextures(1, &texture_id);
-    printf("INFO: texture_id %d\n", texture_id);
+    glGenTextures(1, &ctx->texture_id);
+    printf("INFO: texture_id %d\n", ctx->texture_id);
 
     /* "Bind" the newly created texture : all future texture functions will modify this texture */
     glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, texture_id);
+    glBindTexture(GL_TEXTURE_2D, ctx->texture_id);
     glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
     glTexImage2D (GL_TEXTURE_2D, 0, GL_RGB, image_size, image_size, 0, GL_RGB, GL_UNSIGNED_BYTE, image_data);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
@@ -415,26 +948,39 @@ JNIEXPORT jboolean JNICALL Java_org_brain4free_jprojectm_ProjectM_initTexture
     glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
     glGenerateMipmap(GL_TEXTURE_2D);
     
-    free(image_data);
-    
     return(JNI_FALSE);
 }
 
 JNIEXPORT jboolean JNICALL Java_org_brain4free_jprojectm_ProjectM_initProjectm
   (JNIEnv* env, jobject thisObject)
 {
+    projectm_context_t *ctx = getContext(env, thisObject);
+
+    if (ctx == NULL || makeCurrent(ctx)) {
+        fprintf(stderr, "ERROR: initProjectm() needs a GL context\n");
+        return(JNI_TRUE);
+    }
+
     /* Initialize projectM */
     printf("ProjectM max samples: %d\n",projectm_pcm_get_max_samples());
-    //projectm = projectm_create("/home/chrigi/.projectM/config.inp", 0);
-    if (projectm == NULL) {
+    ctx->projectm = projectm_create(NULL, 0);
+    if (ctx->projectm == NULL) {
 		fprintf (stderr, "projectm_create() failed\n");
 		return(JNI_TRUE);
     }
     //texture_id = projectm_init_render_to_texture(projectm);
     //projectm_set_texture_size(projectm, 2048);
-    //projectm_set_window_size(projectm, 300, 300);
+    projectm_set_window_size(ctx->projectm, ctx->width, ctx->height);
     //projectm_set_mesh_size(projectm, 128, 128);
     
+    if (!ctx->preset_loader.running) {
+        if (preset_loader_init(&ctx->preset_loader)) {
+            return(JNI_TRUE);
+        }
+        if (ctx->preset_cache.directory != NULL) {
+            preset_loader_set_cache(&ctx->preset_loader, &ctx->preset_cache);
+        }
+    }
     return(JNI_FALSE);
 }
 
@@ -453,39 +999,59 @@ JNIEXPORT void JNICALL Java_org_brain4free_jprojectm_ProjectM_init
 JNIEXPORT void JNICALL Java_org_brain4free_jprojectm_ProjectM_destroyJack
   (JNIEnv* env, jobject thisObject)
 {
+    projectm_context_t *ctx = getContext(env, thisObject);
+
     /* Clean up everything */
-	jack_client_close (client);
+    if (ctx == NULL || ctx->client == NULL) {
+        return;
+    }
+	jack_client_close (ctx->client);
+	ctx->client = NULL;
 }
 
 JNIEXPORT void JNICALL Java_org_brain4free_jprojectm_ProjectM_destroyProjectm
   (JNIEnv* env, jobject thisObject)
 {    
-    projectm_destroy(projectm);
+    projectm_context_t *ctx = getContext(env, thisObject);
+
+    if (ctx == NULL || ctx->projectm == NULL || makeCurrent(ctx)) {
+        return;
+    }
+    preset_loader_free(&ctx->preset_loader);
+    projectm_destroy(ctx->projectm);
+    ctx->projectm = NULL;
 }
 
 JNIEXPORT void JNICALL Java_org_brain4free_jprojectm_ProjectM_destroyGl
   (JNIEnv* env, jobject thisObject)
 {
+    projectm_context_t *ctx = getContext(env, thisObject);
+
+    if (ctx == NULL || makeCurrent(ctx)) {
+        return;
+    }
     glDisableVertexAttribArray(1);
     glDisableVertexAttribArray(0);
 
+    destroyExport(ctx);
+    stage_timer_release(&ctx->stage_timer);
+
     glBindTexture(GL_TEXTURE_2D, 0);
-    glDeleteTextures(1, &texture_id);
+    glDeleteTextures(1, &ctx->texture_id);
+    gradient_cache_free(&ctx->gradient_cache);
 
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-    glDeleteBuffers(1, &idx);
+    glDeleteBuffers(1, &ctx->idx);
 
     glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glDeleteBuffers(1, &vbo);
+    glDeleteBuffers(1, &ctx->vbo);
 
     glBindVertexArray(0);
-    glDeleteVertexArrays(1, &vao);
+    glDeleteVertexArrays(1, &ctx->vao);
 
-    glDetachShader(program, vertexShader);
-    glDetachShader(program, fragmentShader);
-    glDeleteProgram(program);
-    glDeleteShader(vertexShader);
-    glDeleteShader(fragmentShader);
+    glDeleteProgram(ctx->program);
+    ctx->texture_id = ctx->idx = ctx->vbo = ctx->vao = 0;
+    ctx->program = 0;
 }
 
 JNIEXPORT void JNICALL Java_org_brain4free_jprojectm_ProjectM_destroy
@@ -500,56 +1066,322 @@ JNIEXPORT void JNICALL Java_org_brain4free_jprojectm_ProjectM_destroy
 JNIEXPORT void JNICALL Java_org_brain4free_jprojectm_ProjectM_render
   (JNIEnv* env, jobject thisObject)
 {
-    //projectm_render_frame(projectm);
-    glBindTexture(GL_TEXTURE_2D, texture_id);
-    glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
-    glClear(GL_COLOR_BUFFER_BIT);
-    glUseProgram(program);
-    glDrawElements(GL_TRIANGLES, 3, GL_UNSIGNED_INT, (void *)0);
-    glutSwapBuffers();
+    projectm_context_t *ctx = getContext(env, thisObject);
+
+    if (ctx == NULL || makeCurrent(ctx)) {
+        return;
+    }
+    if (ctx->headless) {
+        headless_bind(&ctx->offscreen);
+    }
+    drawFrame(ctx);
+    if (ctx->window) {
+        stage_timer_begin(&ctx->stage_timer, STAGE_SWAP);
+        glutSwapBuffers();
+        stage_timer_end(&ctx->stage_timer, STAGE_SWAP);
+    } else {
+        glFlush();
+    }
 }
 
 JNIEXPORT void JNICALL Java_org_brain4free_jprojectm_ProjectM_renderTexture
   (JNIEnv* env, jobject thisObject)
 {
+    projectm_context_t *ctx = getContext(env, thisObject);
+
+    if (ctx == NULL || makeCurrent(ctx)) {
+        return;
+    }
     //projectm_render_frame(projectm);
-    glBindTexture(GL_TEXTURE_2D, texture_id);
+    glBindTexture(GL_TEXTURE_2D, ctx->texture_id);
 }
 
 JNIEXPORT void JNICALL Java_org_brain4free_jprojectm_ProjectM_reshape
   (JNIEnv* env, jobject thisObject, jint w, jint h)
 {
-	width = w; height = h;
-    glViewport(0, 0, (GLsizei)w, (GLsizei)h);
-    //projectm_set_window_size(projectm, x, y);
+    projectm_context_t *ctx = getContext(env, thisObject);
+
+    if (ctx == NULL || makeCurrent(ctx)) {
+        return;
+    }
+    resize(ctx, w, h);
 }
 
-JNIEXPORT jboolean JNICALL Java_org_brain4free_jprojectm_ProjectM_loadPreset
-  (JNIEnv* env, jobject thisObject, jstring presetUrl)
+JNIEXPORT jint JNICALL Java_org_brain4free_jprojectm_ProjectM_addAudio__Ljava_nio_FloatBuffer_2II
+  (JNIEnv* env, jobject thisObject, jobject samples, jint frames, jint channels)
 {
-    const char* presetUrlCharPointer = (*env)->GetStringUTFChars(env, presetUrl, 0);
-    int rating[1] = {1};
-    
-    if (projectm == NULL) {
-        fprintf (stderr, "ERROR: projectM not Initialized!\n");
+    projectm_context_t *ctx = getContext(env, thisObject);
+    const float *data = (*env)->GetDirectBufferAddress(env, samples);
+
+    if (ctx == NULL) {
+        return -1;
+    }
+    if (data == NULL || channels < 1 || frames < 0 ||
+        (*env)->GetDirectBufferCapacity(env, samples) < (jlong)frames * channels) {
+        fprintf(stderr, "ERROR: addAudio() needs a direct FloatBuffer of frames*channels\n");
+        return -1;
+    }
+    return (jint)pushAudio(ctx, data, frames, channels);
+}
+
+JNIEXPORT jint JNICALL Java_org_brain4free_jprojectm_ProjectM_addAudio___3FII
+  (JNIEnv* env, jobject thisObject, jfloatArray samples, jint frames, jint channels)
+{
+    projectm_context_t *ctx = getContext(env, thisObject);
+    float *data;
+    size_t done;
+
+    if (ctx == NULL) {
+        return -1;
+    }
+    if (channels < 1 || frames < 0 ||
+        (*env)->GetArrayLength(env, samples) < (jlong)frames * channels) {
+        fprintf(stderr, "ERROR: addAudio() needs an array of frames*channels\n");
+        return -1;
+    }
+    /* pinned, not copied; no JNI calls until it is released */
+    data = (*env)->GetPrimitiveArrayCritical(env, samples, NULL);
+    if (data == NULL) {
+        return -1;
+    }
+    done = pushAudio(ctx, data, frames, channels);
+    (*env)->ReleasePrimitiveArrayCritical(env, samples, data, JNI_ABORT);
+    return (jint)done;
+}
+
+JNIEXPORT jlong JNICALL Java_org_brain4free_jprojectm_ProjectM_renderInto
+  (JNIEnv* env, jobject thisObject, jobject buffer)
+{
+    projectm_context_t *ctx = getContext(env, thisObject);
+    uint8_t *pixels = (*env)->GetDirectBufferAddress(env, buffer);
+    jlong capacity = (*env)->GetDirectBufferCapacity(env, buffer);
+
+    if (ctx == NULL || makeCurrent(ctx)) {
+        fprintf(stderr, "ERROR: renderInto() needs a GL context\n");
+        return -1;
+    }
+    if (pixels == NULL) {
+        fprintf(stderr, "ERROR: renderInto() needs a direct ByteBuffer\n");
+        return -1;
+    }
+    if (capacity < (jlong)ctx->width * ctx->height * 4) {
+        fprintf(stderr, "ERROR: renderInto() buffer too small for %dx%d RGBA\n",
+                ctx->width, ctx->height);
+        return -1;
+    }
+    if (ctx->export_width != ctx->width || ctx->export_height != ctx->height) {
+        if (setupExport(ctx, ctx->width, ctx->height)) {
+            return -1;
+        }
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, ctx->export_fbo);
+    glViewport(0, 0, ctx->width, ctx->height);
+    drawFrame(ctx);
+
+    /* the frame that comes back was rendered EXPORT_READBACK_DEPTH-1 calls ago */
+    ctx->export_buffer = pixels;
+    ctx->export_frame = -1;
+    stage_timer_begin(&ctx->stage_timer, STAGE_READBACK);
+    readback_frame(&ctx->export_readback);
+    stage_timer_end(&ctx->stage_timer, STAGE_READBACK);
+    ctx->export_buffer = NULL;
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    return ctx->export_frame;
+}
+
+JNIEXPORT jstring JNICALL Java_org_brain4free_jprojectm_ProjectM_getStats
+  (JNIEnv* env, jobject thisObject)
+{
+    projectm_context_t *ctx = getContext(env, thisObject);
+    jstring stats;
+    char *text;
+
+    if (ctx == NULL) {
+        return NULL;
+    }
+    /* only reads the stats under their lock, no GL context needed */
+    if ((text = stage_timer_text(&ctx->stage_timer)) == NULL) {
+        return NULL;
+    }
+    stats = (*env)->NewStringUTF(env, text);
+    free(text);
+    return stats;
+}
+
+JNIEXPORT jboolean JNICALL Java_org_brain4free_jprojectm_ProjectM_startRenderThread
+  (JNIEnv* env, jobject thisObject, jlong id, jint w, jint h)
+{
+    projectm_context_t *ctx = getContext(env, thisObject);
+
+    if (ctx == NULL || ctx->thread_started || ctx->window || ctx->headless) {
+        fprintf(stderr, "ERROR: this instance already has a GL context\n");
+        return(JNI_TRUE);
+    }
+    if ((*env)->GetJavaVM(env, &ctx->vm) != JNI_OK) {
+        return(JNI_TRUE);
+    }
+    ctx->object = (*env)->NewGlobalRef(env, thisObject);
+    ctx->queue_head = ctx->queue_tail = 0;
+    ctx->thread_stopping = 0;
+    ctx->thread_attached = 0;
+    queueCommand(ctx, COMMAND_INIT, id, w, h, NULL);
+
+    ctx->thread_started = 1;
+    if (pthread_create(&ctx->thread, NULL, renderThread, ctx)) {
+        fprintf(stderr, "ERROR: cannot start the render thread\n");
+        ctx->thread_started = 0;
+        (*env)->DeleteGlobalRef(env, ctx->object);
+        ctx->object = NULL;
+        return(JNI_TRUE);
+    }
+
+    /* a thread the JVM does not know cannot complete the INIT future,
+     * so its failure to attach is reported here instead */
+    pthread_mutex_lock(&ctx->queue_lock);
+    while (ctx->thread_attached == 0) {
+        pthread_cond_wait(&ctx->queue_cond, &ctx->queue_lock);
+    }
+    pthread_mutex_unlock(&ctx->queue_lock);
+    if (ctx->thread_attached < 0) {
+        pthread_join(ctx->thread, NULL);
+        ctx->thread_started = 0;
+        ctx->queue_head = ctx->queue_tail = 0;
+        (*env)->DeleteGlobalRef(env, ctx->object);
+        ctx->object = NULL;
         return(JNI_TRUE);
     }
+    return(JNI_FALSE);
+}
+
+JNIEXPORT jboolean JNICALL Java_org_brain4free_jprojectm_ProjectM_postCommand
+  (JNIEnv* env, jobject thisObject, jint type, jlong id, jint w, jint h, jobject arg)
+{
+    projectm_context_t *ctx = getContext(env, thisObject);
+    jobject ref = NULL;
+    int failed;
+
+    if (ctx == NULL || !ctx->thread_started) {
+        return(JNI_TRUE);
+    }
+    if (arg != NULL) {
+        ref = (*env)->NewGlobalRef(env, arg);
+    }
+    pthread_mutex_lock(&ctx->queue_lock);
+    failed = queueCommand(ctx, type, id, w, h, ref);
+    pthread_mutex_unlock(&ctx->queue_lock);
+    if (failed && ref != NULL) {
+        (*env)->DeleteGlobalRef(env, ref);
+    }
+    return failed ? JNI_TRUE : JNI_FALSE;
+}
+
+JNIEXPORT void JNICALL Java_org_brain4free_jprojectm_ProjectM_stopRenderThread
+  (JNIEnv* env, jobject thisObject)
+{
+    projectm_context_t *ctx = getContext(env, thisObject);
+
+    if (ctx == NULL || !ctx->thread_started) {
+        return;
+    }
+    pthread_mutex_lock(&ctx->queue_lock);
+    if (!ctx->thread_stopping) {
+        queueCommand(ctx, COMMAND_SHUTDOWN, 0, 0, 0, NULL);
+    }
+    pthread_mutex_unlock(&ctx->queue_lock);
 
-    printf("INFO: New preset %s\n" , presetUrlCharPointer);
+    pthread_join(ctx->thread, NULL);
+    ctx->thread_started = 0;
+    (*env)->DeleteGlobalRef(env, ctx->object);
+    ctx->object = NULL;
+}
+
+JNIEXPORT jboolean JNICALL Java_org_brain4free_jprojectm_ProjectM_loadPreset__Ljava_lang_String_2
+  (JNIEnv* env, jobject thisObject, jstring presetUrl)
+{
+    projectm_context_t *ctx = getContext(env, thisObject);
+    const char* presetUrlCharPointer;
+    int failed;
     
-    /* Preset handling */
-    projectm_clear_playlist(projectm);
-    projectm_insert_preset_url(projectm, 0, presetUrlCharPointer, "test", rating, 0);
-    projectm_select_preset(projectm, 0, true);
-    if (projectm_get_error_loading_current_preset(projectm) == false) {
-        fprintf (stderr, "projectm_select_preset() failed\n");
+    /* destroyProjectm() on the render thread frees the loader */
+    if (ctx == NULL || checkThread(ctx)) {
         return(JNI_TRUE);
     }
-    projectm_lock_preset(projectm, true);
+    if (ctx->projectm == NULL) {
+        fprintf (stderr, "ERROR: projectM not Initialized!\n");
+        return(JNI_TRUE);
+    }
+    presetUrlCharPointer = (*env)->GetStringUTFChars(env, presetUrl, 0);
+    
+    /* Preset handling: read in the background, applied by the next frame */
+    failed = preset_loader_request(&ctx->preset_loader, presetUrlCharPointer);
     
     (*env)->ReleaseStringUTFChars(env, presetUrl, presetUrlCharPointer); 
     
-    return(JNI_FALSE);
+    return failed ? JNI_TRUE : JNI_FALSE;
+}
+
+/* preset paths for the warm-up thread, the index does not change */
+static int presetPath(void *user, int index, char *path, size_t size)
+{
+    return preset_cache_path(user, index, path, size);
+}
+
+JNIEXPORT jint JNICALL Java_org_brain4free_jprojectm_ProjectM_openPresetDirectory
+  (JNIEnv* env, jobject thisObject, jstring directory)
+{
+    projectm_context_t *ctx = getContext(env, thisObject);
+    const char *directoryCharPointer;
+    preset_cache_stats_t stats;
+    int failed;
+
+    if (ctx == NULL || ctx->preset_cache.directory != NULL) {
+        fprintf (stderr, "ERROR: a preset directory is already open\n");
+        return -1;
+    }
+    directoryCharPointer = (*env)->GetStringUTFChars(env, directory, 0);
+    failed = preset_cache_open(&ctx->preset_cache, directoryCharPointer);
+    if (!failed) {
+        preset_cache_stats(&ctx->preset_cache, &stats);
+        printf("INFO: %u presets in %s, indexed in %.1f ms (%u files read, index %s)\n",
+               stats.presets, directoryCharPointer, stats.open_seconds * 1e3,
+               stats.hashed, stats.index_loaded ? "reused" : "created");
+    }
+    (*env)->ReleaseStringUTFChars(env, directory, directoryCharPointer);
+    if (failed) {
+        return -1;
+    }
+    if (ctx->preset_loader.running) {
+        preset_loader_set_cache(&ctx->preset_loader, &ctx->preset_cache);
+    }
+    if (preset_cache_count(&ctx->preset_cache) > 1
+        && preset_warmup_init(&ctx->preset_warmup, preset_cache_count(&ctx->preset_cache),
+                              presetPath, &ctx->preset_cache)) {
+        fprintf (stderr, "WARNING: no preset warm-up, presets compile on first use\n");
+    }
+    return preset_cache_count(&ctx->preset_cache);
+}
+
+JNIEXPORT jboolean JNICALL Java_org_brain4free_jprojectm_ProjectM_loadPreset__I
+  (JNIEnv* env, jobject thisObject, jint index)
+{
+    projectm_context_t *ctx = getContext(env, thisObject);
+    char path[PATH_MAX];
+
+    if (ctx == NULL || checkThread(ctx)) {
+        return(JNI_TRUE);
+    }
+    if (ctx->projectm == NULL) {
+        fprintf (stderr, "ERROR: projectM not Initialized!\n");
+        return(JNI_TRUE);
+    }
+    if (preset_cache_path(&ctx->preset_cache, index, path, sizeof(path))) {
+        fprintf (stderr, "ERROR: no preset %d in the preset directory\n", (int)index);
+        return(JNI_TRUE);
+    }
+    preset_warmup_ahead(&ctx->preset_warmup, index);
+    return preset_loader_request(&ctx->preset_loader, path) ? JNI_TRUE : JNI_FALSE;
 }
 
 JNIEXPORT jboolean JNICALL Java_org_brain4free_jprojectm_ProjectM_startMainLoop
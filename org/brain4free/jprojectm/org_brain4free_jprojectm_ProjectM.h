@@ -7,6 +7,22 @@
 #ifdef __cplusplus
 extern "C" {
 #endif
+/*
+ * Class:     org_brain4free_jprojectm_ProjectM
+ * Method:    create
+ * Signature: ()J
+ */
+JNIEXPORT jlong JNICALL Java_org_brain4free_jprojectm_ProjectM_create
+  (JNIEnv *, jclass);
+
+/*
+ * Class:     org_brain4free_jprojectm_ProjectM
+ * Method:    dispose
+ * Signature: (J)V
+ */
+JNIEXPORT void JNICALL Java_org_brain4free_jprojectm_ProjectM_dispose
+  (JNIEnv *, jclass, jlong);
+
 /*
  * Class:     org_brain4free_jprojectm_ProjectM
  * Method:    init
@@ -39,6 +55,14 @@ JNIEXPORT jboolean JNICALL Java_org_brain4free_jprojectm_ProjectM_initJackPorts
 JNIEXPORT jboolean JNICALL Java_org_brain4free_jprojectm_ProjectM_initGlWindow
   (JNIEnv *, jobject);
 
+/*
+ * Class:     org_brain4free_jprojectm_ProjectM
+ * Method:    initHeadless
+ * Signature: (II)Z
+ */
+JNIEXPORT jboolean JNICALL Java_org_brain4free_jprojectm_ProjectM_initHeadless
+  (JNIEnv *, jobject, jint, jint);
+
 /*
  * Class:     org_brain4free_jprojectm_ProjectM
  * Method:    initTexture
@@ -68,9 +92,25 @@ JNIEXPORT jboolean JNICALL Java_org_brain4free_jprojectm_ProjectM_initShaders
  * Method:    loadPreset
  * Signature: (Ljava/lang/String;)Z
  */
-JNIEXPORT jboolean JNICALL Java_org_brain4free_jprojectm_ProjectM_loadPreset
+JNIEXPORT jboolean JNICALL Java_org_brain4free_jprojectm_ProjectM_loadPreset__Ljava_lang_String_2
+  (JNIEnv *, jobject, jstring);
+
+/*
+ * Class:     org_brain4free_jprojectm_ProjectM
+ * Method:    openPresetDirectory
+ * Signature: (Ljava/lang/String;)I
+ */
+JNIEXPORT jint JNICALL Java_org_brain4free_jprojectm_ProjectM_openPresetDirectory
   (JNIEnv *, jobject, jstring);
 
+/*
+ * Class:     org_brain4free_jprojectm_ProjectM
+ * Method:    loadPreset
+ * Signature: (I)Z
+ */
+JNIEXPORT jboolean JNICALL Java_org_brain4free_jprojectm_ProjectM_loadPreset__I
+  (JNIEnv *, jobject, jint);
+
 /*
  * Class:     org_brain4free_jprojectm_ProjectM
  * Method:    destroyJack
@@ -119,6 +159,62 @@ JNIEXPORT void JNICALL Java_org_brain4free_jprojectm_ProjectM_renderTexture
 JNIEXPORT void JNICALL Java_org_brain4free_jprojectm_ProjectM_reshape
   (JNIEnv *, jobject, jint, jint);
 
+/*
+ * Class:     org_brain4free_jprojectm_ProjectM
+ * Method:    renderInto
+ * Signature: (Ljava/nio/ByteBuffer;)J
+ */
+JNIEXPORT jlong JNICALL Java_org_brain4free_jprojectm_ProjectM_renderInto
+  (JNIEnv *, jobject, jobject);
+
+/*
+ * Class:     org_brain4free_jprojectm_ProjectM
+ * Method:    addAudio
+ * Signature: (Ljava/nio/FloatBuffer;II)I
+ */
+JNIEXPORT jint JNICALL Java_org_brain4free_jprojectm_ProjectM_addAudio__Ljava_nio_FloatBuffer_2II
+  (JNIEnv *, jobject, jobject, jint, jint);
+
+/*
+ * Class:     org_brain4free_jprojectm_ProjectM
+ * Method:    addAudio
+ * Signature: ([FII)I
+ */
+JNIEXPORT jint JNICALL Java_org_brain4free_jprojectm_ProjectM_addAudio___3FII
+  (JNIEnv *, jobject, jfloatArray, jint, jint);
+
+/*
+ * Class:     org_brain4free_jprojectm_ProjectM
+ * Method:    getStats
+ * Signature: ()Ljava/lang/String;
+ */
+JNIEXPORT jstring JNICALL Java_org_brain4free_jprojectm_ProjectM_getStats
+  (JNIEnv *, jobject);
+
+/*
+ * Class:     org_brain4free_jprojectm_ProjectM
+ * Method:    startRenderThread
+ * Signature: (JII)Z
+ */
+JNIEXPORT jboolean JNICALL Java_org_brain4free_jprojectm_ProjectM_startRenderThread
+  (JNIEnv *, jobject, jlong, jint, jint);
+
+/*
+ * Class:     org_brain4free_jprojectm_ProjectM
+ * Method:    postCommand
+ * Signature: (IJIILjava/lang/Object;)Z
+ */
+JNIEXPORT jboolean JNICALL Java_org_brain4free_jprojectm_ProjectM_postCommand
+  (JNIEnv *, jobject, jint, jlong, jint, jint, jobject);
+
+/*
+ * Class:     org_brain4free_jprojectm_ProjectM
+ * Method:    stopRenderThread
+ * Signature: ()V
+ */
+JNIEXPORT void JNICALL Java_org_brain4free_jprojectm_ProjectM_stopRenderThread
+  (JNIEnv *, jobject);
+
 /*
  * Class:     org_brain4free_jprojectm_ProjectM
  * Method:    startMainLoop
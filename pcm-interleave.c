@@ -0,0 +1,109 @@
+/** @file pcm-interleave.c
+ *
+ * @brief Zip two mono channels into one interleaved stereo buffer
+ */
+
+#include "pcm-interleave.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+# define HAVE_X86 1
+# include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+# define HAVE_NEON 1
+# include <arm_neon.h>
+#endif
+
+void pcm_interleave_scalar(float *dst, const float *left,
+                           const float *right, size_t frames)
+{
+    size_t i;
+    for (i = 0; i < frames; i++) {
+        dst[2*i+0] = left[i];
+        dst[2*i+1] = right[i];
+    }
+}
+
+#ifdef HAVE_X86
+__attribute__((target("sse2")))
+static void pcm_interleave_sse2(float *dst, const float *left,
+                                const float *right, size_t frames)
+{
+    size_t i;
+    for (i = 0; i + 4 <= frames; i += 4) {
+        __m128 l = _mm_loadu_ps(left + i);
+        __m128 r = _mm_loadu_ps(right + i);
+        _mm_storeu_ps(dst + 2*i + 0, _mm_unpacklo_ps(l, r));
+        _mm_storeu_ps(dst + 2*i + 4, _mm_unpackhi_ps(l, r));
+    }
+    pcm_interleave_scalar(dst + 2*i, left + i, right + i, frames - i);
+}
+
+__attribute__((target("avx")))
+static void pcm_interleave_avx(float *dst, const float *left,
+                               const float *right, size_t frames)
+{
+    size_t i;
+    for (i = 0; i + 8 <= frames; i += 8) {
+        __m256 l = _mm256_loadu_ps(left + i);
+        __m256 r = _mm256_loadu_ps(right + i);
+        /* unpack works per 128 bit lane: lo = l0 r0 l1 r1 | l4 r4 l5 r5 */
+        __m256 lo = _mm256_unpacklo_ps(l, r);
+        __m256 hi = _mm256_unpackhi_ps(l, r);
+        _mm256_storeu_ps(dst + 2*i + 0, _mm256_permute2f128_ps(lo, hi, 0x20));
+        _mm256_storeu_ps(dst + 2*i + 8, _mm256_permute2f128_ps(lo, hi, 0x31));
+    }
+    pcm_interleave_sse2(dst + 2*i, left + i, right + i, frames - i);
+}
+#endif
+
+#ifdef HAVE_NEON
+static void pcm_interleave_neon(float *dst, const float *left,
+                                const float *right, size_t frames)
+{
+    size_t i;
+    for (i = 0; i + 4 <= frames; i += 4) {
+        float32x4x2_t lr;
+        lr.val[0] = vld1q_f32(left + i);
+        lr.val[1] = vld1q_f32(right + i);
+        vst2q_f32(dst + 2*i, lr);
+    }
+    pcm_interleave_scalar(dst + 2*i, left + i, right + i, frames - i);
+}
+#endif
+
+size_t pcm_interleave_kernels(pcm_interleave_kernel_t *kernels, size_t max)
+{
+    size_t n = 0;
+
+    if (n < max) {
+        kernels[n].name = "scalar";
+        kernels[n++].fn = pcm_interleave_scalar;
+    }
+#ifdef HAVE_X86
+    __builtin_cpu_init();
+    if (n < max && __builtin_cpu_supports("sse2")) {
+        kernels[n].name = "sse2";
+        kernels[n++].fn = pcm_interleave_sse2;
+    }
+    if (n < max && __builtin_cpu_supports("avx")) {
+        kernels[n].name = "avx";
+        kernels[n++].fn = pcm_interleave_avx;
+    }
+#endif
+#ifdef HAVE_NEON
+    if (n < max) {
+        kernels[n].name = "neon";
+        kernels[n++].fn = pcm_interleave_neon;
+    }
+#endif
+    return n;
+}
+
+pcm_interleave_kernel_t pcm_interleave_select(void)
+{
+    pcm_interleave_kernel_t kernels[4];
+    size_t n = pcm_interleave_kernels(kernels, 4);
+    return kernels[n - 1];
+}
@@ -0,0 +1,40 @@
+/** @file pcm-interleave.h
+ *
+ * @brief Zip two mono channels into one interleaved stereo buffer
+ *
+ * JACK delivers every channel in its own buffer, projectM wants
+ * stereo audio as L R L R ...  The kernels below do the zip with
+ * SSE2, AVX or NEON where available and fall back to plain C.
+ * None of them allocate, they are safe to call from the realtime thread.
+ */
+
+#ifndef PCM_INTERLEAVE_H
+#define PCM_INTERLEAVE_H
+
+#include <stddef.h>
+
+/** dst must have room for 2 * frames floats, no alignment required */
+typedef void (*pcm_interleave_fn)(float *dst, const float *left,
+                                  const float *right, size_t frames);
+
+typedef struct pcm_interleave_kernel {
+    const char *name;
+    pcm_interleave_fn fn;
+} pcm_interleave_kernel_t;
+
+void pcm_interleave_scalar(float *dst, const float *left,
+                           const float *right, size_t frames);
+
+/**
+ * The fastest kernel the running CPU supports.  Call this once at
+ * startup and keep the result, it queries the CPU features.
+ */
+pcm_interleave_kernel_t pcm_interleave_select(void);
+
+/**
+ * All kernels compiled in and supported by the running CPU, scalar
+ * first.  Used by the benchmark.  Returns the number of entries.
+ */
+size_t pcm_interleave_kernels(pcm_interleave_kernel_t *kernels, size_t max);
+
+#endif /* PCM_INTERLEAVE_H */
@@ -0,0 +1,128 @@
+/** @file pcm-ring.c
+ *
+ * @brief Wait-free single-producer/single-consumer ring buffer for PCM floats
+ *
+ * head and tail are free running counters, the position in the buffer
+ * is obtained by masking them with capacity-1.  The producer publishes
+ * new samples with a release store on head, the consumer frees space
+ * with a release store on tail.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "pcm-ring.h"
+
+static size_t next_power_of_two(size_t n)
+{
+    size_t p = 1;
+    while (p < n) {
+        p <<= 1;
+    }
+    return p;
+}
+
+int pcm_ring_init(pcm_ring_t *ring, size_t min_capacity, size_t channels)
+{
+    void *data = NULL;
+    size_t capacity;
+
+    if (channels == 0 || (channels & (channels - 1))) {
+        return -1;
+    }
+    capacity = next_power_of_two(min_capacity < 2 * channels ?
+                                 2 * channels : min_capacity);
+
+    if (posix_memalign(&data, PCM_RING_CACHE_LINE, capacity * sizeof(float))) {
+        return -1;
+    }
+    /* touch every page now, so the realtime thread never faults them in */
+    memset(data, 0, capacity * sizeof(float));
+
+    ring->data = data;
+    ring->capacity = capacity;
+    ring->mask = capacity - 1;
+    ring->channels = channels;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->overruns, 0);
+    atomic_init(&ring->underruns, 0);
+    return 0;
+}
+
+void pcm_ring_free(pcm_ring_t *ring)
+{
+    free(ring->data);
+    ring->data = NULL;
+    ring->capacity = 0;
+    ring->mask = 0;
+}
+
+size_t pcm_ring_write(pcm_ring_t *ring, const float *src, size_t count)
+{
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    size_t space = ring->capacity - (head - tail);
+    size_t n = count < space ? count : space;
+    size_t start = head & ring->mask;
+    size_t first = ring->capacity - start;
+
+    n -= n % ring->channels;
+
+    if (n < count) {
+        atomic_fetch_add_explicit(&ring->overruns, count - n,
+                                  memory_order_relaxed);
+    }
+
+    if (first > n) {
+        first = n;
+    }
+    memcpy(ring->data + start, src, first * sizeof(float));
+    memcpy(ring->data, src + first, (n - first) * sizeof(float));
+
+    atomic_store_explicit(&ring->head, head + n, memory_order_release);
+    return n;
+}
+
+size_t pcm_ring_read(pcm_ring_t *ring, float *dst, size_t count)
+{
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    size_t avail = head - tail;
+    size_t n = count < avail ? count : avail;
+    size_t start = tail & ring->mask;
+    size_t first = ring->capacity - start;
+
+    n -= n % ring->channels;
+
+    if (first > n) {
+        first = n;
+    }
+    memcpy(dst, ring->data + start, first * sizeof(float));
+    memcpy(dst + first, ring->data, (n - first) * sizeof(float));
+
+    atomic_store_explicit(&ring->tail, tail + n, memory_order_release);
+    return n;
+}
+
+size_t pcm_ring_read_space(pcm_ring_t *ring)
+{
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    return head - tail;
+}
+
+void pcm_ring_underrun(pcm_ring_t *ring)
+{
+    atomic_fetch_add_explicit(&ring->underruns, 1, memory_order_relaxed);
+}
+
+unsigned long pcm_ring_overruns(pcm_ring_t *ring)
+{
+    return atomic_load_explicit(&ring->overruns, memory_order_relaxed);
+}
+
+unsigned long pcm_ring_underruns(pcm_ring_t *ring)
+{
+    return atomic_load_explicit(&ring->underruns, memory_order_relaxed);
+}
@@ -0,0 +1,75 @@
+/** @file pcm-ring.h
+ *
+ * @brief Wait-free single-producer/single-consumer ring buffer for PCM floats
+ *
+ * The JACK process() callback runs in a realtime thread and must never
+ * block, allocate or call into libprojectM.  It writes the captured
+ * samples into this ring, and the render thread drains them into
+ * projectM once per frame.
+ *
+ * Only one thread may write and only one thread may read.  All memory
+ * is allocated by pcm_ring_init(), so pcm_ring_write() and
+ * pcm_ring_read() are safe to call from a realtime thread.
+ */
+
+#ifndef PCM_RING_H
+#define PCM_RING_H
+
+#include <stddef.h>
+#include <stdatomic.h>
+
+#define PCM_RING_CACHE_LINE 64
+
+typedef struct pcm_ring {
+    /* written by the producer only */
+    _Alignas(PCM_RING_CACHE_LINE) atomic_size_t head;
+    atomic_ulong overruns;      /* samples dropped because the ring was full */
+
+    /* written by the consumer only */
+    _Alignas(PCM_RING_CACHE_LINE) atomic_size_t tail;
+    atomic_ulong underruns;     /* frames that found the ring empty */
+
+    /* read-only after pcm_ring_init() */
+    _Alignas(PCM_RING_CACHE_LINE) float *data;
+    size_t capacity;            /* power of two */
+    size_t mask;
+    size_t channels;            /* samples per frame, reads and writes
+                                 * never split a frame */
+} pcm_ring_t;
+
+/**
+ * Allocate a ring that holds at least min_capacity samples of
+ * interleaved audio with the given number of channels.  The capacity
+ * is rounded up to the next power of two, so channels must be a power
+ * of two as well.  Not realtime safe.
+ * Returns 0 on success, -1 if the allocation failed.
+ */
+int pcm_ring_init(pcm_ring_t *ring, size_t min_capacity, size_t channels);
+
+/** Release the memory of the ring.  Not realtime safe. */
+void pcm_ring_free(pcm_ring_t *ring);
+
+/**
+ * Producer side: copy up to count samples into the ring.  Whole frames
+ * that do not fit are dropped and added to the overrun counter.
+ * Returns the number of samples written.
+ */
+size_t pcm_ring_write(pcm_ring_t *ring, const float *src, size_t count);
+
+/**
+ * Consumer side: copy up to count samples, rounded down to whole
+ * frames, out of the ring.  Returns the number of samples read.
+ */
+size_t pcm_ring_read(pcm_ring_t *ring, float *dst, size_t count);
+
+/** Consumer side: number of samples that can be read right now. */
+size_t pcm_ring_read_space(pcm_ring_t *ring);
+
+/** Consumer side: record a frame that had no audio to drain. */
+void pcm_ring_underrun(pcm_ring_t *ring);
+
+/** Counters, safe to read from any thread. */
+unsigned long pcm_ring_overruns(pcm_ring_t *ring);
+unsigned long pcm_ring_underruns(pcm_ring_t *ring);
+
+#endif /* PCM_RING_H */
@@ -21,6 +21,7 @@
 #include "Gem/Image.h"
 #include "Utils/Functions.h"
 #include <string.h>
+#include <math.h>
 
 #ifdef debug_post
 # undef debug_post
@@ -48,24 +49,62 @@ CPPEXTERN_NEW(tex_gradient);
 tex_gradient :: tex_gradient()
   : m_textureOnOff(1),
     m_textureMinQuality(GL_LINEAR), m_textureMagQuality(GL_LINEAR),
-    m_wantMipmap(false), m_canMipmap(false), m_hasMipmap(false),
+    m_wantMipmap(false),
     m_repeat(GL_REPEAT),
+    m_numPbo(0),
+    m_clientStorage(0), //have to do this due to texture corruption issues
+    m_yuv(1),
+    m_texunit(0),
+    m_canMipmap(false), m_numTexUnits(0),
+    m_hasMipmap(false),
     m_didTexture(false), m_rebuildList(false),
     m_textureObj(0),
     m_realTextureObj(0),
     m_oldTexCoords(NULL), m_oldNumCoords(0), m_oldTexture(0),
     m_oldBaseCoord(TexCoord(1.,1.)), m_oldOrientation(true),
     m_textureType( GL_TEXTURE_2D ),
-    m_clientStorage(0), //have to do this due to texture corruption issues
-    m_yuv(1),
-    m_texunit(0),
-    m_numTexUnits(0),
-    m_numPbo(0), m_oldNumPbo(0), m_curPbo(0), m_pbo(NULL),
-    m_upsidedown(false)
+    m_curPbo(0), m_oldNumPbo(0), m_pbo(NULL),
+    m_pboMap(NULL), m_pboFence(NULL), m_pboSize(0),
+    m_texFormat(-1), m_texWidth(-1), m_texHeight(-1), m_texLevels(0),
+    m_texBytes(0), m_texSavedBytes(0),
+    m_texPool(NULL),
+    m_poolSize(4), m_poolClock(0), m_poolHits(0), m_poolMisses(0),
+    m_yuvShader(false), m_yuvProgram(0), m_yuvTexture(0),
+    m_yuvWidth(-1), m_yuvHeight(-1), m_yuvFbo(0),
+    m_gradientType(GRADIENT_OFF), m_gradientSpread(0),
+    m_gradientAngle(0.), m_gradientPhase(0.), m_gradientStops(0),
+    m_gradientGeneration(1), m_gradientProgram(0), m_gradientDrawn(0),
+    m_pboUploads(0), m_pboStalls(0),
+    m_pboUploadTime(0.), m_pboUploadMax(0.), m_pboWaitTime(0.),
+    m_stageTimer(NULL), m_upsidedown(false),
+    m_projectmOn(false), m_presetGeneration(0),
+    m_fboWidth(1024), m_fboHeight(1024), m_fboGeneration(0), m_fboBuilt(0),
+    m_projectm(NULL), m_presetLoaded(0),
+    m_fbo(0), m_fboTexture(0),
+    m_srcXsize(0), m_srcYsize(0), m_srcCsize(0),
+    m_srcFormat(0), m_srcType(0), m_srcData(NULL),
+    m_imageGeneration(0), m_convertedGeneration(0),
+    m_copiedTotal(0), m_copiedWindow(0),
+    m_copiedSince(0.), m_copiedRate(0.)
 {
-  m_dataSize[0] = m_dataSize[1] = m_dataSize[2] = -1;
-  m_buffer.xsize = m_buffer.ysize = m_buffer.csize = -1;
-  m_buffer.data = NULL;
+  m_gradientCenter[0] = m_gradientCenter[1] = 0.5;
+  /* the gradient texture-jack-client used to compute on the CPU */
+  t_atom stops[10];
+  SETFLOAT(stops+0, 0.);
+  SETFLOAT(stops+1, 0.);
+  SETFLOAT(stops+2, 0.);
+  SETFLOAT(stops+3, 1.);
+  SETFLOAT(stops+4, 1.);
+  SETFLOAT(stops+5, 1.);
+  SETFLOAT(stops+6, 1.);
+  SETFLOAT(stops+7, 1.);
+  SETFLOAT(stops+8, 0.);
+  SETFLOAT(stops+9, 1.);
+  stopsMess(gensym("stops"), 10, stops);
+  m_yuvConvert = yuv_convert_select().fn;
+  if(yuv_convert_pool_init(&m_yuvPool, yuv_convert_threads()) < 0) {
+    verbose(1, "cannot start the YUV conversion threads, converting on one");
+  }
 
   int ival=1;
   gem::Settings::get("texture.repeat", ival);
@@ -79,6 +118,9 @@ tex_gradient :: tex_gradient()
 
   // create an outlet to send texture ID
   m_outTexID = outlet_new(this->x_obj, &s_float);
+  // and one for statistics
+  m_outInfo = outlet_new(this->x_obj, 0);
+  m_copiedSince = sys_getrealtime();
 }
 
 ////////////////////////////////////////////////////////
@@ -87,11 +129,24 @@ tex_gradient :: tex_gradient()
 /////////////////////////////////////////////////////////
 tex_gradient :: ~tex_gradient()
 {
+  /* projectM deletes its GL objects, so it can only be destroyed with
+   * its context current, in stopRendering() */
+  projectm_handle projectm=m_projectm;
+  if(projectm) {
+    verbose(1, "projectM outlived its GL context, leaking it");
+  }
+
   if(m_outTexID) {
     outlet_free(m_outTexID);
   }
 
   m_outTexID=NULL;
+
+  if(m_outInfo) {
+    outlet_free(m_outInfo);
+  }
+  m_outInfo=NULL;
+  yuv_convert_pool_free(&m_yuvPool);
 }
 
 ////////////////////////////////////////////////////////
@@ -224,6 +279,809 @@ void tex_gradient :: sendExtTexture(GLuint texobj, GLfloat xRatio,
   }
 }
 
+////////////////////////////////////////////////////////
+// change detection
+//
+// upstream may send the very same image over and over again
+// (e.g. a still [pix_image]); then there is nothing to upload
+/////////////////////////////////////////////////////////
+bool tex_gradient :: imageChanged(const imageStruct&image)
+{
+  return (image.xsize  != m_srcXsize  ||
+          image.ysize  != m_srcYsize  ||
+          image.csize  != m_srcCsize  ||
+          image.format != m_srcFormat ||
+          image.type   != m_srcType   ||
+          image.data   != m_srcData);
+}
+
+void tex_gradient :: countCopy(size_t bytes)
+{
+  m_copiedTotal += bytes;
+  m_copiedWindow += bytes;
+  double now = sys_getrealtime();
+  if(now - m_copiedSince >= 1.) {
+    m_copiedRate = m_copiedWindow / (now - m_copiedSince);
+    m_copiedWindow = 0;
+    m_copiedSince = now;
+  }
+}
+
+////////////////////////////////////////////////////////
+// texture storage
+//
+// textures are allocated at the exact size of the image, with
+// immutable storage where available; after that they are only ever
+// updated with glTexSubImage2D().
+// when the size changes, the old texture is parked in a small pool, so
+// toggling between a few resolutions stops allocating after warm-up.
+/////////////////////////////////////////////////////////
+static GLsizei mipmapLevels(int width, int height)
+{
+  GLsizei levels=1;
+  while((width|height) >> levels) {
+    levels++;
+  }
+  return levels;
+}
+
+bool tex_gradient :: needsStorage(int width, int height, GLenum internalformat)
+{
+  const GLsizei levels = (m_wantMipmap && m_canMipmap) ? mipmapLevels(width,
+                         height) : 1;
+  const int format=m_texFormat, texWidth=m_texWidth, texHeight=m_texHeight;
+  const GLsizei texLevels=m_texLevels;
+  return (format != (int)internalformat ||
+          texWidth != width ||
+          texHeight != height ||
+          texLevels != levels);
+}
+
+/* binds the new texture */
+void tex_gradient :: allocateTexture(int width, int height,
+                                    GLenum internalformat)
+{
+  const GLsizei levels = (m_wantMipmap && m_canMipmap) ? mipmapLevels(width,
+                         height) : 1;
+  GLuint obj=m_realTextureObj;
+  TexturePool*pool=m_texPool;
+  if(!pool) {
+    pool=new TexturePool;
+    m_texPool=pool;
+  }
+
+  /* park the current texture (if it has storage at all) in the pool */
+  const int oldWidth=m_texWidth;
+  if(obj && oldWidth > 0) {
+    TexturePoolEntry entry;
+    entry.texture = obj;
+    entry.width = oldWidth;
+    entry.height = m_texHeight;
+    entry.internalformat = (int)m_texFormat;
+    entry.levels = m_texLevels;
+    entry.lastUse = m_poolClock++;
+    pool->push_back(entry);
+    obj = 0;
+  }
+
+  /* ... and take the one we need out of it */
+  for(size_t i=0; i<pool->size(); i++) {
+    const TexturePoolEntry&entry = (*pool)[i];
+    if(entry.width == width && entry.height == height &&
+        entry.internalformat == internalformat && entry.levels == levels) {
+      if(obj) {
+        glDeleteTextures(1, &obj);
+      }
+      obj = entry.texture;
+      pool->erase(pool->begin() + i);
+      break;
+    }
+  }
+
+  if(obj && obj != m_realTextureObj) {
+    m_poolHits++;
+    glBindTexture(m_textureType, obj);
+  } else {
+    m_poolMisses++;
+    if(!obj) {
+      glGenTextures(1, &obj);
+    }
+    glBindTexture(m_textureType, obj);
+    if(GLEW_ARB_texture_storage) {
+      glTexStorage2D(m_textureType, levels, internalformat, width, height);
+    } else {
+      glTexImage2D(m_textureType, 0, internalformat, width, height, 0,
+                   GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    }
+  }
+  m_realTextureObj=obj;
+  m_textureObj=obj;
+  /* filters and wrapping might have changed while it was parked */
+  setUpTextureState();
+  trimTexturePool(m_poolSize);
+  m_hasMipmap = false;
+
+  m_texFormat = (int)internalformat;
+  m_texWidth = width;
+  m_texHeight = height;
+  m_texLevels = levels;
+
+  /* what the old power-of-two padding would have cost (level 0 only) */
+  const size_t texel = (internalformat == GL_RGBA32F) ? 16 : 4;
+  m_texBytes = texel * width * height;
+  m_texSavedBytes = texel * powerOfTwo(width) * powerOfTwo(height) - m_texBytes;
+  debug_post("allocated %dx%d texture, %d levels", width, height, levels);
+}
+
+/* delete the least recently parked textures until at most 'size' are left */
+void tex_gradient :: trimTexturePool(size_t size)
+{
+  TexturePool*pool=m_texPool;
+  if(!pool) {
+    return;
+  }
+  while(pool->size() > size) {
+    size_t oldest=0;
+    for(size_t i=1; i<pool->size(); i++) {
+      if((*pool)[i].lastUse < (*pool)[oldest].lastUse) {
+        oldest=i;
+      }
+    }
+    GLuint obj=(*pool)[oldest].texture;
+    glDeleteTextures(1, &obj);
+    pool->erase(pool->begin() + oldest);
+  }
+}
+
+void tex_gradient :: destroyTexturePool(void)
+{
+  TexturePool*pool=m_texPool;
+  trimTexturePool(0);
+  delete pool;
+  m_texPool=NULL;
+}
+
+////////////////////////////////////////////////////////
+// PBO upload ring
+//
+// with GL_ARB_buffer_storage the PBOs are mapped once, persistently
+// and coherently, and every slot carries a fence so we only ever wait
+// for the GPU when it is still reading the slot we want to fill.
+// without it, each upload orphans its buffer before mapping it.
+/////////////////////////////////////////////////////////
+bool tex_gradient :: setupPbo(size_t bytes)
+{
+  if(m_pbo && (m_oldNumPbo != (GLuint)m_numPbo || m_pboSize != bytes)) {
+    /* the PBO settings have changed, invalidate the old ring */
+    destroyPbo();
+  }
+  if(m_pbo) {
+    return true;
+  }
+  if(!GLEW_ARB_pixel_buffer_object) {
+    verbose(1, "PBOs not supported! disabling");
+    m_numPbo=0;
+    return false;
+  }
+
+  GLuint*pbo=new GLuint[m_numPbo];
+  GLubyte**map=NULL;
+  GLsync*fence=NULL;
+  int i=0;
+  glGenBuffersARB(m_numPbo, pbo);
+
+  if(GLEW_ARB_buffer_storage) {
+    const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT |
+                             GL_MAP_COHERENT_BIT;
+    bool mapped=true;
+    map=new GLubyte*[m_numPbo];
+    fence=new GLsync[m_numPbo];
+    for(i=0; i<m_numPbo; i++) {
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo[i]);
+      glBufferStorage(GL_PIXEL_UNPACK_BUFFER, bytes, NULL, flags);
+      map[i]=(GLubyte*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes, flags);
+      fence[i]=0;
+      mapped = mapped && map[i];
+    }
+    if(!mapped) {
+      /* storage is immutable, start over with fresh buffers */
+      verbose(1, "cannot map PBOs persistently, orphaning instead");
+      glDeleteBuffersARB(m_numPbo, pbo);
+      glGenBuffersARB(m_numPbo, pbo);
+      delete[]map;
+      delete[]fence;
+      map=NULL;
+      fence=NULL;
+    }
+  }
+  if(!map) {
+    for(i=0; i<m_numPbo; i++) {
+      glBindBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB, pbo[i]);
+      glBufferDataARB(GL_PIXEL_UNPACK_BUFFER_ARB, bytes, 0, GL_STREAM_DRAW_ARB);
+    }
+  }
+  glBindBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB, 0);
+
+  m_pbo=pbo;
+  m_pboMap=map;
+  m_pboFence=fence;
+  m_pboSize=bytes;
+  m_oldNumPbo=m_numPbo;
+  m_curPbo=0;
+  return true;
+}
+
+void tex_gradient :: destroyPbo(void)
+{
+  GLuint*pbo=m_pbo;
+  GLubyte**map=m_pboMap;
+  GLsync*fence=m_pboFence;
+  GLuint count=m_oldNumPbo;
+
+  if(fence) {
+    for(GLuint i=0; i<count; i++) {
+      if(fence[i]) {
+        glDeleteSync(fence[i]);
+      }
+    }
+    delete[]fence;
+  }
+  delete[]map;
+  if(pbo) {
+    /* deleting a buffer also unmaps it */
+    glDeleteBuffersARB(count, pbo);
+    delete[]pbo;
+  }
+  m_pbo=NULL;
+  m_pboMap=NULL;
+  m_pboFence=NULL;
+  m_pboSize=0;
+}
+
+void tex_gradient :: uploadImage(imageStruct*src)
+{
+  const size_t bytes = src->xsize * src->ysize * src->csize;
+  const double start = sys_getrealtime();
+  const GLvoid*data = src->data;
+
+  if(m_numPbo>0 && setupPbo(bytes)) {
+    GLuint*pbo=m_pbo;
+    GLubyte**map=m_pboMap;
+    GLuint index=m_curPbo=(m_curPbo+1)%m_numPbo;
+    GLubyte*ptr=NULL;
+
+    if(map) {
+      /* wait until the GPU has consumed what we put here last time */
+      GLsync*fence=m_pboFence;
+      if(fence[index]) {
+        if(glClientWaitSync(fence[index], 0, 0) == GL_TIMEOUT_EXPIRED) {
+          const double wait = sys_getrealtime();
+          glClientWaitSync(fence[index], GL_SYNC_FLUSH_COMMANDS_BIT,
+                           1000000000ull);
+          m_pboWaitTime += sys_getrealtime() - wait;
+          m_pboStalls++;
+        }
+        glDeleteSync(fence[index]);
+        fence[index]=0;
+      }
+      ptr=map[index];
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo[index]);
+    } else {
+      /* orphan the old storage, so the map never waits for the GPU */
+      glBindBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB, pbo[index]);
+      glBufferDataARB(GL_PIXEL_UNPACK_BUFFER_ARB, bytes, 0, GL_STREAM_DRAW_ARB);
+      ptr=(GLubyte*)glMapBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB, GL_WRITE_ONLY_ARB);
+    }
+
+    if(ptr) {
+      // update data off the mapped buffer
+      memcpy(ptr, src->data, bytes);
+      countCopy(bytes);
+      if(!map) {
+        glUnmapBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB);
+      }
+      data = NULL; /* <-- that's the key */
+    } else {
+      /* unbind the buffer and upload from main memory */
+      glBindBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB, 0);
+    }
+
+    glTexSubImage2D(m_textureType, 0,
+                    0, 0,                           // position
+                    src->xsize,
+                    src->ysize,
+                    src->format,
+                    src->type,
+                    data);
+    if(map) {
+      GLsync*fence=m_pboFence;
+      fence[index]=glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+    /* unbind the current buffer */
+    glBindBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB, 0);
+
+  } else {
+    glTexSubImage2D(m_textureType, 0,
+                    0, 0,                           // position
+                    src->xsize,
+                    src->ysize,
+                    src->format,
+                    src->type,
+                    data);
+  }
+  m_hasMipmap = false;
+
+  const double elapsed = sys_getrealtime() - start;
+  m_pboUploads++;
+  m_pboUploadTime += elapsed;
+  if(elapsed > m_pboUploadMax) {
+    m_pboUploadMax = elapsed;
+  }
+}
+
+////////////////////////////////////////////////////////
+// YUV422 to RGBA on the GPU
+//
+// the packed image is uploaded as is, one RGBA texel per U Y0 V Y1,
+// and a fragment shader renders the RGBA image into our texture
+/////////////////////////////////////////////////////////
+/* a single quad in clip coordinates covers the whole target */
+static const char passVertexShader[] =
+  "#version 130\n"
+  "void main() { gl_Position = gl_Vertex; }\n";
+
+/* same fixed point coefficients as the CPU path (yuv-convert.c) */
+static const char yuvFragmentShader[] =
+  "#version 130\n"
+  "uniform sampler2D uyvy;\n"
+  "void main() {\n"
+  "  ivec2 p = ivec2(gl_FragCoord.xy);\n"
+  "  vec4 t = texelFetch(uyvy, ivec2(p.x / 2, p.y), 0);\n"
+  "  float y = 1.1640625 * (((p.x & 1) == 0 ? t.g : t.a) - 16.0/255.0);\n"
+  "  float u = t.r - 128.0/255.0;\n"
+  "  float v = t.b - 128.0/255.0;\n"
+  "  gl_FragColor = vec4(y + 1.59765625 * v,\n"
+  "                      y - 0.390625 * u - 0.8125 * v,\n"
+  "                      y + 2.015625 * u,\n"
+  "                      1.0);\n"
+  "}\n";
+
+GLuint tex_gradient :: compileProgram(const char*fragment)
+{
+  const char*sources[2] = { passVertexShader, fragment };
+  const GLenum types[2] = { GL_VERTEX_SHADER, GL_FRAGMENT_SHADER };
+  GLuint program = glCreateProgram();
+  GLint ok = GL_FALSE;
+  char log[1024];
+
+  for(int i=0; i<2; i++) {
+    GLuint shader = glCreateShader(types[i]);
+    glShaderSource(shader, 1, &sources[i], NULL);
+    glCompileShader(shader);
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &ok);
+    if(!ok) {
+      glGetShaderInfoLog(shader, sizeof(log), NULL, log);
+      error("shader: %s", log);
+      glDeleteShader(shader);
+      glDeleteProgram(program);
+      return 0;
+    }
+    glAttachShader(program, shader);
+    /* only flagged for deletion, the program keeps it */
+    glDeleteShader(shader);
+  }
+  glLinkProgram(program);
+  glGetProgramiv(program, GL_LINK_STATUS, &ok);
+  if(!ok) {
+    glGetProgramInfoLog(program, sizeof(log), NULL, log);
+    error("shader: %s", log);
+    glDeleteProgram(program);
+    return 0;
+  }
+  return program;
+}
+
+bool tex_gradient :: convertYuvOnGpu(imageStruct&image, GemState*state)
+{
+  GLuint program=m_yuvProgram;
+  if(!program) {
+    program=compileProgram(yuvFragmentShader);
+    if(!program) {
+      return false;
+    }
+    m_yuvProgram=program;
+  }
+
+  const int width=image.xsize, height=image.ysize;
+
+  GLuint packed=m_yuvTexture;
+  if(!packed) {
+    glGenTextures(1, &packed);
+    m_yuvTexture=packed;
+    m_yuvWidth = m_yuvHeight = -1;
+  }
+  glBindTexture(GL_TEXTURE_2D, packed);
+  if(m_yuvWidth != width/2 || m_yuvHeight != height) {
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width/2, height, 0,
+                 GL_RGBA, GL_UNSIGNED_BYTE, image.data);
+    m_yuvWidth = width/2;
+    m_yuvHeight = height;
+  } else {
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width/2, height,
+                    GL_RGBA, GL_UNSIGNED_BYTE, image.data);
+  }
+
+  /* the target has the exact size, just like the CPU path */
+  if(needsStorage(width, height, GL_RGBA8)) {
+    glBindTexture(m_textureType, m_textureObj);
+    allocateTexture(width, height, GL_RGBA8);
+    glBindTexture(GL_TEXTURE_2D, packed);
+  }
+  GLuint target=m_textureObj;
+
+  GLuint fbo=m_yuvFbo;
+  if(!fbo) {
+    glGenFramebuffers(1, &fbo);
+    m_yuvFbo=fbo;
+  }
+  GLint oldFbo=0, oldProgram=0;
+  glGetIntegerv(GL_FRAMEBUFFER_BINDING, &oldFbo);
+  glGetIntegerv(GL_CURRENT_PROGRAM, &oldProgram);
+  glPushAttrib(GL_ALL_ATTRIB_BITS);
+
+  glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                         m_textureType, target, 0);
+  glViewport(0, 0, width, height);
+  glDisable(GL_BLEND);
+  glDisable(GL_DEPTH_TEST);
+  glDisable(GL_SCISSOR_TEST);
+  glUseProgram(program);
+  glUniform1i(glGetUniformLocation(program, "uyvy"), m_texunit);
+  drawQuad();
+
+  glUseProgram(oldProgram);
+  glBindFramebuffer(GL_FRAMEBUFFER, oldFbo);
+  glPopAttrib();
+  glBindTexture(m_textureType, target);
+
+  m_xRatio = 1.0;
+  m_yRatio = 1.0;
+  m_upsidedown = image.upsidedown;
+  tex2state(state, m_coords, 4);
+  m_hasMipmap = false;
+  return true;
+}
+
+void tex_gradient :: drawQuad(void)
+{
+  glBegin(GL_QUADS);
+  glVertex2f(-1.f, -1.f);
+  glVertex2f( 1.f, -1.f);
+  glVertex2f( 1.f,  1.f);
+  glVertex2f(-1.f,  1.f);
+  glEnd();
+}
+
+void tex_gradient :: destroyYuvShader(void)
+{
+  GLuint program=m_yuvProgram;
+  if(program) {
+    glDeleteProgram(program);
+    m_yuvProgram=0;
+  }
+  GLuint tex=m_yuvTexture;
+  if(tex) {
+    glDeleteTextures(1, &tex);
+    m_yuvTexture=0;
+  }
+  GLuint fbo=m_yuvFbo;
+  if(fbo) {
+    glDeleteFramebuffers(1, &fbo);
+    m_yuvFbo=0;
+  }
+}
+
+////////////////////////////////////////////////////////
+// projectM render-to-texture
+//
+/////////////////////////////////////////////////////////
+bool tex_gradient :: setupFbo(void)
+{
+  GLuint tex=m_fboTexture;
+  GLuint fbo=m_fbo;
+  if(fbo && m_fboBuilt == m_fboGeneration) {
+    return true;
+  }
+
+  if(!tex) {
+    glGenTextures(1, &tex);
+  }
+  glBindTexture(GL_TEXTURE_2D, tex);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, m_fboWidth, m_fboHeight, 0,
+               GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  if(!fbo) {
+    glGenFramebuffers(1, &fbo);
+  }
+  GLint oldFbo=0;
+  glGetIntegerv(GL_FRAMEBUFFER_BINDING, &oldFbo);
+  glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                         GL_TEXTURE_2D, tex, 0);
+  GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+  glBindFramebuffer(GL_FRAMEBUFFER, oldFbo);
+
+  m_fboTexture=tex;
+  m_fbo=fbo;
+  if(status != GL_FRAMEBUFFER_COMPLETE) {
+    error("framebuffer incomplete (0x%x)", status);
+    destroyFbo();
+    return false;
+  }
+  m_fboBuilt = m_fboGeneration;
+  return true;
+}
+
+void tex_gradient :: destroyFbo(void)
+{
+  GLuint fbo=m_fbo;
+  if(fbo) {
+    glDeleteFramebuffers(1, &fbo);
+    m_fbo=0;
+  }
+  GLuint tex=m_fboTexture;
+  if(tex) {
+    glDeleteTextures(1, &tex);
+    m_fboTexture=0;
+  }
+}
+
+/* hand the FBO texture downstream, exactly as if we had uploaded it */
+void tex_gradient :: sendFboTexture(GemState *state)
+{
+  GLuint tex=m_fboTexture;
+  if(GLEW_VERSION_1_3) {
+    glActiveTexture(GL_TEXTURE0_ARB + m_texunit);
+  }
+  m_textureType = GL_TEXTURE_2D;
+  glEnable(GL_TEXTURE_2D);
+  glBindTexture(GL_TEXTURE_2D, tex);
+  if (m_wantMipmap && m_canMipmap) {
+    glGenerateMipmap(GL_TEXTURE_2D);
+  }
+  setTexFilters(m_textureMinQuality != GL_LINEAR_MIPMAP_LINEAR
+                || (m_wantMipmap && m_canMipmap));
+  glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, m_repeat);
+  glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, m_repeat);
+  glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, m_env);
+
+  m_xRatio = 1.0;
+  m_yRatio = 1.0;
+  setTexCoords(m_coords, m_xRatio, m_yRatio, false);
+  tex2state(state, m_coords, 4);
+
+  int numTexUnits=m_numTexUnits;
+  state->set(GemState::_GL_TEX_UNITS, numTexUnits);
+  state->set(GemState::_GL_TEX_TYPE, 1);
+  m_baseCoord.s=m_xRatio;
+  m_baseCoord.t=m_yRatio;
+  state->set(GemState::_GL_TEX_BASECOORD, m_baseCoord);
+  state->set(GemState::_GL_TEX_ORIENTATION, false);
+  m_didTexture=true;
+
+  sendExtTexture(tex, m_xRatio, m_yRatio, GL_TEXTURE_2D, false);
+}
+
+////////////////////////////////////////////////////////
+// projectM render-to-texture
+//
+/////////////////////////////////////////////////////////
+bool tex_gradient :: setupProjectM(void)
+{
+  projectm_handle projectm=m_projectm;
+  if(!projectm) {
+    projectm = projectm_create(NULL, 0);
+    if(!projectm) {
+      error("projectm_create() failed");
+      m_projectmOn = false;
+      return false;
+    }
+    projectm_set_texture_size(projectm, 2048);
+    projectm_set_mesh_size(projectm, 128, 128);
+    projectm_set_window_size(projectm, m_fboWidth, m_fboHeight);
+    m_projectm=projectm;
+    /* a new instance needs the preset, even if it did not change */
+    m_presetLoaded=0;
+  }
+
+  const bool resized = !m_fbo || m_fboBuilt != m_fboGeneration;
+  if(!setupFbo()) {
+    destroyProjectM();
+    m_projectmOn = false;
+    return false;
+  }
+  if(resized) {
+    projectm_set_window_size(projectm, m_fboWidth, m_fboHeight);
+  }
+
+  if(m_presetLoaded != m_presetGeneration && !m_preset.empty()) {
+    int rating[1] = {1};
+    projectm_clear_playlist(projectm);
+    projectm_insert_preset_url(projectm, 0, m_preset.c_str(), "pd", rating, 0);
+    projectm_select_preset(projectm, 0, true);
+    projectm_lock_preset(projectm, true);
+    m_presetLoaded=m_presetGeneration;
+  }
+  return true;
+}
+
+void tex_gradient :: destroyProjectM(void)
+{
+  projectm_handle projectm=m_projectm;
+  if(projectm) {
+    projectm_destroy(projectm);
+    m_projectm=NULL;
+  }
+  destroyFbo();
+}
+
+void tex_gradient :: renderProjectM(GemState *state)
+{
+  if(!setupProjectM()) {
+    return;
+  }
+
+  /* projectM is a core-profile renderer that changes whatever state it
+   * needs, so save Gem's state around it */
+  GLint oldFbo=0, oldProgram=0, oldVao=0, oldArrayBuffer=0, oldViewport[4];
+  glGetIntegerv(GL_FRAMEBUFFER_BINDING, &oldFbo);
+  glGetIntegerv(GL_CURRENT_PROGRAM, &oldProgram);
+  glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &oldVao);
+  glGetIntegerv(GL_ARRAY_BUFFER_BINDING, &oldArrayBuffer);
+  glGetIntegerv(GL_VIEWPORT, oldViewport);
+  glPushAttrib(GL_ALL_ATTRIB_BITS);
+  glPushClientAttrib(GL_CLIENT_ALL_ATTRIB_BITS);
+
+  glBindFramebuffer(GL_FRAMEBUFFER, m_fbo);
+  glViewport(0, 0, m_fboWidth, m_fboHeight);
+  stage_timer_begin(m_stageTimer, STAGE_RENDER);
+  glClear(GL_COLOR_BUFFER_BIT);
+  projectm_render_frame(m_projectm);
+  stage_timer_end(m_stageTimer, STAGE_RENDER);
+
+  glBindFramebuffer(GL_FRAMEBUFFER, oldFbo);
+  glBindVertexArray(oldVao);
+  glBindBuffer(GL_ARRAY_BUFFER, oldArrayBuffer);
+  glUseProgram(oldProgram);
+  glPopClientAttrib();
+  glPopAttrib();
+  glViewport(oldViewport[0], oldViewport[1], oldViewport[2], oldViewport[3]);
+
+  sendFboTexture(state);
+}
+
+////////////////////////////////////////////////////////
+// procedural gradient
+//
+// rendered into the FBO texture by a fragment shader; only the
+// uniforms change, and only when a parameter did, so an animated
+// gradient costs neither CPU loops nor upload bandwidth
+/////////////////////////////////////////////////////////
+#define GRADIENT_STR2(x) #x
+#define GRADIENT_STR(x) GRADIENT_STR2(x)
+#define GRADIENT_MAX_STOPS_STR GRADIENT_STR(GRADIENT_MAX_STOPS)
+
+static const char gradientFragmentShader[] =
+  "#version 130\n"
+  "uniform int type;\n"          /* 0 linear, 1 radial, 2 angular */
+  "uniform int spread;\n"        /* 0 pad, 1 repeat, 2 reflect */
+  "uniform vec2 size;\n"
+  "uniform vec2 direction;\n"
+  "uniform vec2 center;\n"
+  "uniform float phase;\n"
+  "uniform int count;\n"
+  "uniform float positions[" GRADIENT_MAX_STOPS_STR "];\n"
+  "uniform vec4 colors[" GRADIENT_MAX_STOPS_STR "];\n"
+  "void main() {\n"
+  "  vec2 uv = gl_FragCoord.xy / size;\n"
+  "  float t;\n"
+  "  if (type == 0) {\n"
+  "    t = dot(uv - 0.5, direction) / (abs(direction.x) + abs(direction.y)) + 0.5;\n"
+  "  } else if (type == 1) {\n"
+  "    t = 2.0 * length(uv - center);\n"
+  "  } else {\n"
+  "    t = atan(uv.y - center.y, uv.x - center.x) / 6.2831853 + 0.5;\n"
+  "  }\n"
+  "  t += phase;\n"
+  "  if (spread == 1 || type == 2) {\n"
+  "    t = fract(t);\n"
+  "  } else if (spread == 2) {\n"
+  "    t = 1.0 - abs(mod(t, 2.0) - 1.0);\n"
+  "  }\n"
+  "  vec4 c = colors[0];\n"
+  "  for (int i = 1; i < count; i++) {\n"
+  "    float w = max(positions[i] - positions[i-1], 1e-6);\n"
+  "    c = mix(c, colors[i], clamp((t - positions[i-1]) / w, 0.0, 1.0));\n"
+  "  }\n"
+  "  gl_FragColor = c;\n"
+  "}\n";
+
+void tex_gradient :: renderGradient(GemState *state)
+{
+  bool redraw = !m_fbo || m_fboBuilt != m_fboGeneration ||
+                m_gradientDrawn != m_gradientGeneration;
+  if(!setupFbo()) {
+    m_gradientType = GRADIENT_OFF;
+    return;
+  }
+
+  GLuint program=m_gradientProgram;
+  if(!program) {
+    program=compileProgram(gradientFragmentShader);
+    if(!program) {
+      m_gradientType = GRADIENT_OFF;
+      return;
+    }
+    m_gradientProgram=program;
+    redraw=true;
+  }
+
+  if(redraw) {
+    GLint oldFbo=0, oldProgram=0;
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &oldFbo);
+    glGetIntegerv(GL_CURRENT_PROGRAM, &oldProgram);
+    glPushAttrib(GL_ALL_ATTRIB_BITS);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, m_fbo);
+    glViewport(0, 0, m_fboWidth, m_fboHeight);
+    glDisable(GL_BLEND);
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_SCISSOR_TEST);
+    glUseProgram(program);
+
+    const float rad = m_gradientAngle * M_PI / 180.;
+    glUniform1i(glGetUniformLocation(program, "type"), m_gradientType - 1);
+    glUniform1i(glGetUniformLocation(program, "spread"), m_gradientSpread);
+    glUniform2f(glGetUniformLocation(program, "size"), m_fboWidth,
+                m_fboHeight);
+    glUniform2f(glGetUniformLocation(program, "direction"), cos(rad),
+                sin(rad));
+    glUniform2f(glGetUniformLocation(program, "center"), m_gradientCenter[0],
+                m_gradientCenter[1]);
+    glUniform1f(glGetUniformLocation(program, "phase"), m_gradientPhase);
+    glUniform1i(glGetUniformLocation(program, "count"), m_gradientStops);
+    glUniform1fv(glGetUniformLocation(program, "positions"), m_gradientStops,
+                 m_gradientPositions);
+    glUniform4fv(glGetUniformLocation(program, "colors"), m_gradientStops,
+                 m_gradientColors);
+    stage_timer_begin(m_stageTimer, STAGE_DRAW);
+    drawQuad();
+    stage_timer_end(m_stageTimer, STAGE_DRAW);
+
+    glUseProgram(oldProgram);
+    glBindFramebuffer(GL_FRAMEBUFFER, oldFbo);
+    glPopAttrib();
+    m_gradientDrawn=m_gradientGeneration;
+  }
+
+  sendFboTexture(state);
+}
+
+void tex_gradient :: destroyGradient(void)
+{
+  GLuint program=m_gradientProgram;
+  if(program) {
+    glDeleteProgram(program);
+    m_gradientProgram=0;
+  }
+}
+
 ////////////////////////////////////////////////////////
 // render
 //
@@ -236,24 +1094,30 @@ void tex_gradient :: render(GemState *state)
   if(!m_textureOnOff) {
     return;
   }
+  stage_timer_t*timer=m_stageTimer;
+  if(!timer) {
+    timer=new stage_timer_t;
+    stage_timer_init(timer);
+    m_stageTimer=timer;
+  }
+  stage_timer_frame(timer);
+
+  if(m_projectmOn) {
+    renderProjectM(state);
+    return;
+  }
+  if(m_gradientType != GRADIENT_OFF) {
+    renderGradient(state);
+    return;
+  }
 
   bool upsidedown=false;
-  bool normalized=true;
   bool canMipmap=m_canMipmap;
 
   int texType = m_textureType;
-  int x_2=1, y_2=1;
   int newfilm = 0;
   pixBlock*img=NULL;
-  GLint internalformat = GL_RGBA;
-
-  if(m_pbo && (m_numPbo != m_oldNumPbo)) {
-    /* the PBO settings have changed, invalidate the old PBO */
-    GLuint*pbo=m_pbo;
-    glDeleteBuffersARB(m_numPbo, pbo);
-    delete[]pbo;
-    m_pbo=NULL;
-  }
+  GLint internalformat = GL_RGBA8;
 
   state->get(GemState::_PIX, img);
   if(img) {
@@ -273,33 +1137,56 @@ void tex_gradient :: render(GemState *state)
   tex2state(state, m_coords, 4);
 
     upsidedown = img->image.upsidedown;
-    if (img->newimage) {
+
+    /* upload straight from upstream's image; m_imagebuf is only used
+     * when the image has to be converted first.  an image that has not
+     * changed since the last upload is not touched at all */
+    if (img->newimage || imageChanged(img->image)) {
+      m_srcXsize  = img->image.xsize;
+      m_srcYsize  = img->image.ysize;
+      m_srcCsize  = img->image.csize;
+      m_srcFormat = img->image.format;
+      m_srcType   = img->image.type;
+      m_srcData   = img->image.data;
+      m_imageGeneration++;
+      m_rebuildList = true;
+    }
+
+    // if YUV is not supported on this platform, we have to convert it to RGB
+    // either on the CPU into m_imagebuf, or with a shader (see convertYuvOnGpu())
+    const bool do_yuv = m_yuv && GLEW_APPLE_ycbcr_422;
+    const bool convert = !do_yuv && img->image.format == GEM_YUV;
+    const bool shader = convert && m_yuvShader;
+    imageStruct*src = (convert && !shader) ? &m_imagebuf : &img->image;
+
+    if (convert && !shader && m_convertedGeneration != m_imageGeneration) {
+      // RGBA rather than RGB: 4 byte pixels keep the SIMD stores simple
+      // and the rows aligned for the upload
+      m_imagebuf.xsize  = img->image.xsize;
+      m_imagebuf.ysize  = img->image.ysize;
+      m_imagebuf.type   = GL_UNSIGNED_BYTE;
+      m_imagebuf.format = GL_RGBA;
+      m_imagebuf.csize  = 4;
+      m_imagebuf.upsidedown = img->image.upsidedown;
+      m_imagebuf.reallocate();
+      yuv_convert_image(&m_yuvPool, m_yuvConvert, m_imagebuf.data, img->image.data,
+                        img->image.xsize, img->image.ysize);
+      countCopy(m_imagebuf.xsize * m_imagebuf.ysize * m_imagebuf.csize);
+      m_convertedGeneration = m_imageGeneration;
       m_rebuildList = true;
     }
 
-    img->image.copy2ImageStruct(&m_imagebuf);
-    switch(m_imagebuf.type) {
+    switch(src->type) {
     case GL_FLOAT:
     case GL_DOUBLE:
       internalformat =  GL_RGBA32F;
       break;
     default:
-      internalformat = GL_RGBA;
+      internalformat = GL_RGBA8;
     }
 
-    x_2 = powerOfTwo(m_imagebuf.xsize);
-    y_2 = powerOfTwo(m_imagebuf.ysize);
-
-    normalized = ((m_imagebuf.xsize==x_2) && (m_imagebuf.ysize==y_2));
-
-    debug_post("normalized=%d\t%d - %d\t%d - %d", normalized, m_imagebuf.xsize,
-               x_2, m_imagebuf.ysize, y_2);
-
       m_textureType = GL_TEXTURE_2D;
       debug_post("using mode 0:GL_TEXTURE_2D");
-      normalized = 0;
-
-    debug_post("normalized=%d", normalized);
   
 
   if (m_textureType!=texType) {
@@ -320,8 +1207,8 @@ void tex_gradient :: render(GemState *state)
       if ( GLEW_APPLE_texture_range ) {
         if(glTextureRangeAPPLE == NULL) {
           glTextureRangeAPPLE( m_textureType,
-                               m_imagebuf.xsize * m_imagebuf.ysize * m_imagebuf.csize,
-                               m_imagebuf.data );
+                               src->xsize * src->ysize * src->csize,
+                               src->data );
           debug_post("using glTextureRangeAPPLE()");
         } else {
           glTextureRangeAPPLE( m_textureType, 0, NULL );
@@ -352,169 +1239,30 @@ void tex_gradient :: render(GemState *state)
   /* here comes the work: a new image has to be transferred from main memory to GPU and attached to a texture object */
 
   if (m_rebuildList) {
-    // if YUV is not supported on this platform, we have to convert it to RGB
-    //(skip Alpha since it isn't used)
-    const bool do_yuv = m_yuv && GLEW_APPLE_ycbcr_422;
-    if (!do_yuv && m_imagebuf.format == GEM_YUV) {
-      m_imagebuf.format=GL_RGB;
-      m_imagebuf.csize=3;
-      m_imagebuf.reallocate();
-      if(img) {
-        m_imagebuf.fromYUV422(img->image.data);
+    if (shader) {
+      stage_timer_begin(m_stageTimer, STAGE_UPLOAD);
+      const bool converted = convertYuvOnGpu(img->image, state);
+      stage_timer_end(m_stageTimer, STAGE_UPLOAD);
+      if(!converted) {
+        error("YUV shader failed, converting on the CPU");
+        m_yuvShader = false;
+        m_srcData = NULL; /* try again next frame */
       }
-    }
-    if (normalized) {
-      m_buffer.xsize = m_imagebuf.xsize;
-      m_buffer.ysize = m_imagebuf.ysize;
-      m_buffer.csize  = m_imagebuf.csize;
-      m_buffer.format = m_imagebuf.format;
-      m_buffer.type   = m_imagebuf.type;
-      m_buffer.reallocate();
+    } else {
+      /* GL-3.3 guarantees non-power-of-two textures, so the texture is
+       * exactly as large as the image and the coordinates go up to 1.0 */
+      if (needsStorage(src->xsize, src->ysize, internalformat)) {
+        allocateTexture(src->xsize, src->ysize, internalformat);
+        // just to make sure...
+        img->newfilm = 0;
+      }
+      stage_timer_begin(m_stageTimer, STAGE_UPLOAD);
+      uploadImage(src);
+      stage_timer_end(m_stageTimer, STAGE_UPLOAD);
       m_xRatio=1.0;
       m_yRatio=1.0;
       m_upsidedown=upsidedown;
-
-      tex2state(state, m_coords, 4);
-      if (m_buffer.csize != m_dataSize[0] ||
-          m_buffer.xsize != m_dataSize[1] ||
-          m_buffer.ysize != m_dataSize[2]) {
-        m_dataSize[0] = m_buffer.csize;
-        m_dataSize[1] = m_buffer.xsize;
-        m_dataSize[2] = m_buffer.ysize;
-
-      }
-      //if the texture is a power of two in size then there is no need to subtexture
-      glTexImage2D(m_textureType, /* target */
-                   0, /* level */
-                   internalformat, /* internalformat */
-                   m_imagebuf.xsize, m_imagebuf.ysize,
-                   0, /* border */
-                   m_imagebuf.format,
-                   m_imagebuf.type,
-                   m_imagebuf.data);
-      m_hasMipmap = false;
-
-    } else { // !normalized
-      m_xRatio = (float)m_imagebuf.xsize;
-      m_yRatio = (float)m_imagebuf.ysize;
-        m_xRatio /= (float)x_2;
-        m_yRatio /= (float)y_2;
-        m_buffer.xsize = x_2;
-        m_buffer.ysize = y_2;
-
-      m_buffer.csize  = m_imagebuf.csize;
-      m_buffer.format = m_imagebuf.format;
-      m_buffer.type   = m_imagebuf.type;
-      m_buffer.reallocate();
-      m_upsidedown=upsidedown;
       tex2state(state, m_coords, 4);
-
-      if (m_buffer.csize != m_dataSize[0] ||
-          m_buffer.xsize != m_dataSize[1] ||
-          m_buffer.ysize != m_dataSize[2]) {
-        newfilm = 1;
-
-      } //end of loop if size has changed
-
-      // okay, load in the actual pixel data
-
-      //when doing rectangle textures the buffer changes after every film is loaded this call makes sure the
-      //texturing is updated as well to prevent crashes
-      if(newfilm) {
-        m_dataSize[0] = m_buffer.csize;
-        m_dataSize[1] = m_buffer.xsize;
-        m_dataSize[2] = m_buffer.ysize;
-
-        if (m_buffer.format == GEM_YUV && !m_rectangle) {
-          m_buffer.setBlack();
-        }
-
-        if(m_numPbo>0) {
-          if(GLEW_ARB_pixel_buffer_object) {
-            GLuint*pbo=m_pbo;
-            if(pbo) {
-              delete[]pbo;
-              pbo=NULL;
-            }
-            pbo=new GLuint[m_numPbo];
-            m_oldNumPbo=m_numPbo;
-            m_pbo=pbo;
-            glGenBuffersARB(m_numPbo, pbo);
-            int i=0;
-            for(i=0; i<m_numPbo; i++) {
-              glBindBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB, pbo[i]);
-              glBufferDataARB(GL_PIXEL_UNPACK_BUFFER_ARB,
-                              m_buffer.xsize*m_buffer.ysize*m_buffer.csize,
-                              0, GL_STREAM_DRAW_ARB);
-            }
-            glBindBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB, 0);
-
-          } else {
-            verbose(1, "PBOs not supported! disabling");
-            m_numPbo=0;
-          }
-        }
-
-        //this is for dealing with power of 2 textures which need a buffer that's 2^n
-          glTexImage2D( m_textureType, 0,
-                        //m_buffer.csize,
-                        internalformat,
-                        m_buffer.xsize,
-                        m_buffer.ysize, 0,
-                        m_buffer.format,
-                        m_buffer.type,
-                        m_buffer.data);
-          m_hasMipmap = false;
-          debug_post("TexImage2D non rectangle");
-
-        // just to make sure...
-        img->newfilm = 0;
-      }
-
-      if(m_pbo && m_numPbo) {
-        GLuint*pbo=m_pbo;
-        m_curPbo=(m_curPbo+1)%m_numPbo;
-        GLuint index=m_curPbo;
-        GLuint nextIndex=(m_curPbo+1)%m_numPbo;
-
-        glBindBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB, pbo[index]);
-        glTexSubImage2D(m_textureType, 0,
-                        0, 0,
-                        m_imagebuf.xsize,
-                        m_imagebuf.ysize,
-                        m_imagebuf.format,
-                        m_imagebuf.type,
-                        NULL); /* <-- that's the key */
-        m_hasMipmap = false;
-
-        glBindBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB, pbo[nextIndex]);
-        glBufferDataARB(GL_PIXEL_UNPACK_BUFFER_ARB,
-                        m_imagebuf.xsize * m_imagebuf.ysize * m_imagebuf.csize, 0,
-                        GL_STREAM_DRAW_ARB);
-
-        GLubyte* ptr = (GLubyte*)glMapBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB,
-                                                GL_WRITE_ONLY_ARB);
-        if(ptr) {
-          // update data off the mapped buffer
-          memcpy(ptr, m_imagebuf.data,
-                 m_imagebuf.xsize * m_imagebuf.ysize * m_imagebuf.csize);
-          glUnmapBufferARB(
-            GL_PIXEL_UNPACK_BUFFER_ARB); // release pointer to mapping buffer
-        }
-
-        /* unbind the current buffer */
-        glBindBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB, 0);
-
-      } else {
-        glTexSubImage2D(m_textureType, 0,
-                        0, 0,                           // position
-                        m_imagebuf.xsize,
-                        m_imagebuf.ysize,
-                        m_imagebuf.format,
-                        m_imagebuf.type,
-                        m_imagebuf.data);
-        m_hasMipmap = false;
-      }
     }
   } // rebuildlist
 
@@ -596,7 +1344,11 @@ void tex_gradient :: startRendering()
   m_textureObj=m_realTextureObj;
   setUpTextureState();
 
-  m_dataSize[0] = m_dataSize[1] = m_dataSize[2] = -1;
+  m_texFormat = -1;
+  m_texWidth = -1;
+  m_texHeight = -1;
+  /* a fresh texture needs the image, even if it did not change */
+  m_srcData = NULL;
 
   if (!m_realTextureObj)        {
     error("Unable to allocate texture object");
@@ -615,16 +1367,25 @@ void tex_gradient :: stopRendering()
     glDeleteTextures(1, &obj);
 
     m_realTextureObj = 0;
-    m_dataSize[0] = m_dataSize[1] = m_dataSize[2] = -1;
+    m_texFormat = -1;
+    m_texWidth = -1;
+    m_texHeight = -1;
   }
-
-  if(m_pbo) {
-    GLuint*pbo=m_pbo;
-    glDeleteBuffersARB(m_numPbo, pbo);
-    delete[]pbo;
-    m_pbo=NULL;
+  destroyTexturePool();
+
+  destroyPbo();
+  destroyYuvShader();
+  destroyGradient();
+  stage_timer_t*timer=m_stageTimer;
+  if(timer) {
+    stage_timer_release(timer);
+    stage_timer_free(timer);
+    delete timer;
+    m_stageTimer=NULL;
   }
 
+  /* projectM's GL objects die with the context, it is recreated on demand */
+  destroyProjectM();
 }
 
 
@@ -755,14 +1516,7 @@ void tex_gradient :: pboMess(int num)
     return;
   }
 
-  if(m_pbo) {
-    GLuint*pbo=m_pbo;
-    glDeleteBuffersARB(m_numPbo, pbo);
-    delete[]pbo;
-    m_pbo=NULL;
-    m_numPbo=0;
-  }
-
+  /* the ring is re-allocated in the render context (see setupPbo()) */
   m_numPbo=num;
   setModified();
 }
@@ -775,11 +1529,240 @@ void tex_gradient :: yuvMess(int mode)
 {
   m_yuv=mode;
 }
+void tex_gradient :: yuvShaderMess(int on)
+{
+  m_yuvShader = (on != 0);
+  m_srcData = NULL; /* convert the current image again */
+  setModified();
+}
 void tex_gradient :: texunitMess(int unit)
 {
   m_texunit=unit;
 }
 
+////////////////////////////////////////////////////////
+// projectM messages
+//
+/////////////////////////////////////////////////////////
+void tex_gradient :: presetMess(t_symbol*preset)
+{
+  m_preset = preset->s_name;
+  m_presetGeneration++;
+  m_projectmOn = true;
+  m_gradientType = GRADIENT_OFF;
+  setModified();
+}
+void tex_gradient :: projectmMess(int on)
+{
+  m_projectmOn = (on != 0);
+  if(m_projectmOn) {
+    m_gradientType = GRADIENT_OFF;
+  }
+  setModified();
+}
+void tex_gradient :: dimenMess(int width, int height)
+{
+  if(width<1 || height<1) {
+    error("invalid dimensions %dx%d", width, height);
+    return;
+  }
+  m_fboWidth = width;
+  m_fboHeight = height;
+  m_fboGeneration++;
+  setModified();
+}
+
+////////////////////////////////////////////////////////
+// gradient messages
+//
+/////////////////////////////////////////////////////////
+void tex_gradient :: gradientMess(t_symbol*type)
+{
+  if(type == gensym("linear")) {
+    m_gradientType = GRADIENT_LINEAR;
+  } else if(type == gensym("radial")) {
+    m_gradientType = GRADIENT_RADIAL;
+  } else if(type == gensym("angular")) {
+    m_gradientType = GRADIENT_ANGULAR;
+  } else if(type == gensym("off")) {
+    m_gradientType = GRADIENT_OFF;
+  } else {
+    error("gradient: unknown type '%s' (linear, radial, angular, off)",
+          type->s_name);
+    return;
+  }
+  if(m_gradientType != GRADIENT_OFF) {
+    /* both render into the same FBO texture */
+    m_projectmOn = false;
+  }
+  m_gradientGeneration++;
+  setModified();
+}
+void tex_gradient :: stopsMess(t_symbol*s, int argc, t_atom*argv)
+{
+  /* <position> <r> <g> <b> <a> per stop */
+  if(argc % 5 || argc < 10 || argc > 5 * GRADIENT_MAX_STOPS) {
+    error("%s: need 2 to %d stops of <position> <r> <g> <b> <a>",
+          s->s_name, GRADIENT_MAX_STOPS);
+    return;
+  }
+  int count = argc / 5;
+  for(int i=0; i<count; i++) {
+    m_gradientPositions[i] = atom_getfloat(argv + 5*i);
+    for(int c=0; c<4; c++) {
+      m_gradientColors[4*i + c] = atom_getfloat(argv + 5*i + 1 + c);
+    }
+  }
+  /* the shader expects the stops in order; insertion sort, there are few */
+  for(int i=1; i<count; i++) {
+    for(int j=i; j>0 && m_gradientPositions[j-1] > m_gradientPositions[j]; j--) {
+      float pos = m_gradientPositions[j];
+      m_gradientPositions[j] = m_gradientPositions[j-1];
+      m_gradientPositions[j-1] = pos;
+      for(int c=0; c<4; c++) {
+        float col = m_gradientColors[4*j + c];
+        m_gradientColors[4*j + c] = m_gradientColors[4*(j-1) + c];
+        m_gradientColors[4*(j-1) + c] = col;
+      }
+    }
+  }
+  m_gradientStops = count;
+  m_gradientGeneration++;
+}
+void tex_gradient :: angleMess(t_float degrees)
+{
+  m_gradientAngle = degrees;
+  m_gradientGeneration++;
+}
+void tex_gradient :: centerMess(t_float x, t_float y)
+{
+  m_gradientCenter[0] = x;
+  m_gradientCenter[1] = y;
+  m_gradientGeneration++;
+}
+void tex_gradient :: phaseMess(t_float phase)
+{
+  m_gradientPhase = phase;
+  m_gradientGeneration++;
+}
+void tex_gradient :: spreadMess(t_symbol*spread)
+{
+  if(spread == gensym("pad")) {
+    m_gradientSpread = 0;
+  } else if(spread == gensym("repeat")) {
+    m_gradientSpread = 1;
+  } else if(spread == gensym("reflect")) {
+    m_gradientSpread = 2;
+  } else {
+    error("spread: unknown mode '%s' (pad, repeat, reflect)", spread->s_name);
+    return;
+  }
+  m_gradientGeneration++;
+}
+
+////////////////////////////////////////////////////////
+// statistics
+//
+/////////////////////////////////////////////////////////
+void tex_gradient :: copiedMess(void)
+{
+  /* bytes/second over the last second, and bytes since creation */
+  t_atom ap[2];
+  double rate = m_copiedRate;
+  if(sys_getrealtime() - m_copiedSince >= 2.) {
+    /* nothing was copied for a while */
+    rate = 0.;
+  }
+  SETFLOAT(ap+0, (t_float)rate);
+  SETFLOAT(ap+1, (t_float)m_copiedTotal);
+  outlet_anything(m_outInfo, gensym("copied"), 2, ap);
+}
+
+void tex_gradient :: memoryMess(void)
+{
+  /* bytes of the texture and bytes saved compared to padding it */
+  t_atom ap[2];
+  SETFLOAT(ap+0, (t_float)m_texBytes);
+  SETFLOAT(ap+1, (t_float)m_texSavedBytes);
+  outlet_anything(m_outInfo, gensym("memory"), 2, ap);
+}
+
+void tex_gradient :: poolMess(int size)
+{
+  if(size<0) {
+    return;
+  }
+  /* shrinking happens on the next reallocation, in the render context */
+  m_poolSize=size;
+}
+
+void tex_gradient :: poolStatsMess(void)
+{
+  /* hits misses parked */
+  t_atom ap[3];
+  SETFLOAT(ap+0, (t_float)m_poolHits);
+  SETFLOAT(ap+1, (t_float)m_poolMisses);
+  TexturePool*pool=m_texPool;
+  SETFLOAT(ap+2, (t_float)(pool ? pool->size() : 0));
+  outlet_anything(m_outInfo, gensym("pool_stats"), 3, ap);
+}
+
+void tex_gradient :: pboStatsMess(void)
+{
+  /* persistent(0/1) uploads avg_ms max_ms stalls stall_ms */
+  t_atom ap[6];
+  GLubyte**map=m_pboMap;
+  double avg = m_pboUploads ? m_pboUploadTime / m_pboUploads : 0.;
+  SETFLOAT(ap+0, (t_float)(map != NULL));
+  SETFLOAT(ap+1, (t_float)m_pboUploads);
+  SETFLOAT(ap+2, (t_float)(avg * 1000.));
+  SETFLOAT(ap+3, (t_float)(m_pboUploadMax * 1000.));
+  SETFLOAT(ap+4, (t_float)m_pboStalls);
+  SETFLOAT(ap+5, (t_float)(m_pboWaitTime * 1000.));
+  outlet_anything(m_outInfo, gensym("pbo_stats"), 6, ap);
+}
+
+void tex_gradient :: statsMess(void)
+{
+  /* per stage with samples:
+   *   stats <stage> <frames> <cpu mean/p50/p99/max ms> <gpu mean/p50/p99/max ms>
+   *   histogram <stage> cpu|gpu <count below 2us> <below 4us> ... <2^17us and more>
+   * the GPU times are -1 without timer queries */
+  stage_timer_t*timer=m_stageTimer;
+  if(!timer) {
+    return;
+  }
+  for(int stage=0; stage<STAGE_COUNT; stage++) {
+    stage_summary_t s[2];
+    stage_timer_summary(timer, (stage_t)stage, 0, s+0);
+    stage_timer_summary(timer, (stage_t)stage, 1, s+1);
+    if(!s[0].samples) {
+      continue;
+    }
+    t_atom ap[2+STAGE_TIMER_BUCKETS];
+    SETSYMBOL(ap+0, gensym(stage_timer_name((stage_t)stage)));
+    SETFLOAT(ap+1, (t_float)s[0].samples);
+    for(int gpu=0; gpu<2; gpu++) {
+      const bool have = s[gpu].samples > 0;
+      SETFLOAT(ap+2+4*gpu, have ? (t_float)(s[gpu].mean * 1000.) : -1);
+      SETFLOAT(ap+3+4*gpu, have ? (t_float)(s[gpu].p50 * 1000.) : -1);
+      SETFLOAT(ap+4+4*gpu, have ? (t_float)(s[gpu].p99 * 1000.) : -1);
+      SETFLOAT(ap+5+4*gpu, have ? (t_float)(s[gpu].max * 1000.) : -1);
+    }
+    outlet_anything(m_outInfo, gensym("stats"), 10, ap);
+    for(int gpu=0; gpu<2; gpu++) {
+      if(!s[gpu].samples) {
+        continue;
+      }
+      SETSYMBOL(ap+1, gensym(gpu ? "gpu" : "cpu"));
+      for(int b=0; b<STAGE_TIMER_BUCKETS; b++) {
+        SETFLOAT(ap+2+b, (t_float)s[gpu].histogram[b]);
+      }
+      outlet_anything(m_outInfo, gensym("histogram"), 2+STAGE_TIMER_BUCKETS, ap);
+    }
+  }
+}
+
 ////////////////////////////////////////////////////////
 // static member functions
 //
@@ -794,10 +1777,29 @@ void tex_gradient :: obj_setupCallback(t_class *classPtr)
   CPPEXTERN_MSG1(classPtr, "client_storage", clientStorage, int);
 
   CPPEXTERN_MSG1(classPtr, "yuv", yuvMess, int);
+  CPPEXTERN_MSG1(classPtr, "yuv_shader", yuvShaderMess, int);
   CPPEXTERN_MSG1(classPtr, "pbo", pboMess, int);
 
   CPPEXTERN_MSG1(classPtr, "texunit", texunitMess, int);
 
+  CPPEXTERN_MSG1(classPtr, "preset", presetMess, t_symbol*);
+  CPPEXTERN_MSG1(classPtr, "projectm", projectmMess, int);
+  CPPEXTERN_MSG2(classPtr, "dimen", dimenMess, int, int);
+
+  CPPEXTERN_MSG1(classPtr, "gradient", gradientMess, t_symbol*);
+  CPPEXTERN_MSG (classPtr, "stops", stopsMess);
+  CPPEXTERN_MSG1(classPtr, "angle", angleMess, t_float);
+  CPPEXTERN_MSG2(classPtr, "center", centerMess, t_float, t_float);
+  CPPEXTERN_MSG1(classPtr, "phase", phaseMess, t_float);
+  CPPEXTERN_MSG1(classPtr, "spread", spreadMess, t_symbol*);
+
+  CPPEXTERN_MSG0(classPtr, "copied", copiedMess);
+  CPPEXTERN_MSG0(classPtr, "pbo_stats", pboStatsMess);
+  CPPEXTERN_MSG0(classPtr, "memory", memoryMess);
+  CPPEXTERN_MSG1(classPtr, "pool", poolMess, int);
+  CPPEXTERN_MSG0(classPtr, "pool_stats", poolStatsMess);
+  CPPEXTERN_MSG0(classPtr, "stats", statsMess);
+
   class_addcreator(reinterpret_cast<t_newmethod>(create_tex_gradient),
                    gensym("tex_gradient2"), A_GIMME, A_NULL);
 }
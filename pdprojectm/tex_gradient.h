@@ -20,6 +20,16 @@
 #include "Gem/Image.h"
 #include "Gem/State.h"
 
+#include <libprojectM/projectM.h>
+#include <string>
+#include <vector>
+
+#include "yuv-convert.h"
+#include "stage-timer.h"
+
+/* color stops of the procedural gradient */
+#define GRADIENT_MAX_STOPS 8
+
 /*-----------------------------------------------------------------
   -------------------------------------------------------------------
   CLASS
@@ -32,6 +42,14 @@
 
   DESCRIPTION
 
+  With a "preset" loaded, libprojectM renders straight into a texture
+  attached to a framebuffer object in Gem's context, and that texture
+  is passed downstream without any copy through the CPU.
+
+  With "gradient linear|radial|angular" a fragment shader renders a
+  color gradient into the same texture; parameter changes only update
+  uniforms, nothing is computed or uploaded by the CPU.
+
   -----------------------------------------------------------------*/
 class GEM_EXTERN tex_gradient : public GemBase
 {
@@ -95,14 +113,40 @@ public:
 
   void clientStorage(int mode);
   void yuvMess(int mode);
+  void yuvShaderMess(int on);
 
   void texunitMess(int unit);
 
   void extTextureMess(t_symbol*, int, t_atom*);
 
+  //////////
+  // projectM render-to-texture mode
+  void presetMess(t_symbol*preset);
+  void projectmMess(int on);
+  void dimenMess(int width, int height);
+
+  //////////
+  // procedural gradient, rendered by a shader into the same texture
+  void gradientMess(t_symbol*type);
+  void stopsMess(t_symbol*s, int argc, t_atom*argv);
+  void angleMess(t_float degrees);
+  void centerMess(t_float x, t_float y);
+  void phaseMess(t_float phase);
+  void spreadMess(t_symbol*spread);
+
+  //////////
+  // report CPU-side pixel copies through the info outlet
+  void copiedMess(void);
+  void pboStatsMess(void);
+  void memoryMess(void);
+  void poolMess(int size);
+  void poolStatsMess(void);
+  void statsMess(void);
+
 
 protected:
   t_outlet   *m_outTexID; /* outlet to pass on our texture */
+  t_outlet   *m_outInfo;  /* outlet for statistics */
 
   // USER requested data
 
@@ -167,13 +211,6 @@ protected:
 
   /* MISC */
 
-  //////////
-  // The size of the texture (so we can use sub image)
-  int           m_dataSize[3];
-
-  //////////
-  // The resizing buffer
-  imageStruct   m_buffer;
   //////////
   // a buffer for colour-space conversion
   imageStruct   m_imagebuf;
@@ -197,13 +234,124 @@ protected:
   GLfloat m_xRatio, m_yRatio; // x- and y-size if texture
 
   /* using PBOs for (hopefully) optimized pixel transfers */
-  // FIXXME; m_pbo must be allocated per-context (*not* in pboMess callback)
+  // the ring is (re)allocated per-context in render(), *not* in pboMess
+  bool setupPbo(size_t bytes);
+  void destroyPbo(void);
+  void uploadImage(imageStruct*src);
+
   gem::ContextData<GLuint> m_curPbo;
   gem::ContextData<GLuint> m_oldNumPbo;
   gem::ContextData<GLuint*>m_pbo;  // IDs of PBO
+  gem::ContextData<GLubyte**>m_pboMap;  // persistent mappings (or NULL)
+  gem::ContextData<GLsync*>m_pboFence;  // one fence per mapped slot
+  gem::ContextData<size_t> m_pboSize;   // bytes per PBO
+
+  /* exact-size (immutable where possible) texture storage */
+  bool needsStorage(int width, int height, GLenum internalformat);
+  void allocateTexture(int width, int height, GLenum internalformat);
+
+  void trimTexturePool(size_t size);
+  void destroyTexturePool(void);
+
+  // internalformat, size and levels of m_realTextureObj, -1 for none
+  gem::ContextData<int> m_texFormat, m_texWidth, m_texHeight;
+  gem::ContextData<GLsizei> m_texLevels;
+  size_t          m_texBytes, m_texSavedBytes;  // of the last allocation
+
+  /* textures of other sizes, kept alive for when the size changes back */
+  struct TexturePoolEntry {
+    GLuint texture;
+    int width, height;
+    GLenum internalformat;
+    GLsizei levels;
+    unsigned long lastUse;
+  };
+  typedef std::vector<TexturePoolEntry> TexturePool;
+  gem::ContextData<TexturePool*> m_texPool;  // allocated per-context in render()
+  size_t          m_poolSize;
+  unsigned long   m_poolClock;
+  unsigned long   m_poolHits, m_poolMisses;
+
+  /* YUV422 conversion: SIMD kernel on the threads of m_yuvPool, or a shader */
+  bool convertYuvOnGpu(imageStruct&image, GemState*state);
+  void destroyYuvShader(void);
+
+  yuv_convert_fn  m_yuvConvert;
+  yuv_convert_pool_t m_yuvPool;
+  bool            m_yuvShader;
+  gem::ContextData<GLuint> m_yuvProgram;
+  gem::ContextData<GLuint> m_yuvTexture;  // the packed image
+  gem::ContextData<int> m_yuvWidth, m_yuvHeight;  // its size, -1 for none
+  gem::ContextData<GLuint> m_yuvFbo;
+
+  /* procedural gradient */
+  void renderGradient(GemState*state);
+  void destroyGradient(void);
+
+  enum {
+    GRADIENT_OFF, GRADIENT_LINEAR, GRADIENT_RADIAL, GRADIENT_ANGULAR
+  }               m_gradientType;
+  int             m_gradientSpread; // 0 pad, 1 repeat, 2 reflect
+  float           m_gradientAngle;  // degrees, linear only
+  float           m_gradientCenter[2];
+  float           m_gradientPhase;
+  int             m_gradientStops;
+  float           m_gradientPositions[GRADIENT_MAX_STOPS];
+  float           m_gradientColors[4*GRADIENT_MAX_STOPS];
+  unsigned long   m_gradientGeneration; // bumped by every parameter change
+  gem::ContextData<GLuint> m_gradientProgram;
+  gem::ContextData<unsigned long> m_gradientDrawn;  // generation drawn here
+
+  /* upload statistics, in seconds */
+  unsigned long   m_pboUploads, m_pboStalls;
+  double          m_pboUploadTime, m_pboUploadMax, m_pboWaitTime;
+
+  /* CPU/GPU time of upload, projectM rendering and drawing per frame */
+  // the queries are per-context, so is the timer; allocated in render()
+  gem::ContextData<stage_timer_t*> m_stageTimer;
 
   /* upside down texture? */
   gem::ContextData<GLboolean> m_upsidedown;
+
+  /* render-to-texture: projectM or the gradient draw into m_fboTexture */
+  bool setupFbo(void);
+  void destroyFbo(void);
+  void sendFboTexture(GemState*state);
+  GLuint compileProgram(const char*fragment);
+  void drawQuad(void);
+
+  /* libprojectM rendering into m_fboTexture, no pixBlock needed */
+  // one instance per context: projectM's GL objects live in it
+  void renderProjectM(GemState*state);
+  bool setupProjectM(void);
+  void destroyProjectM(void);
+
+  bool            m_projectmOn;
+  std::string     m_preset;
+  unsigned long   m_presetGeneration;  // bumped by every [preset(
+  int             m_fboWidth, m_fboHeight;
+  unsigned long   m_fboGeneration;  // bumped by every [dimen(
+  gem::ContextData<unsigned long> m_fboBuilt;  // generation m_fbo has here
+  gem::ContextData<projectm_handle> m_projectm;
+  gem::ContextData<unsigned long> m_presetLoaded;  // generation loaded here
+  gem::ContextData<GLuint> m_fbo;
+  gem::ContextData<GLuint> m_fboTexture;
+
+  /* what we uploaded last, to skip images that did not change */
+  bool imageChanged(const imageStruct&image);
+  void countCopy(size_t bytes);
+
+  int             m_srcXsize, m_srcYsize, m_srcCsize;
+  GLenum          m_srcFormat, m_srcType;
+  unsigned char  *m_srcData;
+  unsigned long   m_imageGeneration;     // bumped for every new image
+  unsigned long   m_convertedGeneration; // image held in m_imagebuf
+
+  /* bytes copied by the CPU (colour-space conversion, PBO staging) */
+  double          m_copiedTotal;
+  double          m_copiedWindow;
+  double          m_copiedSince;
+  double          m_copiedRate;
 };
 
 #endif  // for header file
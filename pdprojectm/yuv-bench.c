@@ -0,0 +1,89 @@
+/** @file yuv-bench.c
+ *
+ * @brief Compare the YUV422 to RGBA converters at video frame sizes
+ *
+ * Prints the time per frame of every kernel the CPU supports, on one
+ * thread and row-parallel, for 720p, 1080p and 4K frames, and checks
+ * that each kernel produces the same output as the scalar one.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "yuv-convert.h"
+#include "../monotonic.h"
+
+#define BENCH_SECONDS 0.5
+
+int main(void)
+{
+    static const int sizes[][2] = { {1280, 720}, {1920, 1080}, {3840, 2160} };
+    yuv_convert_kernel_t kernels[3];
+    size_t nkernels = yuv_convert_kernels(kernels, 3);
+    int threads = yuv_convert_threads();
+    size_t max_pixels = 3840 * 2160;
+    uint8_t *src = malloc(max_pixels * 2);
+    uint8_t *expect = malloc(max_pixels * 4);
+    uint8_t *dst = malloc(max_pixels * 4);
+    size_t s, k, i;
+
+    if (!src || !expect || !dst) {
+        fprintf(stderr, "ERROR: out of memory\n");
+        exit(1);
+    }
+    /* every byte value turns up, including out of range Y and chroma */
+    srand(1);
+    for (i = 0; i < max_pixels * 2; i++) {
+        src[i] = rand() & 0xff;
+    }
+
+    printf("%10s %8s %8s %10s %10s\n", "size", "kernel", "threads", "ms/frame", "fps");
+    for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        int width = sizes[s][0], height = sizes[s][1];
+        size_t bytes = (size_t)width * height * 4;
+        char name[32];
+
+        snprintf(name, sizeof(name), "%dx%d", width, height);
+        yuv_convert_scalar(expect, src, (size_t)width * height / 2);
+
+        for (k = 0; k < nkernels; k++) {
+            int t;
+            for (t = 1; t <= threads; t = (t == threads) ? t + 1 : threads) {
+                yuv_convert_pool_t pool;
+                double start, elapsed;
+                long frames = 0;
+
+                if (yuv_convert_pool_init(&pool, t) < 0 || pool.threads != t) {
+                    fprintf(stderr, "ERROR: cannot start %d conversion threads\n", t);
+                    exit(1);
+                }
+                memset(dst, 0, bytes);
+                yuv_convert_image(&pool, kernels[k].fn, dst, src, width, height);
+                if (memcmp(dst, expect, bytes)) {
+                    fprintf(stderr, "ERROR: %s output differs from scalar\n",
+                            kernels[k].name);
+                    exit(1);
+                }
+
+                start = monotonic_now();
+                do {
+                    yuv_convert_image(&pool, kernels[k].fn, dst, src, width, height);
+                    /* keep the compiler from dropping the calls */
+                    __asm__ __volatile__("" : : "r"(dst) : "memory");
+                    frames++;
+                    elapsed = monotonic_now() - start;
+                } while (elapsed < BENCH_SECONDS);
+
+                printf("%10s %8s %8d %10.3f %10.1f\n", name, kernels[k].name, t,
+                       elapsed * 1e3 / frames, frames / elapsed);
+                yuv_convert_pool_free(&pool);
+            }
+        }
+    }
+
+    free(src);
+    free(expect);
+    free(dst);
+    return 0;
+}
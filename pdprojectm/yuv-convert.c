@@ -0,0 +1,343 @@
+/** @file yuv-convert.c
+ *
+ * @brief Convert Gem's packed YUV422 images to RGBA
+ *
+ * Fixed point BT.601 video range, the same coefficients Gem uses:
+ *
+ *   R = (298 (Y-16)              + 409 (V-128) + 128) >> 8
+ *   G = (298 (Y-16) - 100 (U-128) - 208 (V-128) + 128) >> 8
+ *   B = (298 (Y-16) + 516 (U-128)               + 128) >> 8
+ *
+ * The SIMD kernels compute exactly these sums in 32 bit lanes with
+ * pmaddwd, each lane holding (Y, chroma) as two 16 bit halves.
+ */
+
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "yuv-convert.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+# define HAVE_X86 1
+# include <immintrin.h>
+#endif
+
+/* slices smaller than this are not worth a thread */
+#define YUV_CONVERT_MIN_PAIRS (64 * 1024)
+
+static inline uint8_t clamp_u8(int v)
+{
+    return v < 0 ? 0 : v > 255 ? 255 : (uint8_t)v;
+}
+
+void yuv_convert_scalar(uint8_t *dst, const uint8_t *src, size_t pairs)
+{
+    size_t i;
+    for (i = 0; i < pairs; i++, src += 4, dst += 8) {
+        int u = src[0] - 128;
+        int y0 = 298 * (src[1] - 16);
+        int v = src[2] - 128;
+        int y1 = 298 * (src[3] - 16);
+        int r = 409 * v + 128;
+        int g = -100 * u - 208 * v + 128;
+        int b = 516 * u + 128;
+
+        dst[0] = clamp_u8((y0 + r) >> 8);
+        dst[1] = clamp_u8((y0 + g) >> 8);
+        dst[2] = clamp_u8((y0 + b) >> 8);
+        dst[3] = 255;
+        dst[4] = clamp_u8((y1 + r) >> 8);
+        dst[5] = clamp_u8((y1 + g) >> 8);
+        dst[6] = clamp_u8((y1 + b) >> 8);
+        dst[7] = 255;
+    }
+}
+
+#ifdef HAVE_X86
+/* 16 bit halves of a 32 bit lane for pmaddwd: lo * a + hi * b */
+#define COEF(a, b) ((int)(((uint32_t)(b) << 16) | ((uint32_t)(a) & 0xffff)))
+
+__attribute__((target("sse2")))
+static void yuv_convert_sse2(uint8_t *dst, const uint8_t *src, size_t pairs)
+{
+    const __m128i byte = _mm_set1_epi32(0xff);
+    const __m128i low = _mm_set1_epi32(0xffff);
+    const __m128i c16 = _mm_set1_epi32(16);
+    const __m128i c128 = _mm_set1_epi32(128);
+    const __m128i one_hi = _mm_set1_epi32(1 << 16);
+    const __m128i coef_r = _mm_set1_epi32(COEF(298, 409));
+    const __m128i coef_g = _mm_set1_epi32(COEF(298, -100));
+    const __m128i coef_gv = _mm_set1_epi32(COEF(-208, 128));
+    const __m128i coef_b = _mm_set1_epi32(COEF(298, 516));
+    const __m128i alpha = _mm_set1_epi16(255);
+    size_t i;
+
+    for (i = 0; i + 4 <= pairs; i += 4) {
+        /* one lane per pair: U Y0 V Y1 */
+        __m128i x = _mm_loadu_si128((const __m128i *)(src + 4*i));
+        __m128i u = _mm_sub_epi32(_mm_and_si128(x, byte), c128);
+        __m128i y0 = _mm_sub_epi32(_mm_and_si128(_mm_srli_epi32(x, 8), byte), c16);
+        __m128i v = _mm_sub_epi32(_mm_and_si128(_mm_srli_epi32(x, 16), byte), c128);
+        __m128i y1 = _mm_sub_epi32(_mm_srli_epi32(x, 24), c16);
+        __m128i uhi = _mm_slli_epi32(u, 16);
+        __m128i vhi = _mm_slli_epi32(v, 16);
+        /* -208 V + 128, shared by both pixels of a pair */
+        __m128i gv = _mm_madd_epi16(_mm_or_si128(_mm_and_si128(v, low), one_hi), coef_gv);
+        __m128i r0, g0, b0, r1, g1, b1, rw, gw, bw, rb, ga, rg, ba;
+
+        y0 = _mm_and_si128(y0, low);
+        y1 = _mm_and_si128(y1, low);
+        r0 = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(_mm_or_si128(y0, vhi), coef_r), c128), 8);
+        g0 = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(_mm_or_si128(y0, uhi), coef_g), gv), 8);
+        b0 = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(_mm_or_si128(y0, uhi), coef_b), c128), 8);
+        r1 = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(_mm_or_si128(y1, vhi), coef_r), c128), 8);
+        g1 = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(_mm_or_si128(y1, uhi), coef_g), gv), 8);
+        b1 = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(_mm_or_si128(y1, uhi), coef_b), c128), 8);
+
+        /* even and odd pixels back in order, then saturate to bytes */
+        rw = _mm_packs_epi32(_mm_unpacklo_epi32(r0, r1), _mm_unpackhi_epi32(r0, r1));
+        gw = _mm_packs_epi32(_mm_unpacklo_epi32(g0, g1), _mm_unpackhi_epi32(g0, g1));
+        bw = _mm_packs_epi32(_mm_unpacklo_epi32(b0, b1), _mm_unpackhi_epi32(b0, b1));
+        rb = _mm_packus_epi16(rw, bw);
+        ga = _mm_packus_epi16(gw, alpha);
+        rg = _mm_unpacklo_epi8(rb, ga);
+        ba = _mm_unpackhi_epi8(rb, ga);
+        _mm_storeu_si128((__m128i *)(dst + 8*i + 0), _mm_unpacklo_epi16(rg, ba));
+        _mm_storeu_si128((__m128i *)(dst + 8*i + 16), _mm_unpackhi_epi16(rg, ba));
+    }
+    yuv_convert_scalar(dst + 8*i, src + 4*i, pairs - i);
+}
+
+__attribute__((target("avx2")))
+static void yuv_convert_avx2(uint8_t *dst, const uint8_t *src, size_t pairs)
+{
+    const __m256i byte = _mm256_set1_epi32(0xff);
+    const __m256i low = _mm256_set1_epi32(0xffff);
+    const __m256i c16 = _mm256_set1_epi32(16);
+    const __m256i c128 = _mm256_set1_epi32(128);
+    const __m256i one_hi = _mm256_set1_epi32(1 << 16);
+    const __m256i coef_r = _mm256_set1_epi32(COEF(298, 409));
+    const __m256i coef_g = _mm256_set1_epi32(COEF(298, -100));
+    const __m256i coef_gv = _mm256_set1_epi32(COEF(-208, 128));
+    const __m256i coef_b = _mm256_set1_epi32(COEF(298, 516));
+    const __m256i alpha = _mm256_set1_epi16(255);
+    size_t i;
+
+    /* same as sse2, every instruction works per 128 bit lane */
+    for (i = 0; i + 8 <= pairs; i += 8) {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(src + 4*i));
+        __m256i u = _mm256_sub_epi32(_mm256_and_si256(x, byte), c128);
+        __m256i y0 = _mm256_sub_epi32(_mm256_and_si256(_mm256_srli_epi32(x, 8), byte), c16);
+        __m256i v = _mm256_sub_epi32(_mm256_and_si256(_mm256_srli_epi32(x, 16), byte), c128);
+        __m256i y1 = _mm256_sub_epi32(_mm256_srli_epi32(x, 24), c16);
+        __m256i uhi = _mm256_slli_epi32(u, 16);
+        __m256i vhi = _mm256_slli_epi32(v, 16);
+        __m256i gv = _mm256_madd_epi16(_mm256_or_si256(_mm256_and_si256(v, low), one_hi), coef_gv);
+        __m256i r0, g0, b0, r1, g1, b1, rw, gw, bw, rb, ga, rg, ba, lo, hi;
+
+        y0 = _mm256_and_si256(y0, low);
+        y1 = _mm256_and_si256(y1, low);
+        r0 = _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(_mm256_or_si256(y0, vhi), coef_r), c128), 8);
+        g0 = _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(_mm256_or_si256(y0, uhi), coef_g), gv), 8);
+        b0 = _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(_mm256_or_si256(y0, uhi), coef_b), c128), 8);
+        r1 = _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(_mm256_or_si256(y1, vhi), coef_r), c128), 8);
+        g1 = _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(_mm256_or_si256(y1, uhi), coef_g), gv), 8);
+        b1 = _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(_mm256_or_si256(y1, uhi), coef_b), c128), 8);
+
+        rw = _mm256_packs_epi32(_mm256_unpacklo_epi32(r0, r1), _mm256_unpackhi_epi32(r0, r1));
+        gw = _mm256_packs_epi32(_mm256_unpacklo_epi32(g0, g1), _mm256_unpackhi_epi32(g0, g1));
+        bw = _mm256_packs_epi32(_mm256_unpacklo_epi32(b0, b1), _mm256_unpackhi_epi32(b0, b1));
+        rb = _mm256_packus_epi16(rw, bw);
+        ga = _mm256_packus_epi16(gw, alpha);
+        rg = _mm256_unpacklo_epi8(rb, ga);
+        ba = _mm256_unpackhi_epi8(rb, ga);
+        /* lo = pixels 0-3 | 8-11, hi = 4-7 | 12-15 */
+        lo = _mm256_unpacklo_epi16(rg, ba);
+        hi = _mm256_unpackhi_epi16(rg, ba);
+        _mm256_storeu_si256((__m256i *)(dst + 8*i + 0), _mm256_permute2x128_si256(lo, hi, 0x20));
+        _mm256_storeu_si256((__m256i *)(dst + 8*i + 32), _mm256_permute2x128_si256(lo, hi, 0x31));
+    }
+    yuv_convert_sse2(dst + 8*i, src + 4*i, pairs - i);
+}
+#endif
+
+size_t yuv_convert_kernels(yuv_convert_kernel_t *kernels, size_t max)
+{
+    size_t n = 0;
+
+    if (n < max) {
+        kernels[n].name = "scalar";
+        kernels[n++].fn = yuv_convert_scalar;
+    }
+#ifdef HAVE_X86
+    __builtin_cpu_init();
+    if (n < max && __builtin_cpu_supports("sse2")) {
+        kernels[n].name = "sse2";
+        kernels[n++].fn = yuv_convert_sse2;
+    }
+    if (n < max && __builtin_cpu_supports("avx2")) {
+        kernels[n].name = "avx2";
+        kernels[n++].fn = yuv_convert_avx2;
+    }
+#endif
+    return n;
+}
+
+yuv_convert_kernel_t yuv_convert_select(void)
+{
+    yuv_convert_kernel_t kernels[3];
+    size_t n = yuv_convert_kernels(kernels, 3);
+    return kernels[n - 1];
+}
+
+int yuv_convert_threads(void)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus < 1) {
+        return 1;
+    }
+    /* beyond a handful of threads the conversion is memory bound */
+    return cpus > 8 ? 8 : (int)cpus;
+}
+
+static void convert_slice(const yuv_slice_t *slice)
+{
+    slice->fn(slice->dst, slice->src, slice->pairs);
+}
+
+typedef struct yuv_worker {
+    yuv_convert_pool_t *pool;
+    int index;
+} yuv_worker_t;
+
+static void *worker_thread(void *arg)
+{
+    yuv_convert_pool_t *pool = ((yuv_worker_t *)arg)->pool;
+    int index = ((yuv_worker_t *)arg)->index;
+    unsigned long seen = 0;
+
+    free(arg);
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (!pool->stopping && pool->frame == seen) {
+            pthread_cond_wait(&pool->wake, &pool->lock);
+        }
+        if (pool->stopping) {
+            break;
+        }
+        seen = pool->frame;
+        if (index >= pool->slices) {
+            continue;
+        }
+        pthread_mutex_unlock(&pool->lock);
+        convert_slice(&pool->slice[index]);
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->pending == 0) {
+            pthread_cond_signal(&pool->done);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+int yuv_convert_pool_init(yuv_convert_pool_t *pool, int threads)
+{
+    int i;
+
+    if (threads > YUV_CONVERT_MAX_THREADS) {
+        threads = YUV_CONVERT_MAX_THREADS;
+    }
+    pool->threads = 0;
+    pool->slices = 0;
+    pool->pending = 0;
+    pool->frame = 0;
+    pool->stopping = 0;
+    if (pthread_mutex_init(&pool->lock, NULL)) {
+        return -1;
+    }
+    if (pthread_cond_init(&pool->wake, NULL)) {
+        pthread_mutex_destroy(&pool->lock);
+        return -1;
+    }
+    if (pthread_cond_init(&pool->done, NULL)) {
+        pthread_cond_destroy(&pool->wake);
+        pthread_mutex_destroy(&pool->lock);
+        return -1;
+    }
+    pool->threads = 1;
+    /* slice 0 is the caller's, worker i converts slice i */
+    for (i = 1; i < threads; i++) {
+        yuv_worker_t *worker = malloc(sizeof(*worker));
+        if (worker == NULL) {
+            break;
+        }
+        worker->pool = pool;
+        worker->index = i;
+        if (pthread_create(&pool->worker[i], NULL, worker_thread, worker)) {
+            free(worker);
+            break;
+        }
+        pool->threads++;
+    }
+    return 0;
+}
+
+void yuv_convert_pool_free(yuv_convert_pool_t *pool)
+{
+    int i;
+
+    if (pool->threads == 0) {
+        return;
+    }
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = 1;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+    for (i = 1; i < pool->threads; i++) {
+        pthread_join(pool->worker[i], NULL);
+    }
+    pthread_cond_destroy(&pool->done);
+    pthread_cond_destroy(&pool->wake);
+    pthread_mutex_destroy(&pool->lock);
+    pool->threads = 0;
+}
+
+void yuv_convert_image(yuv_convert_pool_t *pool, yuv_convert_fn fn, uint8_t *dst,
+                       const uint8_t *src, int width, int height)
+{
+    size_t pairs = (size_t)width * height / 2;
+    int threads = pool->threads;
+    int i;
+
+    if ((size_t)threads > pairs / YUV_CONVERT_MIN_PAIRS) {
+        threads = (int)(pairs / YUV_CONVERT_MIN_PAIRS);
+    }
+    if (threads <= 1) {
+        fn(dst, src, pairs);
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    for (i = 0; i < threads; i++) {
+        size_t begin = pairs * i / threads;
+        size_t end = pairs * (i + 1) / threads;
+        pool->slice[i].fn = fn;
+        pool->slice[i].dst = dst + 8 * begin;
+        pool->slice[i].src = src + 4 * begin;
+        pool->slice[i].pairs = end - begin;
+    }
+    pool->slices = threads;
+    pool->pending = threads - 1;
+    pool->frame++;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+
+    convert_slice(&pool->slice[0]);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->pending > 0) {
+        pthread_cond_wait(&pool->done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
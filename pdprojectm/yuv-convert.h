@@ -0,0 +1,96 @@
+/** @file yuv-convert.h
+ *
+ * @brief Convert Gem's packed YUV422 images to RGBA
+ *
+ * Gem stores GEM_YUV images as U Y0 V Y1, two pixels in four bytes.
+ * On platforms without GL_APPLE_ycbcr_422 (all of Linux) they have to
+ * be converted before they can be uploaded.  The kernels below do the
+ * BT.601 video range conversion with SSE2, AVX2 or plain C, and
+ * yuv_convert_image() splits a frame into slices for a pool of threads
+ * started once, so the render path never creates a thread.
+ *
+ * All kernels produce bit identical output.
+ */
+
+#ifndef YUV_CONVERT_H
+#define YUV_CONVERT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** convert pairs * 2 pixels, src holds 4 bytes and dst 8 bytes per pair */
+typedef void (*yuv_convert_fn)(uint8_t *dst, const uint8_t *src, size_t pairs);
+
+#define YUV_CONVERT_MAX_THREADS 16
+
+typedef struct yuv_slice {
+    yuv_convert_fn fn;
+    uint8_t *dst;
+    const uint8_t *src;
+    size_t pairs;
+} yuv_slice_t;
+
+typedef struct yuv_convert_pool {
+    pthread_mutex_t lock;
+    pthread_cond_t wake;        /* a new frame, or stopping */
+    pthread_cond_t done;        /* the last slice of a frame finished */
+    pthread_t worker[YUV_CONVERT_MAX_THREADS];
+    int threads;                /* including the calling thread, 0 if unusable */
+    yuv_slice_t slice[YUV_CONVERT_MAX_THREADS];
+    int slices;                 /* of the current frame */
+    int pending;                /* slices of the current frame not done */
+    unsigned long frame;
+    int stopping;
+} yuv_convert_pool_t;
+
+typedef struct yuv_convert_kernel {
+    const char *name;
+    yuv_convert_fn fn;
+} yuv_convert_kernel_t;
+
+void yuv_convert_scalar(uint8_t *dst, const uint8_t *src, size_t pairs);
+
+/**
+ * The fastest kernel the running CPU supports.  Call this once and
+ * keep the result, it queries the CPU features.
+ */
+yuv_convert_kernel_t yuv_convert_select(void);
+
+/**
+ * All kernels compiled in and supported by the running CPU, scalar
+ * first.  Used by the benchmark.  Returns the number of entries.
+ */
+size_t yuv_convert_kernels(yuv_convert_kernel_t *kernels, size_t max);
+
+/** A sensible thread count for this machine, at least 1. */
+int yuv_convert_threads(void);
+
+/**
+ * Start threads - 1 workers that wait for yuv_convert_image(); the
+ * calling thread makes up the last one.  If some cannot be started the
+ * pool runs with fewer.  Returns 0 on success, -1 if the pool cannot
+ * be set up at all; it then converts on the calling thread only.
+ */
+int yuv_convert_pool_init(yuv_convert_pool_t *pool, int threads);
+
+/** Stop and join the workers. */
+void yuv_convert_pool_free(yuv_convert_pool_t *pool);
+
+/**
+ * Convert a whole width x height image (rows without padding) on the
+ * calling thread and the workers of pool.  Small images are converted
+ * on the calling thread only.  One caller at a time per pool.
+ */
+void yuv_convert_image(yuv_convert_pool_t *pool, yuv_convert_fn fn, uint8_t *dst,
+                       const uint8_t *src, int width, int height);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* YUV_CONVERT_H */
@@ -0,0 +1,180 @@
+/** @file preset-cache-bench.c
+ *
+ * @brief Startup time of the preset cache for a 10000 preset directory
+ *
+ * Without an argument, writes 10000 generated presets of 2 to 20 kB
+ * into a temporary directory (removed afterwards), otherwise uses the
+ * given directory and deletes its index file first.  Prints how long
+ * preset_cache_open() takes without an index, with an unchanged index
+ * and after 1% of the presets were touched, and what a preset switch
+ * costs with and without prefetch.
+ *
+ * The files were just written, so they are in the page cache: the
+ * "no index" case shows the cost of reading and hashing, not of disk
+ * seeks, which make it slower still.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include "preset-cache.h"
+#include "monotonic.h"
+
+#define PRESETS 10000
+#define SWITCHES 2000
+
+static void make_presets(const char *root)
+{
+    char path[PATH_MAX];
+    int i, j, lines;
+
+    srand(1);
+    for (i = 0; i < PRESETS; i++) {
+        FILE *f;
+        /* a hundred presets per directory, like packs in a library */
+        snprintf(path, sizeof(path), "%s/pack%03d", root, i / 100);
+        mkdir(path, 0755);
+        snprintf(path, sizeof(path), "%s/pack%03d/preset %05d.milk", root, i / 100, i);
+        if ((f = fopen(path, "w")) == NULL) {
+            perror(path);
+            exit(1);
+        }
+        fprintf(f, "[preset00]\nfRating=3.000000\nfGammaAdj=2.000000\n");
+        lines = 100 + rand() % 900;
+        for (j = 0; j < lines; j++) {
+            fprintf(f, "per_frame_%d=wave_r = 0.5 + 0.5*sin(time*%d.%03d);\n",
+                    j, rand() % 10, rand() % 1000);
+        }
+        fclose(f);
+    }
+}
+
+static void remove_presets(const char *root)
+{
+    char path[PATH_MAX];
+    int i;
+
+    for (i = 0; i < PRESETS; i++) {
+        snprintf(path, sizeof(path), "%s/pack%03d/preset %05d.milk", root, i / 100, i);
+        unlink(path);
+    }
+    for (i = 0; i < PRESETS / 100; i++) {
+        snprintf(path, sizeof(path), "%s/pack%03d", root, i);
+        rmdir(path);
+    }
+    snprintf(path, sizeof(path), "%s/%s", root, PRESET_CACHE_INDEX_NAME);
+    unlink(path);
+    rmdir(root);
+}
+
+static void report(const char *name, preset_cache_t *cache)
+{
+    preset_cache_stats_t stats;
+
+    preset_cache_stats(cache, &stats);
+    printf("%-26s %8.1f ms %8u presets %8u read\n", name,
+           stats.open_seconds * 1e3, stats.presets, stats.hashed);
+}
+
+/* mean microseconds per switch through the directory in order */
+static double switches(preset_cache_t *cache, int prefetch)
+{
+    volatile char sink = 0;
+    size_t length;
+    double start, elapsed = 0;
+    int i, index;
+
+    for (i = 0; i < SWITCHES; i++) {
+        const char *text;
+        index = (i * 7) % (int)preset_cache_count(cache);
+        if (prefetch) {
+            index = i % (int)preset_cache_count(cache);
+        }
+        start = monotonic_now();
+        if ((text = preset_cache_acquire(cache, index, &length)) == NULL) {
+            fprintf(stderr, "ERROR: cannot read preset %d\n", index);
+            exit(1);
+        }
+        sink ^= text[length / 2];
+        preset_cache_release(cache, index);
+        elapsed += monotonic_now() - start;
+        if (prefetch) {
+            /* off the clock: the loader thread does this after a switch */
+            preset_cache_prefetch(cache, index, 4);
+        }
+    }
+    (void)sink;
+    return elapsed * 1e6 / SWITCHES;
+}
+
+int main(int argc, char *argv[])
+{
+    char root[] = "/tmp/preset-cache-bench.XXXXXX";
+    char path[PATH_MAX];
+    const char *directory = argc > 1 ? argv[1] : root;
+    preset_cache_t cache;
+    preset_cache_stats_t stats;
+    struct timeval times[2];
+    double start;
+    int i;
+
+    if (argc <= 1) {
+        if (mkdtemp(root) == NULL) {
+            perror(root);
+            exit(1);
+        }
+        start = monotonic_now();
+        make_presets(root);
+        printf("generated %d presets in %.1f s\n", PRESETS, monotonic_now() - start);
+    } else {
+        snprintf(path, sizeof(path), "%s/%s", directory, PRESET_CACHE_INDEX_NAME);
+        unlink(path);
+    }
+
+    if (preset_cache_open(&cache, directory)) {
+        exit(1);
+    }
+    report("no index", &cache);
+    preset_cache_close(&cache);
+
+    if (preset_cache_open(&cache, directory)) {
+        exit(1);
+    }
+    report("unchanged index (mapped)", &cache);
+    preset_cache_close(&cache);
+
+    if (argc <= 1) {
+        /* bump the mtime of every 100th preset */
+        gettimeofday(&times[0], NULL);
+        times[1] = times[0];
+        times[1].tv_sec += 10;
+        for (i = 0; i < PRESETS; i += 100) {
+            snprintf(path, sizeof(path), "%s/pack%03d/preset %05d.milk", root, i / 100, i);
+            utimes(path, times);
+        }
+        if (preset_cache_open(&cache, directory)) {
+            exit(1);
+        }
+        report("1% of presets touched", &cache);
+        preset_cache_close(&cache);
+    }
+
+    if (preset_cache_open(&cache, directory) || preset_cache_count(&cache) == 0) {
+        exit(1);
+    }
+    printf("switch, not prefetched    %8.1f us\n", switches(&cache, 0));
+    printf("switch, prefetched        %8.1f us\n", switches(&cache, 1));
+    preset_cache_stats(&cache, &stats);
+    printf("cache: %lu hits, %lu misses\n", stats.hits, stats.misses);
+    preset_cache_close(&cache);
+
+    if (argc <= 1) {
+        remove_presets(root);
+    }
+    return 0;
+}
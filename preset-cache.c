@@ -0,0 +1,553 @@
+/** @file preset-cache.c
+ *
+ * @brief Index of a preset directory and memory-mapped preset texts
+ *
+ * Index file layout, native byte order:
+ *   header  "PMINDEX1", uint32 count, uint32 string table size
+ *   count * preset_index_entry_t, sorted by path
+ *   string table, each path NUL terminated
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <limits.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "preset-cache.h"
+#include "monotonic.h"
+
+#define INDEX_MAGIC "PMINDEX1"
+
+typedef struct index_header {
+    char magic[8];
+    uint32_t count;
+    uint32_t strings_size;
+} index_header_t;
+
+/* relative paths found while scanning */
+typedef struct path_list {
+    char **path;
+    size_t count;
+    size_t capacity;
+} path_list_t;
+
+static int has_suffix(const char *name, const char *suffix)
+{
+    size_t n = strlen(name), s = strlen(suffix);
+    return n > s && strcasecmp(name + n - s, suffix) == 0;
+}
+
+static int path_add(path_list_t *list, const char *path)
+{
+    if (list->count == list->capacity) {
+        size_t capacity = list->capacity ? 2 * list->capacity : 1024;
+        char **p = realloc(list->path, capacity * sizeof(char *));
+        if (p == NULL) {
+            return -1;
+        }
+        list->path = p;
+        list->capacity = capacity;
+    }
+    if ((list->path[list->count] = strdup(path)) == NULL) {
+        return -1;
+    }
+    list->count++;
+    return 0;
+}
+
+/* collect the .milk files below root/relative, skipping hidden entries */
+static int scan(const char *root, const char *relative, path_list_t *list)
+{
+    char full[PATH_MAX], child[PATH_MAX];
+    struct dirent *d;
+    struct stat st;
+    DIR *dir;
+    int failed = 0;
+
+    snprintf(full, sizeof(full), "%s/%s", root, relative);
+    if ((dir = opendir(full)) == NULL) {
+        fprintf(stderr, "ERROR: cannot open preset directory %s: %s\n", full, strerror(errno));
+        return -1;
+    }
+    while (!failed && (d = readdir(dir)) != NULL) {
+        int is_dir, is_file;
+        if (d->d_name[0] == '.') {
+            continue;
+        }
+        if ((size_t)snprintf(child, sizeof(child), "%s%s%s", relative,
+                             relative[0] ? "/" : "", d->d_name) >= sizeof(child)) {
+            continue;
+        }
+        is_dir = d->d_type == DT_DIR;
+        is_file = d->d_type == DT_REG;
+        if (d->d_type == DT_UNKNOWN || d->d_type == DT_LNK) {
+            if ((size_t)snprintf(full, sizeof(full), "%s/%s", root, child) >= sizeof(full)
+                || stat(full, &st)) {
+                continue;
+            }
+            is_dir = S_ISDIR(st.st_mode);
+            is_file = S_ISREG(st.st_mode);
+        }
+        if (is_dir) {
+            failed = scan(root, child, list);
+        } else if (is_file && has_suffix(d->d_name, ".milk")) {
+            failed = path_add(list, child);
+        }
+    }
+    closedir(dir);
+    return failed;
+}
+
+static int compare_paths(const void *a, const void *b)
+{
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/* FNV-1a over the contents of fd */
+static int hash_file(int fd, uint64_t *hash)
+{
+    unsigned char buffer[64 * 1024];
+    uint64_t h = 0xcbf29ce484222325ULL;
+    ssize_t n, i;
+
+    while ((n = read(fd, buffer, sizeof(buffer))) > 0) {
+        for (i = 0; i < n; i++) {
+            h = (h ^ buffer[i]) * 0x100000001b3ULL;
+        }
+    }
+    *hash = h;
+    return n < 0 ? -1 : 0;
+}
+
+/* map an existing index file, 0 if it is missing or not valid */
+static int load_index(const char *file, void **data, size_t *size)
+{
+    const index_header_t *header;
+    const preset_index_entry_t *entry;
+    const char *strings;
+    struct stat st;
+    uint32_t i;
+    void *map;
+    int fd = open(file, O_RDONLY);
+
+    if (fd < 0) {
+        return 0;
+    }
+    if (fstat(fd, &st) || (size_t)st.st_size < sizeof(index_header_t)) {
+        close(fd);
+        return 0;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return 0;
+    }
+    header = map;
+    if (memcmp(header->magic, INDEX_MAGIC, 8) ||
+        sizeof(index_header_t) + (size_t)header->count * sizeof(preset_index_entry_t)
+        + header->strings_size != (size_t)st.st_size) {
+        fprintf(stderr, "WARNING: ignoring invalid preset index %s\n", file);
+        munmap(map, st.st_size);
+        return 0;
+    }
+    entry = (const preset_index_entry_t *)(header + 1);
+    strings = (const char *)(entry + header->count);
+    for (i = 0; i < header->count; i++) {
+        if ((uint64_t)entry[i].path + entry[i].path_length >= header->strings_size ||
+            strings[entry[i].path + entry[i].path_length] != '\0') {
+            fprintf(stderr, "WARNING: ignoring invalid preset index %s\n", file);
+            munmap(map, st.st_size);
+            return 0;
+        }
+    }
+    *data = map;
+    *size = st.st_size;
+    return 1;
+}
+
+/* a file of its own for every writer, so instances indexing the same
+ * directory never write into each other's index */
+static int write_index(const char *file, const void *data, size_t size)
+{
+    char tmp[PATH_MAX];
+    int fd, failed;
+
+    if ((size_t)snprintf(tmp, sizeof(tmp), "%s.XXXXXX", file) >= sizeof(tmp)) {
+        return -1;
+    }
+    if ((fd = mkstemp(tmp)) < 0) {
+        return -1;
+    }
+    failed = fchmod(fd, 0644) || write(fd, data, size) != (ssize_t)size;
+    if (close(fd) || failed || rename(tmp, file)) {
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+int preset_cache_open(preset_cache_t *cache, const char *directory)
+{
+    char root[PATH_MAX], file[PATH_MAX], index_file[PATH_MAX];
+    const preset_index_entry_t *old_entry = NULL;
+    const char *old_strings = NULL;
+    uint32_t old_count = 0, o = 0;
+    void *old_data = NULL;
+    size_t old_size = 0, strings_size = 0, i;
+    path_list_t list = { NULL, 0, 0 };
+    preset_index_entry_t *entry;
+    index_header_t *header;
+    char *strings;
+    double start = monotonic_now();
+    int unchanged;
+
+    memset(cache, 0, sizeof(*cache));
+    for (i = 0; i < PRESET_CACHE_READY; i++) {
+        cache->ready[i].index = -1;
+    }
+    if (realpath(directory, root) == NULL) {
+        fprintf(stderr, "ERROR: cannot open preset directory %s: %s\n", directory, strerror(errno));
+        return -1;
+    }
+    if (scan(root, "", &list)) {
+        goto fail;
+    }
+    qsort(list.path, list.count, sizeof(char *), compare_paths);
+    if (list.count > UINT32_MAX / sizeof(preset_index_entry_t)) {
+        goto fail;
+    }
+    for (i = 0; i < list.count; i++) {
+        strings_size += strlen(list.path[i]) + 1;
+    }
+
+    if ((size_t)snprintf(index_file, sizeof(index_file), "%s/%s", root,
+                         PRESET_CACHE_INDEX_NAME) >= sizeof(index_file)) {
+        goto fail;
+    }
+    if (load_index(index_file, &old_data, &old_size)) {
+        old_count = ((index_header_t *)old_data)->count;
+        old_entry = (const preset_index_entry_t *)((char *)old_data + sizeof(index_header_t));
+        old_strings = (const char *)(old_entry + old_count);
+        cache->stats.index_loaded = 1;
+    }
+
+    cache->index_size = sizeof(index_header_t) + list.count * sizeof(preset_index_entry_t) + strings_size;
+    if ((cache->index_data = malloc(cache->index_size)) == NULL) {
+        goto fail;
+    }
+    header = cache->index_data;
+    memcpy(header->magic, INDEX_MAGIC, 8);
+    header->count = list.count;
+    header->strings_size = strings_size;
+    entry = (preset_index_entry_t *)(header + 1);
+    strings = (char *)(entry + list.count);
+    strings_size = 0;
+    unchanged = old_data != NULL && old_count == list.count;
+
+    for (i = 0; i < list.count; i++) {
+        struct stat st;
+        size_t length = strlen(list.path[i]);
+        int cmp = 1;
+
+        entry[i].path = strings_size;
+        entry[i].path_length = length;
+        memcpy(strings + strings_size, list.path[i], length + 1);
+        strings_size += length + 1;
+
+        if ((size_t)snprintf(file, sizeof(file), "%s/%s", root, list.path[i]) >= sizeof(file)
+            || stat(file, &st)) {
+            memset(&entry[i], 0, offsetof(preset_index_entry_t, path));
+            unchanged = 0;
+            continue;
+        }
+        entry[i].size = st.st_size;
+        entry[i].mtime_ns = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+
+        /* both lists are sorted, walk the old one along */
+        while (o < old_count &&
+               (cmp = strcmp(old_strings + old_entry[o].path, list.path[i])) < 0) {
+            o++;
+        }
+        if (cmp == 0 && old_entry[o].size == entry[i].size &&
+            old_entry[o].mtime_ns == entry[i].mtime_ns) {
+            entry[i].hash = old_entry[o].hash;
+        } else {
+            int fd = open(file, O_RDONLY);
+            if (fd < 0 || hash_file(fd, &entry[i].hash)) {
+                entry[i].hash = 0;
+            }
+            if (fd >= 0) {
+                close(fd);
+            }
+            cache->stats.hashed++;
+            unchanged = 0;
+        }
+    }
+
+    if (unchanged && old_size == cache->index_size &&
+        memcmp(old_data, cache->index_data, old_size) == 0) {
+        /* nothing changed, keep using the mapped file */
+        free(cache->index_data);
+        cache->index_data = old_data;
+        cache->index_mapped = 1;
+        old_data = NULL;
+    } else if (write_index(index_file, cache->index_data, cache->index_size) == 0) {
+        cache->stats.index_written = 1;
+    }
+    if (old_data != NULL) {
+        munmap(old_data, old_size);
+    }
+    for (i = 0; i < list.count; i++) {
+        free(list.path[i]);
+    }
+    free(list.path);
+
+    header = cache->index_data;
+    cache->entry = (const preset_index_entry_t *)(header + 1);
+    cache->strings = (const char *)(cache->entry + header->count);
+    cache->count = header->count;
+    cache->directory = strdup(root);
+    cache->directory_length = strlen(root);
+    pthread_mutex_init(&cache->lock, NULL);
+    cache->stats.presets = cache->count;
+    cache->stats.open_seconds = monotonic_now() - start;
+    return 0;
+
+fail:
+    for (i = 0; i < list.count; i++) {
+        free(list.path[i]);
+    }
+    free(list.path);
+    free(cache->index_data);
+    if (old_data != NULL) {
+        munmap(old_data, old_size);
+    }
+    memset(cache, 0, sizeof(*cache));
+    return -1;
+}
+
+static void unmap_text(preset_text_t *t)
+{
+    if (t->map_length) {
+        munmap(t->text, t->map_length);
+    } else {
+        free(t->text);
+    }
+    t->text = NULL;
+    t->index = -1;
+    t->refs = 0;
+}
+
+void preset_cache_close(preset_cache_t *cache)
+{
+    int i;
+
+    if (cache->directory == NULL) {
+        return;
+    }
+    for (i = 0; i < PRESET_CACHE_READY; i++) {
+        if (cache->ready[i].index >= 0) {
+            unmap_text(&cache->ready[i]);
+        }
+    }
+    if (cache->index_mapped) {
+        munmap(cache->index_data, cache->index_size);
+    } else {
+        free(cache->index_data);
+    }
+    free(cache->directory);
+    pthread_mutex_destroy(&cache->lock);
+    memset(cache, 0, sizeof(*cache));
+}
+
+uint32_t preset_cache_count(const preset_cache_t *cache)
+{
+    return cache->count;
+}
+
+int preset_cache_find(const preset_cache_t *cache, const char *path)
+{
+    int low = 0, high = (int)cache->count - 1;
+
+    if (cache->directory == NULL) {
+        return -1;
+    }
+    if (path[0] == '/') {
+        if (strncmp(path, cache->directory, cache->directory_length) ||
+            path[cache->directory_length] != '/') {
+            return -1;
+        }
+        path += cache->directory_length + 1;
+    }
+    while (low <= high) {
+        int mid = (low + high) / 2;
+        int cmp = strcmp(cache->strings + cache->entry[mid].path, path);
+        if (cmp == 0) {
+            return mid;
+        }
+        if (cmp < 0) {
+            low = mid + 1;
+        } else {
+            high = mid - 1;
+        }
+    }
+    return -1;
+}
+
+int preset_cache_path(const preset_cache_t *cache, int index, char *buffer, size_t size)
+{
+    if (index < 0 || (uint32_t)index >= cache->count ||
+        (size_t)snprintf(buffer, size, "%s/%s", cache->directory,
+                         cache->strings + cache->entry[index].path) >= size) {
+        return -1;
+    }
+    return 0;
+}
+
+/* make the text of index resident in a slot, with the lock held */
+static preset_text_t *map_text(preset_cache_t *cache, int index, int *hit)
+{
+    preset_text_t *t = NULL;
+    char file[PATH_MAX];
+    struct stat st;
+    long page = sysconf(_SC_PAGESIZE);
+    int i, fd;
+
+    for (i = 0; i < PRESET_CACHE_READY; i++) {
+        if (cache->ready[i].index == index) {
+            *hit = 1;
+            return &cache->ready[i];
+        }
+    }
+    /* a free slot, or the least recently used one nobody holds */
+    for (i = 0; i < PRESET_CACHE_READY; i++) {
+        preset_text_t *s = &cache->ready[i];
+        if (s->index < 0) {
+            t = s;
+            break;
+        }
+        if (s->refs == 0 && (t == NULL || s->last_use < t->last_use)) {
+            t = s;
+        }
+    }
+    if (t == NULL || preset_cache_path(cache, index, file, sizeof(file))) {
+        return NULL;
+    }
+    if ((fd = open(file, O_RDONLY)) < 0 || fstat(fd, &st)) {
+        fprintf(stderr, "ERROR: cannot open preset %s: %s\n", file, strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+        }
+        return NULL;
+    }
+    if (t->index >= 0) {
+        unmap_text(t);
+    }
+    *hit = 0;
+
+    t->length = st.st_size;
+    if (st.st_size > 0 && st.st_size % page != 0) {
+        /* the rest of the last page reads as zeros: NUL terminated */
+        t->map_length = st.st_size;
+        t->text = mmap(NULL, t->map_length, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+        if (t->text == MAP_FAILED) {
+            t->text = NULL;
+        }
+    } else {
+        t->map_length = 0;
+        if ((t->text = malloc(t->length + 1)) != NULL) {
+            if (pread(fd, t->text, t->length, 0) != (ssize_t)t->length) {
+                free(t->text);
+                t->text = NULL;
+            } else {
+                t->text[t->length] = '\0';
+            }
+        }
+    }
+    close(fd);
+    if (t->text == NULL) {
+        fprintf(stderr, "ERROR: cannot read preset %s\n", file);
+        t->index = -1;
+        return NULL;
+    }
+    t->index = index;
+    t->refs = 0;
+    return t;
+}
+
+const char *preset_cache_acquire(preset_cache_t *cache, int index, size_t *length)
+{
+    preset_text_t *t;
+    int hit = 0;
+
+    if (index < 0 || (uint32_t)index >= cache->count) {
+        return NULL;
+    }
+    pthread_mutex_lock(&cache->lock);
+    t = map_text(cache, index, &hit);
+    if (hit) {
+        cache->stats.hits++;
+    } else {
+        cache->stats.misses++;
+    }
+    if (t != NULL) {
+        t->refs++;
+        t->last_use = ++cache->clock;
+        *length = t->length;
+    }
+    pthread_mutex_unlock(&cache->lock);
+    return t ? t->text : NULL;
+}
+
+void preset_cache_release(preset_cache_t *cache, int index)
+{
+    int i;
+
+    pthread_mutex_lock(&cache->lock);
+    for (i = 0; i < PRESET_CACHE_READY; i++) {
+        if (cache->ready[i].index == index && cache->ready[i].refs > 0) {
+            cache->ready[i].refs--;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&cache->lock);
+}
+
+void preset_cache_prefetch(preset_cache_t *cache, int index, int count)
+{
+    preset_text_t *t;
+    int i, hit;
+
+    if (cache->count == 0) {
+        return;
+    }
+    if (count > PRESET_CACHE_READY / 2) {
+        count = PRESET_CACHE_READY / 2;
+    }
+    pthread_mutex_lock(&cache->lock);
+    for (i = 1; i <= count; i++) {
+        t = map_text(cache, (index + i) % (int)cache->count, &hit);
+        if (t != NULL) {
+            t->last_use = ++cache->clock;
+        }
+    }
+    pthread_mutex_unlock(&cache->lock);
+}
+
+void preset_cache_stats(preset_cache_t *cache, preset_cache_stats_t *stats)
+{
+    if (cache->directory == NULL) {
+        memset(stats, 0, sizeof(*stats));
+        return;
+    }
+    pthread_mutex_lock(&cache->lock);
+    *stats = cache->stats;
+    pthread_mutex_unlock(&cache->lock);
+}
@@ -0,0 +1,111 @@
+/** @file preset-cache.h
+ *
+ * @brief Index of a preset directory and memory-mapped preset texts
+ *
+ * preset_cache_open() finds every .milk file below a directory and
+ * keeps an index of them (path, size, mtime and a hash of the text),
+ * sorted by path.  The index is written next to the presets and
+ * memory-mapped on the next start, so only files that changed since
+ * are read again.
+ *
+ * The texts of the PRESET_CACHE_READY most recently used or prefetched
+ * presets stay mapped and paged in.  preset_cache_prefetch() maps the
+ * presets that are likely to come next (the following ones in index
+ * order), so a switch to them does not touch the filesystem.
+ *
+ * The index is immutable after preset_cache_open(): count, find and
+ * path may be called from any thread.  acquire, release and prefetch
+ * lock the cache.
+ */
+
+#ifndef PRESET_CACHE_H
+#define PRESET_CACHE_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* presets kept mapped */
+#define PRESET_CACHE_READY 16
+
+/* name of the index file in the preset directory */
+#define PRESET_CACHE_INDEX_NAME ".preset-index"
+
+typedef struct preset_index_entry {
+    uint64_t size;
+    int64_t mtime_ns;
+    uint64_t hash;              /* FNV-1a of the file contents */
+    uint32_t path;              /* offset of the path in the string table */
+    uint32_t path_length;       /* relative to the directory, no NUL */
+} preset_index_entry_t;
+
+typedef struct preset_text {
+    int index;                  /* -1 for a free slot */
+    int refs;                   /* acquired and not released yet */
+    char *text;                 /* length bytes, see preset_cache_acquire() */
+    size_t length;
+    size_t map_length;          /* 0 when text was copied to the heap */
+    unsigned long last_use;
+} preset_text_t;
+
+typedef struct preset_cache_stats {
+    uint32_t presets;
+    uint32_t hashed;            /* files read at open, the rest came from the index */
+    int index_loaded;           /* an index file was found and valid */
+    int index_written;
+    double open_seconds;
+    unsigned long hits;         /* acquire found the text mapped */
+    unsigned long misses;
+} preset_cache_stats_t;
+
+typedef struct preset_cache {
+    char *directory;            /* absolute, no trailing slash */
+    size_t directory_length;
+    void *index_data;           /* the index file, mapped or on the heap */
+    size_t index_size;
+    int index_mapped;
+    const preset_index_entry_t *entry;
+    const char *strings;
+    uint32_t count;
+
+    pthread_mutex_t lock;
+    preset_text_t ready[PRESET_CACHE_READY];
+    unsigned long clock;
+    preset_cache_stats_t stats;
+} preset_cache_t;
+
+/**
+ * Index directory (recursively), reusing and updating its index file.
+ * A read-only directory works too, the index is then kept in memory.
+ * Returns 0 on success, -1 on error.
+ */
+int preset_cache_open(preset_cache_t *cache, const char *directory);
+
+/** Unmap everything.  No text may be acquired any more. */
+void preset_cache_close(preset_cache_t *cache);
+
+/** Number of presets in the index. */
+uint32_t preset_cache_count(const preset_cache_t *cache);
+
+/** Index of path (absolute, or relative to the directory), or -1. */
+int preset_cache_find(const preset_cache_t *cache, const char *path);
+
+/** Absolute path of preset index into buffer, -1 if it does not fit. */
+int preset_cache_path(const preset_cache_t *cache, int index, char *buffer, size_t size);
+
+/**
+ * The text of preset index, length bytes, mapped on a miss.  Valid
+ * until preset_cache_release().  NULL when the file cannot be read.
+ * Only NUL terminated while the file keeps the size it was mapped
+ * with, so copy length bytes rather than the string.
+ */
+const char *preset_cache_acquire(preset_cache_t *cache, int index, size_t *length);
+
+void preset_cache_release(preset_cache_t *cache, int index);
+
+/** Map and page in count presets following index, wrapping around. */
+void preset_cache_prefetch(preset_cache_t *cache, int index, int count);
+
+void preset_cache_stats(preset_cache_t *cache, preset_cache_stats_t *stats);
+
+#endif /* PRESET_CACHE_H */
@@ -0,0 +1,288 @@
+/** @file preset-loader.c
+ *
+ * @brief Read presets on a background thread, apply them between frames
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "preset-loader.h"
+#include "monotonic.h"
+#include "trace.h"
+
+double preset_loader_now(void)
+{
+    return monotonic_now();
+}
+
+/* grow b->data to hold at least size bytes, -1 on error */
+static int reserve(preset_buffer_t *b, size_t size, const char *url)
+{
+    size_t capacity = b->capacity ? b->capacity : 64 * 1024;
+    char *data;
+
+    while (capacity < size) {
+        capacity *= 2;
+    }
+    if (capacity == b->capacity) {
+        return 0;
+    }
+    if (size > PRESET_LOADER_MAX_BYTES + 1) {
+        fprintf(stderr, "ERROR: preset %s is larger than %d bytes\n",
+                url, PRESET_LOADER_MAX_BYTES);
+        return -1;
+    }
+    if ((data = realloc(b->data, capacity)) == NULL) {
+        fprintf(stderr, "ERROR: out of memory reading preset %s\n", url);
+        return -1;
+    }
+    b->data = data;
+    b->capacity = capacity;
+    return 0;
+}
+
+/* copy the cached text of preset index into b->data, -1 on error */
+static int copy_preset(preset_buffer_t *b, preset_cache_t *cache, int index, const char *url)
+{
+    const char *text;
+    size_t length;
+    int failed = -1;
+
+    if ((text = preset_cache_acquire(cache, index, &length)) != NULL) {
+        if (reserve(b, length + 1, url) == 0) {
+            /* the mapping is only NUL terminated while the file keeps its size */
+            memcpy(b->data, text, length);
+            b->data[length] = '\0';
+            b->size = length;
+            failed = 0;
+        }
+        preset_cache_release(cache, index);
+    }
+    /* the next presets in the playlist are likely to be asked for next */
+    preset_cache_prefetch(cache, index, PRESET_LOADER_PREFETCH);
+    return failed;
+}
+
+/* read the whole file at url into b->data, -1 on error */
+static int read_preset(preset_buffer_t *b, const char *url)
+{
+    FILE *f = fopen(url, "rb");
+    size_t n;
+
+    if (f == NULL) {
+        fprintf(stderr, "ERROR: cannot open preset %s: %s\n", url, strerror(errno));
+        return -1;
+    }
+    b->size = 0;
+    do {
+        if (reserve(b, b->size + 4096 + 1, url)) {
+            fclose(f);
+            return -1;
+        }
+        n = fread(b->data + b->size, 1, b->capacity - b->size - 1, f);
+        b->size += n;
+    } while (n > 0);
+    if (ferror(f)) {
+        fprintf(stderr, "ERROR: cannot read preset %s\n", url);
+        fclose(f);
+        return -1;
+    }
+    fclose(f);
+    b->data[b->size] = '\0';
+    return 0;
+}
+
+char *preset_loader_read(const char *url)
+{
+    preset_buffer_t b;
+
+    memset(&b, 0, sizeof(b));
+    if (read_preset(&b, url)) {
+        free(b.data);
+        return NULL;
+    }
+    return b.data;
+}
+
+static void *loader_thread(void *arg)
+{
+    preset_loader_t *loader = arg;
+    preset_buffer_t *b, *other;
+    preset_cache_t *cache;
+    char *url;
+    double requested, start;
+    int failed, index;
+
+    trace_thread_name("preset loader");
+    pthread_mutex_lock(&loader->lock);
+    while (!loader->stopping) {
+        if (loader->request == NULL) {
+            pthread_cond_wait(&loader->cond, &loader->lock);
+            continue;
+        }
+        url = loader->request;
+        requested = loader->request_time;
+        loader->request = NULL;
+
+        /* the render thread may hold one buffer, the other one is free
+         * or holds an older preset nobody picked up yet */
+        b = &loader->buffer[0];
+        other = &loader->buffer[1];
+        if (b->state == PRESET_BUFFER_APPLYING ||
+            (b->state == PRESET_BUFFER_READY && other->state == PRESET_BUFFER_FREE)) {
+            b = &loader->buffer[1];
+            other = &loader->buffer[0];
+        }
+        b->state = PRESET_BUFFER_READING;
+        cache = loader->cache;
+        pthread_mutex_unlock(&loader->lock);
+
+        start = preset_loader_now();
+        trace_begin("preset read");
+        if (cache != NULL && (index = preset_cache_find(cache, url)) >= 0) {
+            failed = copy_preset(b, cache, index, url);
+        } else {
+            failed = read_preset(b, url);
+        }
+        trace_end("preset read");
+
+        pthread_mutex_lock(&loader->lock);
+        if (failed || loader->request != NULL) {
+            /* unreadable, or already replaced by a newer request */
+            if (failed) {
+                loader->stats.failures++;
+            }
+            b->state = PRESET_BUFFER_FREE;
+            free(url);
+            continue;
+        }
+        if (other->state == PRESET_BUFFER_READY) {
+            other->state = PRESET_BUFFER_FREE;
+        }
+        free(b->url);
+        b->url = url;
+        b->requested = requested;
+        b->read_seconds = preset_loader_now() - start;
+        b->state = PRESET_BUFFER_READY;
+    }
+    pthread_mutex_unlock(&loader->lock);
+    return NULL;
+}
+
+int preset_loader_init(preset_loader_t *loader)
+{
+    memset(loader, 0, sizeof(*loader));
+    pthread_mutex_init(&loader->lock, NULL);
+    pthread_cond_init(&loader->cond, NULL);
+    if (pthread_create(&loader->thread, NULL, loader_thread, loader)) {
+        fprintf(stderr, "ERROR: cannot start the preset loader thread\n");
+        pthread_mutex_destroy(&loader->lock);
+        pthread_cond_destroy(&loader->cond);
+        return -1;
+    }
+    loader->running = 1;
+    return 0;
+}
+
+void preset_loader_free(preset_loader_t *loader)
+{
+    int i;
+
+    if (!loader->running) {
+        return;
+    }
+    pthread_mutex_lock(&loader->lock);
+    loader->stopping = 1;
+    pthread_cond_signal(&loader->cond);
+    pthread_mutex_unlock(&loader->lock);
+    pthread_join(loader->thread, NULL);
+
+    free(loader->request);
+    for (i = 0; i < 2; i++) {
+        free(loader->buffer[i].url);
+        free(loader->buffer[i].data);
+    }
+    pthread_mutex_destroy(&loader->lock);
+    pthread_cond_destroy(&loader->cond);
+    memset(loader, 0, sizeof(*loader));
+}
+
+void preset_loader_set_cache(preset_loader_t *loader, preset_cache_t *cache)
+{
+    pthread_mutex_lock(&loader->lock);
+    loader->cache = cache;
+    pthread_mutex_unlock(&loader->lock);
+}
+
+int preset_loader_request(preset_loader_t *loader, const char *url)
+{
+    char *copy;
+
+    if (!loader->running || (copy = strdup(url)) == NULL) {
+        return -1;
+    }
+    pthread_mutex_lock(&loader->lock);
+    free(loader->request);
+    loader->request = copy;
+    loader->request_time = preset_loader_now();
+    pthread_cond_signal(&loader->cond);
+    pthread_mutex_unlock(&loader->lock);
+    return 0;
+}
+
+preset_buffer_t *preset_loader_poll(preset_loader_t *loader)
+{
+    preset_buffer_t *ready = NULL;
+    int i;
+
+    if (!loader->running) {
+        return NULL;
+    }
+    pthread_mutex_lock(&loader->lock);
+    for (i = 0; i < 2; i++) {
+        if (loader->buffer[i].state == PRESET_BUFFER_READY) {
+            ready = &loader->buffer[i];
+            ready->state = PRESET_BUFFER_APPLYING;
+        }
+    }
+    pthread_mutex_unlock(&loader->lock);
+    return ready;
+}
+
+unsigned long preset_loader_applied(preset_loader_t *loader, preset_buffer_t *buffer,
+                                    double apply_seconds, double frame_period)
+{
+    preset_loader_stats_t *s = &loader->stats;
+    unsigned long stalled = 0;
+
+    /* every whole frame period the switch took is a frame not shown */
+    if (frame_period > 0) {
+        stalled = (unsigned long)(apply_seconds / frame_period);
+    }
+    pthread_mutex_lock(&loader->lock);
+    s->loads++;
+    s->last_read = buffer->read_seconds;
+    s->last_apply = apply_seconds;
+    s->last_latency = preset_loader_now() - buffer->requested;
+    if (apply_seconds > s->max_apply) {
+        s->max_apply = apply_seconds;
+    }
+    s->last_stalled = stalled;
+    s->stalled += stalled;
+    buffer->state = PRESET_BUFFER_FREE;
+    pthread_mutex_unlock(&loader->lock);
+    return stalled;
+}
+
+void preset_loader_stats(preset_loader_t *loader, preset_loader_stats_t *stats)
+{
+    if (!loader->running) {
+        memset(stats, 0, sizeof(*stats));
+        return;
+    }
+    pthread_mutex_lock(&loader->lock);
+    *stats = loader->stats;
+    pthread_mutex_unlock(&loader->lock);
+}
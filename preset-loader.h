@@ -0,0 +1,123 @@
+/** @file preset-loader.h
+ *
+ * @brief Read presets on a background thread, apply them between frames
+ *
+ * preset_loader_request() hands a preset path to the loader thread and
+ * returns at once.  The thread reads the file into one of two buffers
+ * while the render thread keeps drawing the current preset.  At the
+ * next frame boundary the render thread picks the finished buffer up
+ * with preset_loader_poll(), gives its text to projectM and returns it
+ * with preset_loader_applied(), which also counts the frames the switch
+ * cost.
+ *
+ * Only the newest request matters: a request that comes in while
+ * another one is still being read, or is waiting to be applied,
+ * replaces it.
+ *
+ * With a preset cache attached, presets in its directory are copied
+ * from the cache's mapped texts instead of read from disk, and the
+ * ones following them in the index are prefetched.
+ */
+
+#ifndef PRESET_LOADER_H
+#define PRESET_LOADER_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+#include "preset-cache.h"
+
+/* presets larger than this are refused, .milk files are a few kB */
+#define PRESET_LOADER_MAX_BYTES (4 * 1024 * 1024)
+
+/* presets prefetched after one that came from the cache */
+#define PRESET_LOADER_PREFETCH 4
+
+typedef enum preset_buffer_state {
+    PRESET_BUFFER_FREE = 0,
+    PRESET_BUFFER_READING,      /* owned by the loader thread */
+    PRESET_BUFFER_READY,        /* waiting for the render thread */
+    PRESET_BUFFER_APPLYING      /* owned by the render thread */
+} preset_buffer_state_t;
+
+typedef struct preset_buffer {
+    preset_buffer_state_t state;
+    char *url;
+    char *data;                 /* file contents, NUL terminated */
+    size_t size;
+    size_t capacity;
+    double requested;           /* preset_loader_request() time */
+    double read_seconds;        /* time spent reading on the loader thread */
+} preset_buffer_t;
+
+typedef struct preset_loader_stats {
+    unsigned long loads;        /* presets applied */
+    unsigned long failures;     /* presets that could not be read */
+    double last_read;           /* seconds on the loader thread */
+    double last_apply;          /* seconds on the render thread */
+    double last_latency;        /* request to applied, seconds */
+    double max_apply;
+    unsigned long last_stalled; /* frames the last switch cost */
+    unsigned long stalled;      /* frames all switches cost */
+} preset_loader_stats_t;
+
+typedef struct preset_loader {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int running;
+    int stopping;
+    char *request;              /* path waiting for the loader thread */
+    preset_cache_t *cache;      /* optional, see preset_loader_set_cache() */
+    double request_time;
+    preset_buffer_t buffer[2];
+    preset_loader_stats_t stats;
+} preset_loader_t;
+
+/** Start the loader thread.  Returns 0 on success, -1 on error. */
+int preset_loader_init(preset_loader_t *loader);
+
+/** Stop the loader thread and free the buffers. */
+void preset_loader_free(preset_loader_t *loader);
+
+/**
+ * Serve presets from cache from now on.  Call before the first
+ * request; the cache must stay open until the loader is freed.
+ */
+void preset_loader_set_cache(preset_loader_t *loader, preset_cache_t *cache);
+
+/**
+ * Queue url for loading, replacing a request that was not applied yet.
+ * Never blocks on file I/O.  Returns 0 on success, -1 on error.
+ */
+int preset_loader_request(preset_loader_t *loader, const char *url);
+
+/**
+ * Called by the render thread before a frame.  Returns the newest
+ * preset that was read completely, or NULL if there is none.  The
+ * buffer stays valid until preset_loader_applied().
+ */
+preset_buffer_t *preset_loader_poll(preset_loader_t *loader);
+
+/**
+ * Return a buffer from preset_loader_poll() after projectM took its
+ * text.  apply_seconds is the time that took on the render thread and
+ * frame_period the frame budget; the frames the switch stalled are
+ * counted in the stats and returned.
+ */
+unsigned long preset_loader_applied(preset_loader_t *loader, preset_buffer_t *buffer,
+                                    double apply_seconds, double frame_period);
+
+/** A copy of the counters, safe to call from any thread. */
+void preset_loader_stats(preset_loader_t *loader, preset_loader_stats_t *stats);
+
+/** Monotonic clock in seconds, for timing preset switches. */
+double preset_loader_now(void);
+
+/**
+ * Read the preset at url on the calling thread, without the loader.
+ * Returns the NUL terminated text, free() it, or NULL on error.
+ */
+char *preset_loader_read(const char *url);
+
+#endif /* PRESET_LOADER_H */
@@ -0,0 +1,184 @@
+/** @file preset-warmup.c
+ *
+ * @brief Compile the shaders of upcoming presets before they are shown
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#define GL_GLEXT_PROTOTYPES 1
+#include "headless.h"
+#include "preset-loader.h"
+#include "preset-warmup.h"
+#include "monotonic.h"
+#include "trace.h"
+#include <GL/glext.h>
+#include <libprojectM/projectM.h>
+
+/* the scratch instance only has to render, not to be looked at */
+#define WARMUP_SIZE 64
+
+/* let the driver compile on all its threads, 1 if it can */
+static int enable_parallel_compile(void)
+{
+    GLint count = 0, i;
+
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for (i = 0; i < count; i++) {
+        const char *name = (const char *)glGetStringi(GL_EXTENSIONS, i);
+        if (strcmp(name, "GL_KHR_parallel_shader_compile") == 0) {
+            glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void warm_preset(preset_warmup_t *w, projectm_handle projectm, int index)
+{
+    char path[PATH_MAX];
+    char *text = NULL;
+    double start = monotonic_now();
+
+    if (w->path(w->user, index, path, sizeof(path)) == 0) {
+        text = preset_loader_read(path);
+    }
+    if (text != NULL) {
+        /* a hard cut compiles the preset right away, the frame runs
+         * every program it uses once */
+        trace_begin("preset warm-up");
+        projectm_load_preset_data(projectm, text, false);
+        projectm_render_frame(projectm);
+        glFinish();
+        trace_end("preset warm-up");
+        free(text);
+    }
+
+    pthread_mutex_lock(&w->lock);
+    if (text != NULL) {
+        w->stats.warm++;
+        w->stats.last_seconds = monotonic_now() - start;
+        w->stats.seconds += w->stats.last_seconds;
+    } else {
+        w->stats.failed++;
+    }
+    pthread_mutex_unlock(&w->lock);
+}
+
+static void *warmup_thread(void *arg)
+{
+    preset_warmup_t *w = arg;
+    projectm_handle projectm = NULL;
+    headless_t context;
+    int index, parallel;
+
+    trace_thread_name("preset warm-up");
+    /* a context of its own, current on this thread only, so nothing
+     * the render thread does waits for it */
+    if (headless_init(&context, WARMUP_SIZE, WARMUP_SIZE)) {
+        fprintf(stderr, "ERROR: no context for the preset warm-up, presets compile on first use\n");
+        return NULL;
+    }
+    parallel = enable_parallel_compile();
+    if ((projectm = projectm_create(NULL, 0)) == NULL) {
+        fprintf(stderr, "ERROR: no projectM instance for the preset warm-up\n");
+        headless_destroy(&context);
+        return NULL;
+    }
+    projectm_set_window_size(projectm, WARMUP_SIZE, WARMUP_SIZE);
+    printf("INFO: warming up %d presets ahead on %s%s\n", PRESET_WARMUP_AHEAD,
+           glGetString(GL_RENDERER), parallel ? ", parallel shader compile" : "");
+
+    pthread_mutex_lock(&w->lock);
+    w->stats.parallel = parallel;
+    while (!w->stopping) {
+        if (w->left == 0) {
+            pthread_cond_wait(&w->cond, &w->lock);
+            continue;
+        }
+        index = w->next;
+        w->next = (w->next + 1) % w->count;
+        w->left--;
+        if (w->warm[index]) {
+            continue;
+        }
+        w->warm[index] = 1;
+        pthread_mutex_unlock(&w->lock);
+        warm_preset(w, projectm, index);
+        pthread_mutex_lock(&w->lock);
+    }
+    pthread_mutex_unlock(&w->lock);
+
+    projectm_destroy(projectm);
+    headless_destroy(&context);
+    return NULL;
+}
+
+int preset_warmup_init(preset_warmup_t *w, int count, preset_warmup_path_fn path, void *user)
+{
+    memset(w, 0, sizeof(*w));
+    if (count <= 0 || (w->warm = calloc(count, 1)) == NULL) {
+        return -1;
+    }
+    w->count = count;
+    w->path = path;
+    w->user = user;
+    w->stats.presets = count;
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->cond, NULL);
+    /* the first preset is loaded right away, warm the ones after it */
+    w->next = 1 % count;
+    w->left = count - 1 < PRESET_WARMUP_AHEAD ? count - 1 : PRESET_WARMUP_AHEAD;
+    if (pthread_create(&w->thread, NULL, warmup_thread, w)) {
+        fprintf(stderr, "ERROR: cannot start the preset warm-up thread\n");
+        pthread_mutex_destroy(&w->lock);
+        pthread_cond_destroy(&w->cond);
+        free(w->warm);
+        memset(w, 0, sizeof(*w));
+        return -1;
+    }
+    w->running = 1;
+    return 0;
+}
+
+void preset_warmup_free(preset_warmup_t *w)
+{
+    if (!w->running) {
+        return;
+    }
+    pthread_mutex_lock(&w->lock);
+    w->stopping = 1;
+    pthread_cond_signal(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+    pthread_join(w->thread, NULL);
+
+    free(w->warm);
+    pthread_mutex_destroy(&w->lock);
+    pthread_cond_destroy(&w->cond);
+    memset(w, 0, sizeof(*w));
+}
+
+void preset_warmup_ahead(preset_warmup_t *w, int current)
+{
+    if (!w->running || current < 0 || current >= w->count) {
+        return;
+    }
+    pthread_mutex_lock(&w->lock);
+    w->next = (current + 1) % w->count;
+    w->left = w->count - 1 < PRESET_WARMUP_AHEAD ? w->count - 1 : PRESET_WARMUP_AHEAD;
+    pthread_cond_signal(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+}
+
+void preset_warmup_stats(preset_warmup_t *w, preset_warmup_stats_t *stats)
+{
+    if (!w->running) {
+        memset(stats, 0, sizeof(*stats));
+        return;
+    }
+    pthread_mutex_lock(&w->lock);
+    *stats = w->stats;
+    pthread_mutex_unlock(&w->lock);
+}
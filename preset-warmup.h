@@ -0,0 +1,77 @@
+/** @file preset-warmup.h
+ *
+ * @brief Compile the shaders of upcoming presets before they are shown
+ *
+ * projectM compiles a preset's shaders when the preset is loaded, so
+ * the first switch to every preset hitches.  The warm-up thread has its
+ * own headless GL context and a scratch projectM instance.  It loads
+ * the presets that are coming up next in the playlist and renders one
+ * frame of each, so the driver compiles all of their programs.  The
+ * driver's shader cache (Mesa's disk cache, the NVIDIA GL cache) then
+ * serves the same programs when the render thread loads the preset.
+ *
+ * Where the worker context has GL_KHR_parallel_shader_compile, it lets
+ * the driver use all its compiler threads.
+ *
+ * The render thread only calls preset_warmup_ahead() and
+ * preset_warmup_stats(), which take a lock the worker holds for a few
+ * instructions at a time: it never waits for a compile.
+ */
+
+#ifndef PRESET_WARMUP_H
+#define PRESET_WARMUP_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+/* presets after the current one that are kept warm */
+#define PRESET_WARMUP_AHEAD 8
+
+/** Writes the path of preset index, returns -1 if there is none. */
+typedef int (*preset_warmup_path_fn)(void *user, int index, char *buffer, size_t size);
+
+typedef struct preset_warmup_stats {
+    int presets;                /* in the playlist */
+    int warm;                   /* presets warmed so far */
+    int failed;                 /* presets that could not be read */
+    int parallel;               /* GL_KHR_parallel_shader_compile in use */
+    double seconds;             /* spent warming, on the worker thread */
+    double last_seconds;        /* for the last preset */
+} preset_warmup_stats_t;
+
+typedef struct preset_warmup {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int running;
+    int stopping;
+    preset_warmup_path_fn path;
+    void *user;
+    int count;
+    unsigned char *warm;        /* per preset: tried already */
+    int next;                   /* next preset to warm */
+    int left;                   /* presets from next on still to warm */
+    preset_warmup_stats_t stats;
+} preset_warmup_t;
+
+/**
+ * Start the worker for a playlist of count presets, whose paths come
+ * from path(user, index, ...), which is called on the worker thread.
+ * Preset 0 is taken to be the one shown first, the PRESET_WARMUP_AHEAD
+ * presets after it are warmed right away.  Returns 0 on success, -1 on
+ * error.
+ */
+int preset_warmup_init(preset_warmup_t *w, int count, preset_warmup_path_fn path, void *user);
+
+/** Stop the worker, waiting for the preset it is warming. */
+void preset_warmup_free(preset_warmup_t *w);
+
+/**
+ * The playlist moved to preset current: warm the PRESET_WARMUP_AHEAD
+ * presets after it, wrapping around.  Never blocks on the worker.
+ */
+void preset_warmup_ahead(preset_warmup_t *w, int current);
+
+void preset_warmup_stats(preset_warmup_t *w, preset_warmup_stats_t *stats);
+
+#endif /* PRESET_WARMUP_H */
@@ -0,0 +1,153 @@
+/** @file program-cache-bench.c
+ *
+ * @brief Cold and warm startup of the GL programs with the program cache
+ *
+ * Builds the texture program of the JNI binding and the texture
+ * clients, plus a preset-sized warp/composite program, in a headless
+ * context: first with an empty cache directory (compile, link and
+ * store), then again as a later run would (load the stored binaries).
+ * Prints the per-program compile and link times and both totals.
+ *
+ * The cache directory is a temporary one, removed afterwards.  With
+ * Mesa, what a binary saves also depends on Mesa's own shader cache:
+ * run with MESA_SHADER_CACHE_DISABLE=true to see the binaries alone.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <dirent.h>
+#include <unistd.h>
+
+#define GL_GLEXT_PROTOTYPES 1
+#include "headless.h"
+#include "program-cache.h"
+#include <GL/glext.h>
+
+static const char *texture_vertex = "#version 330\n\
+in mediump vec3 point;\n\
+in mediump vec2 texcoord;\n\
+out mediump vec2 UV;\n\
+void main()\n\
+{\n\
+  gl_Position = vec4(point, 1);\n\
+  UV = texcoord;\n\
+}";
+
+static const char *texture_fragment = "#version 330\n\
+in mediump vec2 UV;\n\
+out mediump vec3 fragColor;\n\
+uniform sampler2D tex;\n\
+void main()\n\
+{\n\
+  fragColor = texture(tex, UV).rgb;\n\
+}";
+
+/* about what a milkdrop warp shader turns into */
+static const char *preset_fragment = "#version 330\n\
+in mediump vec2 UV;\n\
+out mediump vec4 fragColor;\n\
+uniform sampler2D sampler_main;\n\
+uniform sampler2D sampler_noise_lq;\n\
+uniform vec4 rand_frame;\n\
+uniform float time, bass, mid, treb;\n\
+vec3 blur(vec2 uv, float r)\n\
+{\n\
+  vec3 c = vec3(0.0);\n\
+  for (int i = -4; i <= 4; i++)\n\
+    for (int j = -4; j <= 4; j++)\n\
+      c += texture(sampler_main, uv + vec2(i, j) * r).rgb;\n\
+  return c / 81.0;\n\
+}\n\
+void main()\n\
+{\n\
+  vec2 uv = UV - 0.5;\n\
+  float ang = atan(uv.y, uv.x), rad = length(uv);\n\
+  vec2 zoom = uv * (1.0 - 0.02 * bass) + 0.5;\n\
+  vec3 noise = texture(sampler_noise_lq, zoom * 4.0 + rand_frame.xy).rgb;\n\
+  vec3 ret = texture(sampler_main, zoom + 0.004 * sin(ang * 6.0 + time)).rgb;\n\
+  ret = mix(ret, blur(zoom, 0.003 * (1.0 + mid)), 0.5);\n\
+  ret += 0.1 * noise * treb;\n\
+  ret *= 0.98 - 0.1 * rad;\n\
+  ret = pow(ret, vec3(0.95)) + 0.02 * sin(vec3(1.0, 2.0, 3.0) * time + rad * 10.0);\n\
+  fragColor = vec4(clamp(ret, 0.0, 1.0), 1.0);\n\
+}";
+
+static const struct {
+    const char *name;
+    const char **vertex;
+    const char **fragment;
+} programs[] = {
+    { "texture", &texture_vertex, &texture_fragment },
+    { "preset", &texture_vertex, &preset_fragment },
+};
+
+#define PROGRAMS (sizeof(programs) / sizeof(programs[0]))
+
+static double run(const char *label, int expect_hit)
+{
+    program_cache_stats_t stats;
+    double total = 0;
+    size_t i;
+
+    for (i = 0; i < PROGRAMS; i++) {
+        GLuint program = program_cache_build(programs[i].name, *programs[i].vertex,
+                                             *programs[i].fragment, &stats);
+        if (program == 0 || stats.hit != expect_hit) {
+            fprintf(stderr, "ERROR: %s program %s\n", programs[i].name,
+                    program == 0 ? "failed to build" : "was not cached as expected");
+            exit(1);
+        }
+        glDeleteProgram(program);
+        printf("%-6s %-8s compile %8.2f ms  link %8.2f ms  total %8.2f ms\n", label,
+               programs[i].name, stats.compile_seconds * 1e3, stats.link_seconds * 1e3,
+               stats.total_seconds * 1e3);
+        total += stats.total_seconds;
+    }
+    return total;
+}
+
+int main(void)
+{
+    char directory[] = "/tmp/program-cache-bench.XXXXXX";
+    char path[PATH_MAX];
+    headless_t context;
+    struct dirent *d;
+    double cold, warm;
+    GLint formats = 0;
+    DIR *dir;
+
+    if (mkdtemp(directory) == NULL) {
+        perror(directory);
+        exit(1);
+    }
+    setenv("PROGRAM_CACHE_DIR", directory, 1);
+    if (headless_init(&context, 64, 64)) {
+        fprintf(stderr, "ERROR: cannot create headless context\n");
+        exit(1);
+    }
+    printf("%s, %s\n", glGetString(GL_RENDERER), glGetString(GL_VERSION));
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    if (formats == 0) {
+        printf("no program binary formats, nothing is cached\n");
+    }
+
+    cold = run("cold", 0);
+    warm = run("warm", formats > 0);
+    printf("startup: cold %.2f ms, warm %.2f ms, %.1fx\n",
+           cold * 1e3, warm * 1e3, cold / warm);
+
+    headless_destroy(&context);
+    if ((dir = opendir(directory)) != NULL) {
+        while ((d = readdir(dir)) != NULL) {
+            if (d->d_name[0] != '.') {
+                snprintf(path, sizeof(path), "%s/%s", directory, d->d_name);
+                unlink(path);
+            }
+        }
+        closedir(dir);
+    }
+    rmdir(directory);
+    return 0;
+}
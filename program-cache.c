@@ -0,0 +1,279 @@
+/** @file program-cache.c
+ *
+ * @brief Keep linked GL programs on disk and reload them on later runs
+ *
+ * Entry file layout, native byte order:
+ *   "PMPROG01", uint64 key, uint32 binary format, uint32 binary length
+ *   binary
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define GL_GLEXT_PROTOTYPES 1
+#include "program-cache.h"
+#include "monotonic.h"
+#include <GL/glext.h>
+
+#define ENTRY_MAGIC "PMPROG01"
+
+typedef struct entry_header {
+    char magic[8];
+    uint64_t key;
+    uint32_t format;
+    uint32_t length;
+} entry_header_t;
+
+static pthread_once_t directory_once = PTHREAD_ONCE_INIT;
+static char directory[PATH_MAX];
+
+/* FNV-1a, strings are hashed with their terminating NUL */
+static uint64_t hash_string(uint64_t h, const char *s)
+{
+    do {
+        h = (h ^ (unsigned char)*s) * 0x100000001b3ULL;
+    } while (*s++);
+    return h;
+}
+
+/* mkdir -p, errors show up when the entry is written */
+static void make_directories(char *path)
+{
+    char *p;
+
+    for (p = path + 1; *p; p++) {
+        if (*p == '/') {
+            *p = '\0';
+            mkdir(path, 0755);
+            *p = '/';
+        }
+    }
+    mkdir(path, 0755);
+}
+
+static void find_directory(void)
+{
+    const char *env = getenv("PROGRAM_CACHE_DIR");
+    const char *home;
+
+    if (env != NULL && env[0]) {
+        snprintf(directory, sizeof(directory), "%s", env);
+    } else if ((env = getenv("XDG_CACHE_HOME")) != NULL && env[0]) {
+        snprintf(directory, sizeof(directory), "%s/projectM-test/programs", env);
+    } else if ((home = getenv("HOME")) != NULL && home[0]) {
+        snprintf(directory, sizeof(directory), "%s/.cache/projectM-test/programs", home);
+    } else {
+        directory[0] = '\0';
+        return;
+    }
+    make_directories(directory);
+}
+
+const char *program_cache_directory(void)
+{
+    pthread_once(&directory_once, find_directory);
+    return directory;
+}
+
+static void entry_path(char *path, size_t size, uint64_t key)
+{
+    snprintf(path, size, "%s/%016llx.bin", program_cache_directory(),
+             (unsigned long long)key);
+}
+
+/* the stored binary for key, NULL if there is none; free() it */
+static void *load_entry(uint64_t key, GLenum *format, GLsizei *length)
+{
+    char path[PATH_MAX + 32];
+    entry_header_t header;
+    struct stat st;
+    void *binary;
+    int fd;
+
+    entry_path(path, sizeof(path), key);
+    if ((fd = open(path, O_RDONLY)) < 0) {
+        return NULL;
+    }
+    if (fstat(fd, &st) ||
+        read(fd, &header, sizeof(header)) != sizeof(header) ||
+        memcmp(header.magic, ENTRY_MAGIC, 8) || header.key != key ||
+        (off_t)(sizeof(header) + header.length) != st.st_size ||
+        (binary = malloc(header.length)) == NULL) {
+        close(fd);
+        return NULL;
+    }
+    if (read(fd, binary, header.length) != (ssize_t)header.length) {
+        free(binary);
+        close(fd);
+        return NULL;
+    }
+    close(fd);
+    *format = header.format;
+    *length = header.length;
+    return binary;
+}
+
+/* write the entry to a file of its own next to its final name and rename
+ * it into place, so concurrent runs and instances never see half an entry */
+static int store_entry(uint64_t key, GLenum format, const void *binary, GLsizei length)
+{
+    char path[PATH_MAX + 32], tmp[PATH_MAX + 64];
+    entry_header_t header;
+    int fd, failed;
+
+    if (program_cache_directory()[0] == '\0') {
+        return -1;
+    }
+    entry_path(path, sizeof(path), key);
+    snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+    memcpy(header.magic, ENTRY_MAGIC, 8);
+    header.key = key;
+    header.format = format;
+    header.length = length;
+    if ((fd = mkstemp(tmp)) < 0) {
+        fprintf(stderr, "WARNING: cannot write program cache entry %s: %s\n",
+                path, strerror(errno));
+        return -1;
+    }
+    failed = fchmod(fd, 0644) ||
+        write(fd, &header, sizeof(header)) != sizeof(header) ||
+        write(fd, binary, length) != (ssize_t)length;
+    if (close(fd) || failed || rename(tmp, path)) {
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+/* print the info log of a failed compile or link, like printStatus() */
+static int check_status(const char *name, const char *step, GLuint object, GLenum status)
+{
+    GLint result = GL_FALSE;
+    char buffer[1024];
+
+    if (status == GL_COMPILE_STATUS) {
+        glGetShaderiv(object, status, &result);
+    } else {
+        glGetProgramiv(object, status, &result);
+    }
+    if (result == GL_FALSE) {
+        buffer[0] = '\0';
+        if (status == GL_COMPILE_STATUS) {
+            glGetShaderInfoLog(object, sizeof(buffer), NULL, buffer);
+        } else {
+            glGetProgramInfoLog(object, sizeof(buffer), NULL, buffer);
+        }
+        fprintf(stderr, "ERROR: %s %s: %s\n", name, step, buffer);
+        return -1;
+    }
+    return 0;
+}
+
+static GLuint compile_shader(const char *name, const char *step, GLenum type, const char *source)
+{
+    GLuint shader = glCreateShader(type);
+
+    glShaderSource(shader, 1, &source, NULL);
+    glCompileShader(shader);
+    if (check_status(name, step, shader, GL_COMPILE_STATUS)) {
+        glDeleteShader(shader);
+        return 0;
+    }
+    return shader;
+}
+
+GLuint program_cache_build(const char *name, const char *vertex_source,
+                           const char *fragment_source, program_cache_stats_t *stats)
+{
+    program_cache_stats_t s;
+    GLuint program, vertex, fragment;
+    GLint formats = 0, length = 0;
+    GLenum format;
+    void *binary;
+    double start = monotonic_now(), t;
+
+    memset(&s, 0, sizeof(s));
+    s.key = hash_string(0xcbf29ce484222325ULL, vertex_source);
+    s.key = hash_string(s.key, fragment_source);
+    s.key = hash_string(s.key, (const char *)glGetString(GL_VENDOR));
+    s.key = hash_string(s.key, (const char *)glGetString(GL_RENDERER));
+    s.key = hash_string(s.key, (const char *)glGetString(GL_VERSION));
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+
+    if (formats > 0 && (binary = load_entry(s.key, &format, &length)) != NULL) {
+        GLint linked = GL_FALSE;
+
+        program = glCreateProgram();
+        t = monotonic_now();
+        glProgramBinary(program, format, binary, length);
+        free(binary);
+        glGetProgramiv(program, GL_LINK_STATUS, &linked);
+        s.link_seconds = monotonic_now() - t;
+        if (linked) {
+            s.hit = 1;
+            s.total_seconds = monotonic_now() - start;
+            printf("INFO: %s program %016llx loaded from the cache in %.2f ms\n",
+                   name, (unsigned long long)s.key, s.total_seconds * 1e3);
+            if (stats != NULL) {
+                *stats = s;
+            }
+            return program;
+        }
+        /* out of date for this driver, build it again */
+        printf("INFO: %s program %016llx: the driver rejected the cached binary, recompiling\n",
+               name, (unsigned long long)s.key);
+        glDeleteProgram(program);
+    }
+
+    t = monotonic_now();
+    vertex = compile_shader(name, "vertex shader", GL_VERTEX_SHADER, vertex_source);
+    fragment = compile_shader(name, "fragment shader", GL_FRAGMENT_SHADER, fragment_source);
+    s.compile_seconds = monotonic_now() - t;
+    if (vertex == 0 || fragment == 0) {
+        glDeleteShader(vertex);
+        glDeleteShader(fragment);
+        return 0;
+    }
+
+    program = glCreateProgram();
+    if (formats > 0) {
+        glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+    glAttachShader(program, vertex);
+    glAttachShader(program, fragment);
+    t = monotonic_now();
+    glLinkProgram(program);
+    s.link_seconds = monotonic_now() - t;
+    glDetachShader(program, vertex);
+    glDetachShader(program, fragment);
+    glDeleteShader(vertex);
+    glDeleteShader(fragment);
+    if (check_status(name, "program", program, GL_LINK_STATUS)) {
+        glDeleteProgram(program);
+        return 0;
+    }
+
+    if (formats > 0) {
+        glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+        if (length > 0 && (binary = malloc(length)) != NULL) {
+            glGetProgramBinary(program, length, &length, &format, binary);
+            s.stored = store_entry(s.key, format, binary, length) == 0;
+            free(binary);
+        }
+    }
+    s.total_seconds = monotonic_now() - start;
+    printf("INFO: %s program %016llx compiled in %.2f ms, linked in %.2f ms%s\n",
+           name, (unsigned long long)s.key, s.compile_seconds * 1e3,
+           s.link_seconds * 1e3, s.stored ? ", stored in the cache" : "");
+    if (stats != NULL) {
+        *stats = s;
+    }
+    return program;
+}
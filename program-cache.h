@@ -0,0 +1,51 @@
+/** @file program-cache.h
+ *
+ * @brief Keep linked GL programs on disk and reload them on later runs
+ *
+ * program_cache_build() replaces the glCompileShader() /
+ * glLinkProgram() sequence for a vertex and fragment shader pair.  The
+ * program is looked up by a hash of both sources and GL_VENDOR,
+ * GL_RENDERER and GL_VERSION.  On a hit the glGetProgramBinary() output
+ * stored by an earlier run is handed to glProgramBinary() and nothing
+ * is compiled.  On a miss, or when the driver rejects the binary (e.g.
+ * after a driver update), the sources are compiled and linked and the
+ * new binary is stored.
+ *
+ * Entries live in $PROGRAM_CACHE_DIR, else in
+ * $XDG_CACHE_HOME/projectM-test/programs or
+ * ~/.cache/projectM-test/programs.  Contexts without program binary
+ * formats always compile.
+ *
+ * Attribute locations must be queried after building, as usual; the
+ * binary keeps the locations the link assigned.
+ */
+
+#ifndef PROGRAM_CACHE_H
+#define PROGRAM_CACHE_H
+
+#include <stdint.h>
+#include <GL/gl.h>
+
+typedef struct program_cache_stats {
+    uint64_t key;
+    int hit;                    /* loaded from the cache */
+    int stored;                 /* written to the cache */
+    double compile_seconds;     /* both shaders, 0 on a hit */
+    double link_seconds;        /* glLinkProgram() or glProgramBinary() */
+    double total_seconds;       /* including the cache file I/O */
+} program_cache_stats_t;
+
+/**
+ * Build a program from the two sources, using and filling the cache.
+ * name is used in messages.  Prints compile and link errors and one
+ * INFO line with the timings.  stats may be NULL.
+ *
+ * @return the program, 0 if compiling or linking failed
+ */
+GLuint program_cache_build(const char *name, const char *vertex_source,
+                           const char *fragment_source, program_cache_stats_t *stats);
+
+/** The directory entries are stored in, for messages and benchmarks. */
+const char *program_cache_directory(void);
+
+#endif /* PROGRAM_CACHE_H */
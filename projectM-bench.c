@@ -0,0 +1,573 @@
+/** @file projectM-bench.c
+ *
+ * @brief Render every preset of a directory offscreen and time it
+ *
+ * Each preset gets a fresh projectM instance in a headless context (so
+ * it runs on llvmpipe without a display), is loaded with a hard cut and
+ * rendered for a fixed number of frames with synthetic audio or an
+ * audio file.  Every frame is finished with glFinish(), so the times
+ * are what the GPU, or the CPU under llvmpipe, really spent:
+ *
+ *   projectM-bench --frames=300 --format=json ~/presets > presets.json
+ *
+ * Per preset it reports the load time (parsing and everything else
+ * projectm_load_preset_data() does, without the compiles it does), the
+ * time spent in glCompileShader() and glLinkProgram() while loading and
+ * in the first frame, the first frame including the compiles libprojectM
+ * defers to it, and mean/p50/p99/max of the other frames.
+ *
+ * The compile time is measured by defining glCompileShader() and
+ * glLinkProgram() here, which libprojectM then calls instead of libGL's;
+ * link with -rdynamic.  A libprojectM that looks the entry points up
+ * through glXGetProcAddress/eglGetProcAddress bypasses that, and the
+ * compile columns stay empty.  Drivers with a shader disk cache (Mesa)
+ * only compile on the first run: --no-shader-cache disables Mesa's.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <getopt.h>
+#include <signal.h>
+#include <math.h>
+#include <dlfcn.h>
+#include <sys/stat.h>
+
+#include <sndfile.h>
+#include <libprojectM/projectM.h>
+
+#include "headless.h"
+#include "monotonic.h"
+#include "preset-cache.h"
+#include "preset-loader.h"
+#include "stage-timer.h"
+#include <GL/glext.h>
+
+#define SAMPLE_RATE 44100
+
+enum output_format {
+    FORMAT_CSV,
+    FORMAT_JSON
+};
+
+typedef struct preset_result {
+    const char *path;
+    double load;                /* seconds, without compiling */
+    double compile;             /* seconds, loading and first frame,
+                                 * -1 when not measured */
+    int programs;               /* glLinkProgram() calls */
+    double first_frame;
+    double mean;
+    double p50;
+    double p99;
+    double max;
+} preset_result_t;
+
+projectm_handle projectm;
+headless_t offscreen;
+
+int width = 1280;
+int height = 720;
+int fps = 60;
+int texture_size = 2048;
+int mesh_x = 128;
+int mesh_y = 128;
+long frames = 300;
+const char *audio_path;
+enum output_format format = FORMAT_CSV;
+volatile sig_atomic_t quit;
+
+/* audio file, replayed from the start for every preset */
+SNDFILE *audio_file;
+SF_INFO audio_info;
+float *samples;
+sf_count_t hop;
+
+/*-----------------------------------------------------------------------------
+ * Compile time
+ * ---------------------------------------------------------------------------*/
+double compile_seconds;
+int compiles;
+int links;
+
+void glCompileShader(GLuint shader)
+{
+    static PFNGLCOMPILESHADERPROC real;
+    double start = monotonic_now();
+
+    if (real == NULL) {
+        real = (PFNGLCOMPILESHADERPROC)dlsym(RTLD_NEXT, "glCompileShader");
+    }
+    real(shader);
+    compile_seconds += monotonic_now() - start;
+    compiles++;
+}
+
+void glLinkProgram(GLuint program)
+{
+    static PFNGLLINKPROGRAMPROC real;
+    double start = monotonic_now();
+
+    if (real == NULL) {
+        real = (PFNGLLINKPROGRAMPROC)dlsym(RTLD_NEXT, "glLinkProgram");
+    }
+    real(program);
+    compile_seconds += monotonic_now() - start;
+    links++;
+}
+
+/*-----------------------------------------------------------------------------
+ * Audio
+ * ---------------------------------------------------------------------------*/
+/**
+ * Two seconds of a 120 bpm pattern, the same for every preset: a kick
+ * on every beat, a bass line and a noise hi-hat on the off-beats, so
+ * beat detection and the bass/mid/treble levels all move.
+ */
+void synthesize(float *out, long frame, sf_count_t count)
+{
+    static unsigned int noise = 1;
+    sf_count_t i;
+
+    for (i = 0; i < count; i++) {
+        double t = (double)(frame * SAMPLE_RATE / fps + i) / SAMPLE_RATE;
+        double beat = fmod(t, 0.5), offbeat = fmod(t + 0.25, 0.5);
+        double kick = exp(-beat * 30) * sin(2 * M_PI * (50 + 100 * exp(-beat * 40)) * beat);
+        double bass = 0.3 * sin(2 * M_PI * (fmod(t, 2.0) < 1.0 ? 55 : 82.4) * t);
+        double hat;
+        noise = noise * 1103515245 + 12345;
+        hat = 0.2 * exp(-offbeat * 80) * ((noise >> 16 & 0x7fff) / 16384.0 - 1);
+        out[2*i+0] = 0.6 * kick + bass + hat;
+        out[2*i+1] = 0.6 * kick + bass - hat;
+    }
+}
+
+/* one frame worth of audio into projectM */
+void add_audio(long frame)
+{
+    unsigned int max_samples = projectm_pcm_get_max_samples();
+    sf_count_t count, done, n, i;
+    int channels = 2;
+
+    if (audio_file == NULL) {
+        count = (sf_count_t)(frame + 1) * SAMPLE_RATE / fps - (sf_count_t)frame * SAMPLE_RATE / fps;
+        synthesize(samples, frame, count);
+    } else {
+        count = sf_readf_float(audio_file, samples, hop);
+        if (count < hop) {
+            /* loop files shorter than the benchmark */
+            sf_seek(audio_file, 0, SEEK_SET);
+            count += sf_readf_float(audio_file, samples + count * audio_info.channels,
+                                    hop - count);
+        }
+        channels = audio_info.channels;
+        if (channels > 2) {
+            for (i = 0; i < count; i++) {
+                samples[2*i+0] = samples[channels*i+0];
+                samples[2*i+1] = samples[channels*i+1];
+            }
+            channels = 2;
+        }
+    }
+    for (done = 0; done < count; done += n) {
+        n = count - done;
+        if (n > max_samples) {
+            n = max_samples;
+        }
+        projectm_pcm_add_float(projectm, samples + done * channels, n,
+                               channels == 1 ? PROJECTM_MONO : PROJECTM_STEREO);
+    }
+}
+
+/*-----------------------------------------------------------------------------
+ * Benchmark
+ * ---------------------------------------------------------------------------*/
+/* render one frame and wait for it, returns the time it took */
+double render_frame(long frame)
+{
+    double start;
+
+    add_audio(frame);
+    start = monotonic_now();
+    headless_bind(&offscreen);
+    glClear(GL_COLOR_BUFFER_BIT);
+    projectm_render_frame(projectm);
+    glFinish();
+    return monotonic_now() - start;
+}
+
+/* load and render one preset on a fresh projectM instance, -1 on error */
+int bench_preset(const char *path, double *times, preset_result_t *r)
+{
+    char *text;
+    double start, load_compile;
+    stage_summary_t summary;
+    long i;
+
+    if ((text = preset_loader_read(path)) == NULL) {
+        return -1;
+    }
+    projectm = projectm_create(NULL, 0);
+    if (projectm == NULL) {
+        fprintf (stderr, "projectm_create() failed\n");
+        exit (1);
+    }
+    projectm_set_texture_size(projectm, texture_size);
+    projectm_set_window_size(projectm, width, height);
+    projectm_set_mesh_size(projectm, mesh_x, mesh_y);
+    projectm_set_fps(projectm, fps);
+    if (audio_file != NULL) {
+        sf_seek(audio_file, 0, SEEK_SET);
+    }
+    /* the instance's own programs are built on its first frame, keep
+     * them out of the preset's numbers */
+    render_frame(0);
+
+    memset(r, 0, sizeof(*r));
+    r->path = path;
+    compile_seconds = 0;
+    compiles = links = 0;
+    start = monotonic_now();
+    projectm_load_preset_data(projectm, text, false);
+    projectm_lock_preset(projectm, true);
+    r->load = monotonic_now() - start;
+    load_compile = compile_seconds;
+    free(text);
+    /* compiles deferred to the first frame stay in first_frame */
+    r->first_frame = render_frame(1);
+    r->load -= load_compile < r->load ? load_compile : r->load;
+    r->compile = compiles + links > 0 ? compile_seconds : -1;
+    r->programs = links;
+
+    for (i = 0; i < frames && !quit; i++) {
+        times[i] = render_frame(i + 2);
+    }
+    projectm_destroy(projectm);
+    projectm = NULL;
+    if (i == 0) {
+        return -1;
+    }
+    stage_timer_percentiles(times, i, &summary);
+    r->mean = summary.mean;
+    r->p50 = summary.p50;
+    r->p99 = summary.p99;
+    r->max = summary.max;
+    return 0;
+}
+
+/*-----------------------------------------------------------------------------
+ * Output
+ * ---------------------------------------------------------------------------*/
+/* a CSV field, quoted when it has to be */
+void write_csv_string(FILE *out, const char *s)
+{
+    if (strpbrk(s, ",\"\n\r") == NULL) {
+        fputs(s, out);
+        return;
+    }
+    fputc('"', out);
+    for (; *s; s++) {
+        if (*s == '"') {
+            fputc('"', out);
+        }
+        fputc(*s, out);
+    }
+    fputc('"', out);
+}
+
+void write_json_string(FILE *out, const char *s)
+{
+    fputc('"', out);
+    for (; *s; s++) {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\') {
+            fprintf(out, "\\%c", c);
+        } else if (c < 0x20) {
+            fprintf(out, "\\u%04x", c);
+        } else {
+            fputc(c, out);
+        }
+    }
+    fputc('"', out);
+}
+
+void write_csv(FILE *out, const preset_result_t *results, int count)
+{
+    int i;
+
+    fprintf(out, "preset,load_ms,compile_ms,programs,first_frame_ms,mean_ms,p50_ms,p99_ms,max_ms\n");
+    for (i = 0; i < count; i++) {
+        const preset_result_t *r = &results[i];
+        write_csv_string(out, r->path);
+        fprintf(out, ",%.3f,", r->load * 1e3);
+        if (r->compile >= 0) {
+            fprintf(out, "%.3f", r->compile * 1e3);
+        }
+        fprintf(out, ",%d,%.3f,%.3f,%.3f,%.3f,%.3f\n", r->programs, r->first_frame * 1e3,
+                r->mean * 1e3, r->p50 * 1e3, r->p99 * 1e3, r->max * 1e3);
+    }
+}
+
+void write_json(FILE *out, const preset_result_t *results, int count)
+{
+    int i;
+
+    fprintf(out, "{\n  \"renderer\": ");
+    write_json_string(out, (const char *)glGetString(GL_RENDERER));
+    fprintf(out, ",\n  \"size\": [%d, %d],\n  \"texture\": %d,\n  \"mesh\": [%d, %d],\n"
+            "  \"fps\": %d,\n  \"frames\": %ld,\n  \"audio\": ",
+            width, height, texture_size, mesh_x, mesh_y, fps, frames);
+    if (audio_path != NULL) {
+        write_json_string(out, audio_path);
+    } else {
+        fprintf(out, "null");
+    }
+    fprintf(out, ",\n  \"presets\": [");
+    for (i = 0; i < count; i++) {
+        const preset_result_t *r = &results[i];
+        fprintf(out, "%s\n    {\"preset\": ", i ? "," : "");
+        write_json_string(out, r->path);
+        fprintf(out, ", \"load_ms\": %.3f, \"compile_ms\": ", r->load * 1e3);
+        if (r->compile >= 0) {
+            fprintf(out, "%.3f", r->compile * 1e3);
+        } else {
+            fprintf(out, "null");
+        }
+        fprintf(out, ", \"programs\": %d, \"first_frame_ms\": %.3f, \"mean_ms\": %.3f, "
+                "\"p50_ms\": %.3f, \"p99_ms\": %.3f, \"max_ms\": %.3f}",
+                r->programs, r->first_frame * 1e3, r->mean * 1e3, r->p50 * 1e3,
+                r->p99 * 1e3, r->max * 1e3);
+    }
+    fprintf(out, "\n  ]\n}\n");
+}
+
+/*-----------------------------------------------------------------------------
+ * Main
+ * ---------------------------------------------------------------------------*/
+void stop(int sig)
+{
+    (void)sig;
+    quit = 1;
+}
+
+void usage(const char *name)
+{
+    fprintf (stderr, "usage: %s [options] directory|preset.milk ...\n"
+             "  --size=WxH          framebuffer size (default 1280x720)\n"
+             "  --texture=N         projectM texture size (default 2048)\n"
+             "  --mesh=XxY          projectM mesh size (default 128x128)\n"
+             "  --frames=N          frames timed per preset (default 300)\n"
+             "  --fps=N             frames per second of audio (default 60)\n"
+             "  --audio=FILE        audio file instead of the synthetic beat\n"
+             "  --format=F          csv (default) or json\n"
+             "  --output=FILE       write the results to FILE instead of stdout\n"
+             "  --no-shader-cache   disable Mesa's shader disk cache\n", name);
+}
+
+/* add the presets of argument arg to the list, -1 on error */
+int add_presets(const char *arg, char ***paths, int *count)
+{
+    char path[PATH_MAX];
+    preset_cache_t cache;
+    struct stat st;
+    char **grown;
+    int i, n = 1, directory = stat(arg, &st) == 0 && S_ISDIR(st.st_mode);
+
+    if (directory) {
+        /* the directory index gives the presets in path order */
+        if (preset_cache_open(&cache, arg)) {
+            return -1;
+        }
+        n = preset_cache_count(&cache);
+    }
+    if ((grown = realloc(*paths, (*count + n) * sizeof(char *))) == NULL) {
+        fprintf (stderr, "ERROR: out of memory\n");
+        exit (1);
+    }
+    *paths = grown;
+    if (!directory) {
+        (*paths)[(*count)++] = strdup(arg);
+        return 0;
+    }
+    for (i = 0; i < n; i++) {
+        if (preset_cache_path(&cache, i, path, sizeof(path)) == 0) {
+            (*paths)[(*count)++] = strdup(path);
+        }
+    }
+    preset_cache_close(&cache);
+    return 0;
+}
+
+int main (int argc, char *argv[])
+{
+    const char *output_path = NULL;
+    FILE *out = stdout;
+    preset_result_t *results;
+    char **paths = NULL;
+    double *times, start;
+    int opt, i, count = 0, done = 0, measured = 0;
+    const struct option long_options[] = {
+        {"size", required_argument, NULL, 's'},
+        {"texture", required_argument, NULL, 't'},
+        {"mesh", required_argument, NULL, 'm'},
+        {"frames", required_argument, NULL, 'f'},
+        {"fps", required_argument, NULL, 'r'},
+        {"audio", required_argument, NULL, 'a'},
+        {"format", required_argument, NULL, 'F'},
+        {"output", required_argument, NULL, 'o'},
+        {"no-shader-cache", no_argument, NULL, 'n'},
+        {NULL, 0, NULL, 0}
+    };
+
+    while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+        switch (opt) {
+        case 's':
+            if (sscanf(optarg, "%dx%d", &width, &height) != 2 || width <= 0 || height <= 0) {
+                usage(argv[0]);
+                exit (1);
+            }
+            break;
+        case 't':
+            if (sscanf(optarg, "%d", &texture_size) != 1 || texture_size <= 0) {
+                usage(argv[0]);
+                exit (1);
+            }
+            break;
+        case 'm':
+            if (sscanf(optarg, "%dx%d", &mesh_x, &mesh_y) != 2 || mesh_x <= 0 || mesh_y <= 0) {
+                usage(argv[0]);
+                exit (1);
+            }
+            break;
+        case 'f':
+            if (sscanf(optarg, "%ld", &frames) != 1 || frames <= 0) {
+                usage(argv[0]);
+                exit (1);
+            }
+            break;
+        case 'r':
+            if (sscanf(optarg, "%d", &fps) != 1 || fps <= 0) {
+                usage(argv[0]);
+                exit (1);
+            }
+            break;
+        case 'a':
+            audio_path = optarg;
+            break;
+        case 'F':
+            if (strcmp(optarg, "csv") == 0) {
+                format = FORMAT_CSV;
+            } else if (strcmp(optarg, "json") == 0) {
+                format = FORMAT_JSON;
+            } else {
+                usage(argv[0]);
+                exit (1);
+            }
+            break;
+        case 'o':
+            output_path = optarg;
+            break;
+        case 'n':
+            setenv("MESA_SHADER_CACHE_DISABLE", "true", 1);
+            break;
+        default:
+            usage(argv[0]);
+            exit (1);
+        }
+    }
+    if (optind >= argc) {
+        usage(argv[0]);
+        exit (1);
+    }
+    for (i = optind; i < argc; i++) {
+        if (add_presets(argv[i], &paths, &count)) {
+            exit (1);
+        }
+    }
+    if (count == 0) {
+        fprintf (stderr, "ERROR: no presets found\n");
+        exit (1);
+    }
+
+    /* Audio: a file, or the synthetic beat at SAMPLE_RATE */
+    if (audio_path != NULL) {
+        memset(&audio_info, 0, sizeof(audio_info));
+        audio_file = sf_open(audio_path, SFM_READ, &audio_info);
+        if (audio_file == NULL) {
+            fprintf (stderr, "ERROR: cannot open %s: %s\n", audio_path, sf_strerror(NULL));
+            exit (1);
+        }
+        hop = audio_info.samplerate / fps;
+        samples = malloc(hop * audio_info.channels * sizeof(float));
+    } else {
+        samples = malloc((SAMPLE_RATE / fps + 1) * 2 * sizeof(float));
+    }
+    times = malloc(frames * sizeof(double));
+    results = calloc(count, sizeof(preset_result_t));
+    if (samples == NULL || times == NULL || results == NULL) {
+        fprintf (stderr, "ERROR: out of memory\n");
+        exit (1);
+    }
+    if (output_path != NULL && (out = fopen(output_path, "w")) == NULL) {
+        fprintf (stderr, "ERROR: cannot write %s: %s\n", output_path, strerror(errno));
+        exit (1);
+    }
+
+    /* Initialize an offscreen context */
+    if (headless_init(&offscreen, width, height)) {
+        fprintf (stderr, "ERROR: cannot create headless context\n");
+        exit (1);
+    }
+    fprintf (stderr, "INFO: %d presets, %ld frames each at %dx%d, texture %d, mesh %dx%d, "
+             "using %s, GL_RENDERER: %s\n", count, frames, width, height, texture_size,
+             mesh_x, mesh_y, headless_backend(&offscreen), glGetString(GL_RENDERER));
+    glClearColor(0.0,0.0,0.0,0.0);
+
+    signal(SIGINT, stop);
+    signal(SIGTERM, stop);
+    start = monotonic_now();
+    for (i = 0; i < count && !quit; i++) {
+        preset_result_t *r = &results[done];
+        if (bench_preset(paths[i], times, r)) {
+            continue;
+        }
+        fprintf (stderr, "INFO: [%d/%d] %s: load %.1f ms, compile %.1f ms (%d programs), "
+                 "p50 %.2f ms, p99 %.2f ms\n", i + 1, count, r->path, r->load * 1e3,
+                 r->compile >= 0 ? r->compile * 1e3 : 0, r->programs, r->p50 * 1e3,
+                 r->p99 * 1e3);
+        measured += r->compile >= 0;
+        done++;
+    }
+    fprintf (stderr, "INFO: %d of %d presets benchmarked in %.1f s\n",
+             done, count, monotonic_now() - start);
+    if (done > 0 && measured == 0) {
+        fprintf (stderr, "WARNING: no glCompileShader() calls seen, compile times "
+                 "not measured (link with -rdynamic)\n");
+    }
+
+    if (format == FORMAT_JSON) {
+        write_json(out, results, done);
+    } else {
+        write_csv(out, results, done);
+    }
+    if (out != stdout) {
+        fclose(out);
+    }
+
+    headless_destroy(&offscreen);
+    if (audio_file != NULL) {
+        sf_close(audio_file);
+    }
+    for (i = 0; i < count; i++) {
+        free(paths[i]);
+    }
+    free(paths);
+    free(results);
+    free(times);
+    free(samples);
+    exit (done > 0 ? 0 : 1);
+}
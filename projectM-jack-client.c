@@ -8,11 +8,30 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
+#include <getopt.h>
+#include <signal.h>
+#include <limits.h>
+#include <sys/stat.h>
 
 #include <jack/jack.h>
 #include <GL/freeglut.h>
+#include <GL/glx.h>
+#include <GL/glxext.h>
 #include <libprojectM/projectM.h>
 
+#include "pcm-ring.h"
+#include "pcm-interleave.h"
+#include "headless.h"
+#include "frame-pacer.h"
+#include "preset-cache.h"
+#include "preset-loader.h"
+#include "preset-warmup.h"
+#include "stage-timer.h"
+#include "trace.h"
+
+/* frames interleaved per step in process(), larger periods are chunked */
+#define INTERLEAVE_FRAMES 4096
+
 jack_port_t *input_port1;
 jack_port_t *input_port2;
 jack_port_t *output_port1;
@@ -21,35 +40,87 @@ jack_client_t *client;
 
 projectm_handle projectm;
 
+/* stereo audio handed over from the JACK thread to the render thread */
+pcm_ring_t pcm_ring;
+pcm_interleave_kernel_t interleave;
+float *interleave_buffer;
+float *pcm_drain_buffer;
+unsigned int pcm_drain_size;
+unsigned long reported_overruns;
+jack_nframes_t jack_period;
+
+/* frame pacing, fps == 0 renders as fast as possible (or vsync) */
+frame_pacer_t pacer;
+int target_fps = -1;
+int vsync;
+int frame_due;
+double last_report;
+
+/* CPU/GPU time per stage of the frame, dumped on SIGUSR1 */
+stage_timer_t stage_timer;
+volatile sig_atomic_t dump_stages;
+
+/* offscreen rendering without a window */
+int headless;
+int window_width = 300;
+int window_height = 300;
+long max_frames;
+headless_t offscreen;
+volatile sig_atomic_t quit;
+
+/* presets are read in the background and cycled every switch_seconds,
+ * from the command line or from an indexed preset directory; the
+ * shaders of the next ones are compiled ahead on their own thread */
+preset_loader_t preset_loader;
+preset_cache_t preset_cache;
+preset_warmup_t preset_warmup;
+int preset_directory;
+char **presets;
+int preset_count;
+int current_preset;
+double switch_seconds;
+double last_switch;
+
 /**
  * The process callback for this JACK application is called in a
  * special realtime thread once for each audio cycle.
  *
- * This client does nothing more than copy data from its input
- * port to its output port. It will exit when stopped by 
- * the user (e.g. using Ctrl-C on a unix-ish operating system)
+ * This client copies data from its input port to its output port
+ * and queues the input for the render thread. It must not call
+ * into libprojectM, which may lock or allocate. It will exit when
+ * stopped by the user (e.g. using Ctrl-C on a unix-ish operating system)
  */
 int process (jack_nframes_t nframes, void *arg)
 {
-	jack_default_audio_sample_t *in, *out;
-    
-    int nsamples;
-    nsamples = projectm_pcm_get_max_samples();
-    if(nframes < nsamples) {
-        nsamples = nframes;
-    }
+	jack_default_audio_sample_t *in1, *in2, *out;
+	jack_nframes_t done, n;
 	
-	in = jack_port_get_buffer (input_port1, nframes);
+    trace_begin("process");
+	in1 = jack_port_get_buffer (input_port1, nframes);
 	out = jack_port_get_buffer (output_port1, nframes);
-	memcpy (out, in,
+	memcpy (out, in1,
 		sizeof (jack_default_audio_sample_t) * nframes);
-    in = jack_port_get_buffer (input_port2, nframes);
+    in2 = jack_port_get_buffer (input_port2, nframes);
 	out = jack_port_get_buffer (output_port2, nframes);
-	memcpy (out, in,
+	memcpy (out, in2,
 		sizeof (jack_default_audio_sample_t) * nframes);
+
+    for (done = 0; done < nframes; done += n) {
+        n = nframes - done;
+        if (n > INTERLEAVE_FRAMES) {
+            n = INTERLEAVE_FRAMES;
+        }
+        interleave.fn(interleave_buffer, in1 + done, in2 + done, n);
+        pcm_ring_write(&pcm_ring, interleave_buffer, 2 * n);
+    }
+    trace_end("process");
 	return 0;
+}
 
-    projectm_pcm_add_float(projectm, in, nsamples, PROJECTM_STEREO);
+/* JACK calls this in its process thread before the first cycle */
+void jack_thread_init (void *arg)
+{
+    trace_thread_name("JACK process");
 }
 
 /**
@@ -61,11 +132,206 @@ void jack_shutdown (void *arg)
 	exit (1);
 }
 
+/**
+ * Feed the audio that belongs to this frame into projectM, in chunks of
+ * at most projectm_pcm_get_max_samples() frames.  hop is the number of
+ * audio frames per video frame from the pacer; 0 drains everything.
+ *
+ * JACK delivers whole periods, so up to one period more than a hop may
+ * be waiting.  If the backlog grows beyond that (the audio clock runs
+ * faster than ours) it is fed too, so latency cannot build up.
+ */
+void drain_audio(unsigned int hop)
+{
+    size_t n, avail = pcm_ring_read_space(&pcm_ring);
+    size_t want = 2 * (size_t)hop;
+    unsigned long overruns;
+
+    trace_begin("drain audio");
+    /* want and avail count samples, two per frame */
+    if (hop == 0 || avail > want + 2 * (size_t)jack_period) {
+        want = avail;
+    }
+    /* a short frame still feeds what there is, only empty ones count */
+    if (avail == 0) {
+        pcm_ring_underrun(&pcm_ring);
+        trace_instant("audio underrun");
+    }
+    while (want > 0
+           && (n = pcm_ring_read(&pcm_ring, pcm_drain_buffer,
+                                 want < 2 * pcm_drain_size ? want : 2 * pcm_drain_size)) > 0) {
+        projectm_pcm_add_float(projectm, pcm_drain_buffer, n / 2, PROJECTM_STEREO);
+        want -= n;
+    }
+    trace_end("drain audio");
+
+    overruns = pcm_ring_overruns(&pcm_ring);
+    if (overruns != reported_overruns) {
+        fprintf (stderr, "WARNING: audio ring overrun, %lu samples dropped "
+                 "(%lu frames without audio)\n", overruns,
+                 pcm_ring_underruns(&pcm_ring));
+        reported_overruns = overruns;
+    }
+}
+
+/* the path of preset number i, also called by the warm-up thread */
+int preset_path(void *user, int i, char *path, size_t size)
+{
+    (void)user;
+    if (preset_directory) {
+        return preset_cache_path(&preset_cache, i, path, size);
+    }
+    if ((size_t)snprintf(path, size, "%s", presets[i]) >= size) {
+        return -1;
+    }
+    return 0;
+}
+
+/* ask the loader for preset number i, and warm up the ones after it */
+void request_preset(int i)
+{
+    char path[PATH_MAX];
+
+    if (preset_path(NULL, i, path, sizeof(path)) == 0) {
+        preset_loader_request(&preset_loader, path);
+    }
+    preset_warmup_ahead(&preset_warmup, i);
+}
+
+/**
+ * Called between two frames: request the next preset when it is time to
+ * switch, and hand a preset the loader finished reading to projectM.
+ * Only parsing the text is left to the render thread.
+ */
+void apply_preset(void)
+{
+    preset_buffer_t *preset;
+    preset_loader_stats_t stats;
+    double t = frame_pacer_now(), start;
+
+    if (switch_seconds > 0 && preset_count > 1 && t - last_switch >= switch_seconds) {
+        current_preset = (current_preset + 1) % preset_count;
+        request_preset(current_preset);
+        last_switch = t;
+    }
+
+    preset = preset_loader_poll(&preset_loader);
+    if (preset == NULL) {
+        return;
+    }
+    printf("INFO: switching to preset %s\n", preset->url);
+    start = frame_pacer_now();
+    trace_begin("preset apply");
+    projectm_load_preset_data(projectm, preset->data, false);
+    projectm_lock_preset(projectm, true);
+    trace_end("preset apply");
+    preset_loader_applied(&preset_loader, preset, frame_pacer_now() - start,
+                          pacer.period > 0 ? pacer.period : 1.0 / 60);
+
+    preset_loader_stats(&preset_loader, &stats);
+    printf("INFO: preset read in %.2f ms off the render thread, applied in %.2f ms, "
+           "%.1f ms after the request, %lu frames stalled\n",
+           stats.last_read * 1e3, stats.last_apply * 1e3, stats.last_latency * 1e3,
+           stats.last_stalled);
+}
+
+/* frame time percentiles and dropped frames, every 5 seconds */
+void report_frame_stats(int force)
+{
+    frame_pacer_stats_t stats;
+    preset_warmup_stats_t warmup;
+    double t = frame_pacer_now();
+
+    if (!force && t - last_report < 5.0) {
+        return;
+    }
+    last_report = t;
+    frame_pacer_stats(&pacer, &stats);
+    printf("INFO: frame time p50 %.2f ms p99 %.2f ms, render p50 %.2f ms p99 %.2f ms, "
+           "%lu frames, %lu dropped\n",
+           stats.p50 * 1e3, stats.p99 * 1e3, stats.render_p50 * 1e3,
+           stats.render_p99 * 1e3, stats.frames, stats.dropped);
+    preset_warmup_stats(&preset_warmup, &warmup);
+    if (warmup.presets > 0) {
+        printf("INFO: %d of %d presets warmed up in %.1f ms, last one %.1f ms%s\n",
+               warmup.warm, warmup.presets, warmup.seconds * 1e3,
+               warmup.last_seconds * 1e3,
+               warmup.parallel ? " with parallel shader compile" : "");
+    }
+}
+
+/* GLUT idle callback: wait for the next frame slot, then redisplay */
+void idle(void)
+{
+    frame_pacer_wait(&pacer);
+    frame_due = 1;
+    glutPostRedisplay();
+}
+
+/* kill -USR1 prints the stage times after the next frame */
+void request_stage_dump(int sig)
+{
+    (void)sig;
+    dump_stages = 1;
+}
+
+void report_stage_stats(void)
+{
+    if (dump_stages) {
+        dump_stages = 0;
+        printf("INFO: stage times over the last %d frames:\n", STAGE_TIMER_WINDOW);
+        stage_timer_dump(&stage_timer, stdout);
+    }
+}
+
+/**
+ * Totals of the run.  freeglut ends glutMainLoop() with exit(), so this
+ * runs from atexit() with a window and from main() headless, once.
+ */
+void report_exit_stats(void)
+{
+    static int reported;
+    preset_loader_stats_t preset_stats;
+
+    if (reported) {
+        return;
+    }
+    reported = 1;
+    report_frame_stats(1);
+    dump_stages = 1;
+    report_stage_stats();
+    printf("INFO: audio ring overruns: %lu samples, underruns: %lu frames\n",
+           pcm_ring_overruns(&pcm_ring), pcm_ring_underruns(&pcm_ring));
+    preset_loader_stats(&preset_loader, &preset_stats);
+    printf("INFO: %lu preset switches, %lu unreadable, slowest applied in %.2f ms, "
+           "%lu frames stalled\n", preset_stats.loads, preset_stats.failures,
+           preset_stats.max_apply * 1e3, preset_stats.stalled);
+    if (preset_directory) {
+        preset_cache_stats_t cache_stats;
+        preset_cache_stats(&preset_cache, &cache_stats);
+        printf("INFO: preset cache: %lu hits, %lu misses\n",
+               cache_stats.hits, cache_stats.misses);
+    }
+}
+
 void render(void)
 {
+    trace_begin("frame");
+    stage_timer_frame(&stage_timer);
+    /* expose events redraw without taking a frame slot */
+    if (frame_due) {
+        apply_preset();
+        stage_timer_begin(&stage_timer, STAGE_AUDIO);
+        drain_audio(frame_pacer_hop(&pacer));
+        stage_timer_end(&stage_timer, STAGE_AUDIO);
+    }
+    stage_timer_begin(&stage_timer, STAGE_RENDER);
+    trace_begin("render");
     glClear(GL_COLOR_BUFFER_BIT);
 	glLoadIdentity();
     projectm_render_frame(projectm);
+    trace_end("render");
+    stage_timer_end(&stage_timer, STAGE_RENDER);
 	/*
 	glBegin(GL_POLYGON);
 		glColor3f(0.0,0.0,0.0);
@@ -76,7 +342,66 @@ void render(void)
 		glVertex3f(0.5,0.5,-3.0);
 		*/
 	glEnd();
-	glFlush();			//Finish rendering
+    stage_timer_begin(&stage_timer, STAGE_SWAP);
+    trace_begin("swap");
+	glutSwapBuffers();
+    trace_end("swap");
+    stage_timer_end(&stage_timer, STAGE_SWAP);
+    if (frame_due) {
+        frame_due = 0;
+        frame_pacer_done(&pacer);
+        report_frame_stats(0);
+    }
+    report_stage_stats();
+    trace_end("frame");
+}
+
+/* 1 if name is one of the space separated extensions */
+int has_glx_extension(const char *extensions, const char *name)
+{
+    size_t length = strlen(name);
+    const char *p = extensions;
+
+    while (p != NULL && (p = strstr(p, name)) != NULL) {
+        if ((p == extensions || p[-1] == ' ') && (p[length] == ' ' || p[length] == '\0')) {
+            return 1;
+        }
+        p += length;
+    }
+    return 0;
+}
+
+/**
+ * Swap the window's buffers on vertical blank, with whichever GLX swap
+ * control the driver has.  Returns 0 on success, -1 if there is none
+ * (e.g. freeglut on Wayland).
+ */
+int enable_vsync(void)
+{
+    Display *display = glXGetCurrentDisplay();
+    const char *extensions;
+
+    if (display == NULL) {
+        return -1;
+    }
+    extensions = glXQueryExtensionsString(display, DefaultScreen(display));
+    if (has_glx_extension(extensions, "GLX_EXT_swap_control")) {
+        PFNGLXSWAPINTERVALEXTPROC swap_interval = (PFNGLXSWAPINTERVALEXTPROC)
+            glXGetProcAddress((const GLubyte *)"glXSwapIntervalEXT");
+        swap_interval(display, glXGetCurrentDrawable(), 1);
+        return 0;
+    }
+    if (has_glx_extension(extensions, "GLX_MESA_swap_control")) {
+        PFNGLXSWAPINTERVALMESAPROC swap_interval = (PFNGLXSWAPINTERVALMESAPROC)
+            glXGetProcAddress((const GLubyte *)"glXSwapIntervalMESA");
+        return swap_interval(1) == 0 ? 0 : -1;
+    }
+    if (has_glx_extension(extensions, "GLX_SGI_swap_control")) {
+        PFNGLXSWAPINTERVALSGIPROC swap_interval = (PFNGLXSWAPINTERVALSGIPROC)
+            glXGetProcAddress((const GLubyte *)"glXSwapIntervalSGI");
+        return swap_interval(1) == 0 ? 0 : -1;
+    }
+    return -1;
 }
 
 void reshape(int x, int y)
@@ -94,6 +419,83 @@ void reshape(int x, int y)
 	glViewport(0,0,x,y);  //Use the whole window for rendering
 }
 
+void stop(int sig)
+{
+	(void)sig;
+	quit = 1;
+}
+
+/**
+ * Headless replacement for glutMainLoop(): render frames at the pacer's
+ * rate, or as fast as the context allows with --fps=0, and report the
+ * frame rate once per second.
+ */
+void run_headless(void)
+{
+    long frames = 0, interval_frames = 0;
+    double start = frame_pacer_now(), interval_start = start, t;
+
+    signal(SIGINT, stop);
+    signal(SIGTERM, stop);
+
+    while (!quit && (max_frames == 0 || frames < max_frames)) {
+        frame_pacer_wait(&pacer);
+        headless_bind(&offscreen);
+        trace_begin("frame");
+        stage_timer_frame(&stage_timer);
+        apply_preset();
+        stage_timer_begin(&stage_timer, STAGE_AUDIO);
+        drain_audio(frame_pacer_hop(&pacer));
+        stage_timer_end(&stage_timer, STAGE_AUDIO);
+        stage_timer_begin(&stage_timer, STAGE_RENDER);
+        trace_begin("render");
+        glClear(GL_COLOR_BUFFER_BIT);
+        projectm_render_frame(projectm);
+        trace_end("render");
+        stage_timer_end(&stage_timer, STAGE_RENDER);
+        glFlush();
+        trace_end("frame");
+        frame_pacer_done(&pacer);
+        report_frame_stats(0);
+        report_stage_stats();
+        frames++;
+        interval_frames++;
+
+        t = frame_pacer_now();
+        if (t - interval_start >= 1.0) {
+            glFinish();
+            t = frame_pacer_now();
+            printf("INFO: %.1f fps\n", interval_frames / (t - interval_start));
+            interval_frames = 0;
+            interval_start = t;
+        }
+    }
+    glFinish();
+    t = frame_pacer_now();
+    printf("INFO: rendered %ld frames in %.2f s, %.1f fps\n",
+           frames, t - start, frames / (t - start));
+}
+
+void usage(const char *name)
+{
+    fprintf (stderr, "usage: %s [--headless] [--size=WxH] [--frames=N] [--fps=N] [--vsync]\n"
+             "          [--switch=SECONDS] [--trace=FILE] preset.milk...|directory\n"
+             "  --headless    render offscreen (EGL/OSMesa) instead of a GLUT window\n"
+             "  --size=WxH    window or framebuffer size (default 300x300)\n"
+             "  --frames=N    in headless mode, stop after N frames\n"
+             "  --fps=N       target frame rate, 0 = as fast as possible\n"
+             "                (default 60 with a window, 0 headless)\n"
+             "  --vsync       lock buffer swaps to vertical blank (GLX swap control)\n"
+             "                and let them pace the window instead of a timer\n"
+             "  --switch=S    cycle through the presets every S seconds, they are\n"
+             "                read in the background and switched between frames\n"
+             "  --trace=FILE  write the JACK cycles, audio drains, preset loads,\n"
+             "                rendering and swaps as a Chrome trace (Perfetto)\n"
+             "  directory     play the .milk files below it in path order, indexed\n"
+             "                in directory/" PRESET_CACHE_INDEX_NAME "\n"
+             "kill -USR1 prints CPU and GPU time per stage of the frame\n", name);
+}
+
 int main (int argc, char *argv[])
 {
 	const char **ports;
@@ -103,12 +505,82 @@ int main (int argc, char *argv[])
 	jack_status_t status;
     
     GLuint texture_id;
-    int rating[1] = {1};
+    struct stat preset_stat;
+    const char *trace_path = NULL;
+    int opt;
+    const struct option long_options[] = {
+        {"headless", no_argument, NULL, 'H'},
+        {"size", required_argument, NULL, 's'},
+        {"frames", required_argument, NULL, 'f'},
+        {"fps", required_argument, NULL, 'r'},
+        {"vsync", no_argument, NULL, 'v'},
+        {"switch", required_argument, NULL, 'w'},
+        {"trace", required_argument, NULL, 't'},
+        {NULL, 0, NULL, 0}
+    };
+
+    while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+        switch (opt) {
+        case 'H':
+            headless = 1;
+            break;
+        case 'r':
+            target_fps = atoi(optarg);
+            break;
+        case 'v':
+            vsync = 1;
+            break;
+        case 's':
+            if (sscanf(optarg, "%dx%d", &window_width, &window_height) != 2
+                || window_width <= 0 || window_height <= 0) {
+                usage(argv[0]);
+                exit (1);
+            }
+            break;
+        case 'f':
+            max_frames = atol(optarg);
+            break;
+        case 'w':
+            switch_seconds = atof(optarg);
+            break;
+        case 't':
+            trace_path = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            exit (1);
+        }
+    }
     
-    if (argc == 1) {
+    if (optind >= argc) {
 		fprintf (stderr, "You need to specify a path to a Milkdrop preset\n");
+		usage(argv[0]);
 		exit (1);
     }
+    /* before any thread starts, the trace is finished when exit()
+     * ends glutMainLoop() */
+    if (trace_path != NULL) {
+        if (trace_open(trace_path)) {
+            exit (1);
+        }
+        trace_thread_name("render");
+        atexit(trace_close);
+    }
+    presets = argv + optind;
+    preset_count = argc - optind;
+    if (preset_count == 1 && stat(presets[0], &preset_stat) == 0 && S_ISDIR(preset_stat.st_mode)) {
+        preset_cache_stats_t cache_stats;
+        if (preset_cache_open(&preset_cache, presets[0]) || preset_cache_count(&preset_cache) == 0) {
+            fprintf (stderr, "ERROR: no presets in %s\n", presets[0]);
+            exit (1);
+        }
+        preset_cache_stats(&preset_cache, &cache_stats);
+        printf("INFO: %u presets in %s, indexed in %.1f ms (%u files read, index %s)\n",
+               cache_stats.presets, presets[0], cache_stats.open_seconds * 1e3,
+               cache_stats.hashed, cache_stats.index_loaded ? "reused" : "created");
+        preset_directory = 1;
+        preset_count = preset_cache_count(&preset_cache);
+    }
 	
 	/* open a client connection to the JACK server */
 
@@ -134,6 +606,7 @@ int main (int argc, char *argv[])
 	*/
 
 	jack_set_process_callback (client, process, 0);
+	jack_set_thread_init_callback (client, jack_thread_init, 0);
 
 	/* tell the JACK server to call `jack_shutdown()' if
 	   it ever shuts down, either entirely, or if it
@@ -147,6 +620,26 @@ int main (int argc, char *argv[])
 
 	printf ("INFO: engine sample rate: %" PRIu32 "\n",
 		jack_get_sample_rate (client));
+	jack_period = jack_get_buffer_size (client);
+
+	/* the ring holds one second of interleaved stereo audio, the
+	 * render thread drains it in chunks of what projectM takes in
+	 * one call
+	 */
+
+	if (pcm_ring_init (&pcm_ring, 2 * jack_get_sample_rate (client), 2)) {
+		fprintf (stderr, "ERROR: cannot allocate audio ring\n");
+		exit (1);
+	}
+	interleave = pcm_interleave_select();
+	printf ("INFO: interleave kernel: %s\n", interleave.name);
+	interleave_buffer = malloc (2 * INTERLEAVE_FRAMES * sizeof (float));
+	pcm_drain_size = projectm_pcm_get_max_samples();
+	pcm_drain_buffer = malloc (2 * pcm_drain_size * sizeof (float));
+	if (interleave_buffer == NULL || pcm_drain_buffer == NULL) {
+		fprintf (stderr, "ERROR: cannot allocate audio buffer\n");
+		exit (1);
+	}
 
 	/* create two ports */
 
@@ -222,18 +715,30 @@ int main (int argc, char *argv[])
 	free (ports);
     
     
+    if (headless) {
+        /* Initialize an offscreen context, no display needed */
+        if (headless_init(&offscreen, window_width, window_height)) {
+            fprintf (stderr, "ERROR: cannot create headless context\n");
+            exit (1);
+        }
+        printf("INFO: headless %dx%d using %s\n", window_width, window_height,
+               headless_backend(&offscreen));
+        glClearColor(0.0,0.0,0.0,0.0);
+    } else {
     /* Initialize GLUT */
 	glutInit(&argc, argv);
     glutInitContextVersion(3, 3);
     glutInitContextProfile(GLUT_CORE_PROFILE);
-	glutInitDisplayMode(GLUT_SINGLE | GLUT_RGB);
-	glutInitWindowSize(300, 300);
+	glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGB);
+	glutInitWindowSize(window_width, window_height);
 	//Create a window with rendering context and everything else we need
 	glutCreateWindow("projectM-jack");
 	glClearColor(0.0,0.0,0.0,0.0);
 	//Assign the two used Msg-routines
 	glutDisplayFunc(render);
 	glutReshapeFunc(reshape);
+	glutIdleFunc(idle);
+    }
     
     printf("INFO: GL_VERSION: %s\n", glGetString(GL_VERSION));
     printf("INFO: GL_SHADING_LANGUAGE_VERSION: %s\n", glGetString(GL_SHADING_LANGUAGE_VERSION));
@@ -248,25 +753,70 @@ int main (int argc, char *argv[])
     }
     //texture_id = projectm_init_render_to_texture(projectm);
     projectm_set_texture_size(projectm, 2048);
-    projectm_set_window_size(projectm, 300, 300);
+    projectm_set_window_size(projectm, window_width, window_height);
     projectm_set_mesh_size(projectm, 128, 128);
     
-    /* Preset handling */
-    projectm_clear_playlist(projectm);
-    projectm_insert_preset_url(projectm, 0, argv[1], "test", rating, 0);
-    projectm_select_preset(projectm, 0, true);
-    if (projectm_get_error_loading_current_preset(projectm) == false) {
-		fprintf (stderr, "projectm_select_preset() failed\n");
+    /* Preset handling: the first preset is read while rendering starts */
+    if (preset_loader_init(&preset_loader)) {
+		fprintf (stderr, "ERROR: cannot start the preset loader\n");
 		exit (1);
     }
-    projectm_lock_preset(projectm, true);
+    if (preset_directory) {
+        preset_loader_set_cache(&preset_loader, &preset_cache);
+    }
+    if (preset_count > 1 && switch_seconds > 0
+        && preset_warmup_init(&preset_warmup, preset_count, preset_path, NULL)) {
+        fprintf (stderr, "WARNING: no preset warm-up, presets compile on first use\n");
+    }
+    request_preset(0);
+    last_switch = frame_pacer_now();
     
     //projectm_render_frame(projectm);
     
+    /* the pacer derives the audio hop per frame from the JACK rate */
+    if (target_fps < 0) {
+        target_fps = headless ? 0 : 60;
+    }
+    if (vsync && !headless) {
+        if (enable_vsync() == 0) {
+            printf("INFO: buffer swaps locked to vertical blank\n");
+            target_fps = 0;
+        } else {
+            fprintf (stderr, "WARNING: no GLX swap control, pacing with a timer instead of --vsync\n");
+            if (target_fps <= 0) {
+                target_fps = 60;
+            }
+        }
+    }
+    frame_pacer_init(&pacer, target_fps, jack_get_sample_rate (client));
+    stage_timer_init(&stage_timer);
+    signal(SIGUSR1, request_stage_dump);
+    atexit(report_exit_stats);
+    if (target_fps > 0) {
+        printf("INFO: pacing at %d fps, %u audio frames per video frame\n",
+               target_fps, jack_get_sample_rate (client) / target_fps);
+    }
+
+    if (headless) {
+        run_headless();
+    } else {
 	//Let GLUT get the msgs
 	glutMainLoop();
+    }
 
 	jack_client_close (client);
+    report_exit_stats();
+    preset_warmup_free(&preset_warmup);
+    preset_loader_free(&preset_loader);
+    preset_cache_close(&preset_cache);
+    pcm_ring_free(&pcm_ring);
+    free(interleave_buffer);
+    free(pcm_drain_buffer);
     projectm_destroy(projectm);
+    stage_timer_release(&stage_timer);
+    stage_timer_free(&stage_timer);
+    if (headless) {
+        headless_destroy(&offscreen);
+    }
 	exit (0);
 }
@@ -0,0 +1,326 @@
+/** @file projectM-render.c
+ *
+ * @brief Render an audio file through libprojectM to raw video frames
+ *
+ * The audio file (anything libsndfile reads, e.g. WAV or FLAC) is
+ * streamed through projectM in fixed hops of samplerate/fps frames,
+ * e.g. 735 samples per frame at 44.1 kHz and 60 fps.  Every frame is
+ * rendered offscreen as fast as the machine allows, not in realtime,
+ * and written to stdout as raw RGBA or as a YUV4MPEG2 stream:
+ *
+ *   projectM-render --format=y4m preset.milk track.flac | ffmpeg -i - out.mp4
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <getopt.h>
+
+#include <sndfile.h>
+#include <libprojectM/projectM.h>
+
+#include "headless.h"
+#include "monotonic.h"
+#include "readback.h"
+
+enum output_format {
+    FORMAT_RGBA,
+    FORMAT_Y4M
+};
+
+projectm_handle projectm;
+headless_t offscreen;
+readback_t readback;
+uint8_t *planes;
+
+int width = 1280;
+int height = 720;
+int fps = 60;
+int texture_size = 2048;
+int mesh_x = 128;
+int mesh_y = 128;
+int readback_depth = 3;
+enum output_format format = FORMAT_RGBA;
+
+/*-----------------------------------------------------------------------------
+ * Output
+ * ---------------------------------------------------------------------------*/
+/* OpenGL returns the rows bottom up, video wants them top down */
+void write_rgba(FILE *out, const uint8_t *pixels)
+{
+    int y;
+    for (y = height - 1; y >= 0; y--) {
+        fwrite(pixels + (size_t)y * width * 4, 4, width, out);
+    }
+}
+
+void write_y4m_header(FILE *out)
+{
+    fprintf(out, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n", width, height, fps);
+}
+
+/* full range BT.601, chroma averaged over 2x2 blocks */
+void write_y4m_frame(FILE *out, const uint8_t *pixels, uint8_t *planes)
+{
+    uint8_t *py = planes;
+    uint8_t *pu = py + (size_t)width * height;
+    uint8_t *pv = pu + (size_t)(width / 2) * (height / 2);
+    int x, y;
+
+    for (y = 0; y < height; y++) {
+        const uint8_t *row = pixels + (size_t)(height - 1 - y) * width * 4;
+        for (x = 0; x < width; x++) {
+            const uint8_t *p = row + 4 * x;
+            py[(size_t)y * width + x] = (77 * p[0] + 150 * p[1] + 29 * p[2]) >> 8;
+        }
+    }
+    for (y = 0; y < height / 2; y++) {
+        const uint8_t *row0 = pixels + (size_t)(height - 1 - 2 * y) * width * 4;
+        const uint8_t *row1 = row0 - (size_t)width * 4;
+        for (x = 0; x < width / 2; x++) {
+            const uint8_t *a = row0 + 8 * x, *b = row1 + 8 * x;
+            int r = a[0] + a[4] + b[0] + b[4];
+            int g = a[1] + a[5] + b[1] + b[5];
+            int bl = a[2] + a[6] + b[2] + b[6];
+            pu[(size_t)y * (width / 2) + x] = ((-43 * r - 85 * g + 128 * bl) >> 10) + 128;
+            pv[(size_t)y * (width / 2) + x] = ((128 * r - 107 * g - 21 * bl) >> 10) + 128;
+        }
+    }
+
+    fputs("FRAME\n", out);
+    fwrite(planes, 1, (size_t)width * height * 3 / 2, out);
+}
+
+/* readback callback, frames arrive in order, readback_depth-1 frames late */
+void write_frame(const uint8_t *pixels, int w, int h, long frame, void *user)
+{
+    (void)w;
+    (void)h;
+    (void)frame;
+    (void)user;
+    if (format == FORMAT_Y4M) {
+        write_y4m_frame(stdout, pixels, planes);
+    } else {
+        write_rgba(stdout, pixels);
+    }
+}
+
+/*-----------------------------------------------------------------------------
+ * Audio
+ * ---------------------------------------------------------------------------*/
+/**
+ * Hand one hop of interleaved audio to projectM.  Files with more than
+ * two channels are reduced to the first two in place.
+ */
+void add_audio(float *samples, sf_count_t frames, int channels)
+{
+    unsigned int max_samples = projectm_pcm_get_max_samples();
+    projectm_channels layout = channels == 1 ? PROJECTM_MONO : PROJECTM_STEREO;
+    int stride = channels == 1 ? 1 : 2;
+    sf_count_t i, done, n;
+
+    if (channels > 2) {
+        for (i = 0; i < frames; i++) {
+            samples[2*i+0] = samples[channels*i+0];
+            samples[2*i+1] = samples[channels*i+1];
+        }
+    }
+    for (done = 0; done < frames; done += n) {
+        n = frames - done;
+        if (n > max_samples) {
+            n = max_samples;
+        }
+        projectm_pcm_add_float(projectm, samples + done * stride, n, layout);
+    }
+}
+
+/*-----------------------------------------------------------------------------
+ * Main
+ * ---------------------------------------------------------------------------*/
+void usage(const char *name)
+{
+    fprintf (stderr, "usage: %s [options] preset.milk audiofile > frames\n"
+             "  --size=WxH      frame size (default 1280x720)\n"
+             "  --fps=N         frames per second of audio (default 60)\n"
+             "  --format=F      rgba (raw RGBA frames, default) or y4m\n"
+             "  --texture=N     projectM texture size (default 2048)\n"
+             "  --mesh=XxY      projectM mesh size (default 128x128)\n"
+             "  --readback=N    frames in flight between GPU and CPU (default 3)\n", name);
+}
+
+int main (int argc, char *argv[])
+{
+    SNDFILE *file;
+    SF_INFO info;
+    float *samples;
+    int rating[1] = {1};
+    int opt;
+    long frame = 0;
+    sf_count_t position = 0, next, hop, got;
+    double start, elapsed;
+    const struct option long_options[] = {
+        {"size", required_argument, NULL, 's'},
+        {"fps", required_argument, NULL, 'r'},
+        {"format", required_argument, NULL, 'F'},
+        {"texture", required_argument, NULL, 't'},
+        {"mesh", required_argument, NULL, 'm'},
+        {"readback", required_argument, NULL, 'b'},
+        {NULL, 0, NULL, 0}
+    };
+
+    while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+        switch (opt) {
+        case 's':
+            if (sscanf(optarg, "%dx%d", &width, &height) != 2 || width <= 0 || height <= 0) {
+                usage(argv[0]);
+                exit (1);
+            }
+            break;
+        case 'r':
+            if (sscanf(optarg, "%d", &fps) != 1 || fps <= 0) {
+                usage(argv[0]);
+                exit (1);
+            }
+            break;
+        case 'F':
+            if (strcmp(optarg, "rgba") == 0) {
+                format = FORMAT_RGBA;
+            } else if (strcmp(optarg, "y4m") == 0) {
+                format = FORMAT_Y4M;
+            } else {
+                usage(argv[0]);
+                exit (1);
+            }
+            break;
+        case 't':
+            if (sscanf(optarg, "%d", &texture_size) != 1 || texture_size <= 0) {
+                usage(argv[0]);
+                exit (1);
+            }
+            break;
+        case 'm':
+            if (sscanf(optarg, "%dx%d", &mesh_x, &mesh_y) != 2 || mesh_x <= 0 || mesh_y <= 0) {
+                usage(argv[0]);
+                exit (1);
+            }
+            break;
+        case 'b':
+            if (sscanf(optarg, "%d", &readback_depth) != 1 || readback_depth <= 0) {
+                usage(argv[0]);
+                exit (1);
+            }
+            break;
+        default:
+            usage(argv[0]);
+            exit (1);
+        }
+    }
+    if (argc - optind != 2) {
+        usage(argv[0]);
+        exit (1);
+    }
+    if (format == FORMAT_Y4M && (width % 2 || height % 2)) {
+        fprintf (stderr, "ERROR: y4m output needs an even frame size\n");
+        exit (1);
+    }
+    if (isatty(fileno(stdout))) {
+        fprintf (stderr, "ERROR: refusing to write video frames to a terminal\n");
+        exit (1);
+    }
+
+    /* Open the audio file */
+    memset(&info, 0, sizeof(info));
+    file = sf_open(argv[optind + 1], SFM_READ, &info);
+    if (file == NULL) {
+        fprintf (stderr, "ERROR: cannot open %s: %s\n", argv[optind + 1], sf_strerror(NULL));
+        exit (1);
+    }
+    fprintf (stderr, "INFO: %s: %d Hz, %d channels, %.1f s\n", argv[optind + 1],
+             info.samplerate, info.channels, (double)info.frames / info.samplerate);
+
+    /* Initialize an offscreen context */
+    if (headless_init(&offscreen, width, height)) {
+        fprintf (stderr, "ERROR: cannot create headless context\n");
+        exit (1);
+    }
+    fprintf (stderr, "INFO: rendering %dx%d at %d fps using %s, GL_RENDERER: %s\n",
+             width, height, fps, headless_backend(&offscreen), glGetString(GL_RENDERER));
+    glClearColor(0.0,0.0,0.0,0.0);
+
+    /* Initialize projectM */
+    projectm = projectm_create(NULL, 0);
+    if (projectm == NULL) {
+        fprintf (stderr, "projectm_create() failed\n");
+        exit (1);
+    }
+    projectm_set_texture_size(projectm, texture_size);
+    projectm_set_window_size(projectm, width, height);
+    projectm_set_mesh_size(projectm, mesh_x, mesh_y);
+    projectm_set_fps(projectm, fps);
+
+    /* Preset handling */
+    projectm_clear_playlist(projectm);
+    projectm_insert_preset_url(projectm, 0, argv[optind], "test", rating, 0);
+    projectm_select_preset(projectm, 0, true);
+    projectm_lock_preset(projectm, true);
+
+    /* one hop is samplerate/fps frames, rounded per frame so the
+     * video never drifts away from the audio
+     */
+    hop = info.samplerate / fps + 1;
+    samples = malloc(hop * info.channels * sizeof(float));
+    if (format == FORMAT_Y4M) {
+        planes = malloc((size_t)width * height * 3 / 2);
+        write_y4m_header(stdout);
+    }
+    if (samples == NULL || (format == FORMAT_Y4M && planes == NULL)) {
+        fprintf (stderr, "ERROR: out of memory\n");
+        exit (1);
+    }
+    if (readback_init(&readback, width, height, readback_depth, write_frame, NULL)) {
+        exit (1);
+    }
+
+    start = monotonic_now();
+    while (position < info.frames) {
+        next = (sf_count_t)(frame + 1) * info.samplerate / fps;
+        got = sf_readf_float(file, samples, next - position);
+        if (got <= 0) {
+            break;
+        }
+        position += got;
+        add_audio(samples, got, info.channels);
+
+        headless_bind(&offscreen);
+        glClear(GL_COLOR_BUFFER_BIT);
+        projectm_render_frame(projectm);
+
+        readback_frame(&readback);
+        frame++;
+
+        if (frame % (10 * fps) == 0) {
+            elapsed = monotonic_now() - start;
+            fprintf (stderr, "INFO: %.0f s of audio, %.1f fps, %.2fx realtime\n",
+                     (double)frame / fps, frame / elapsed, frame / (elapsed * fps));
+        }
+    }
+    readback_flush(&readback);
+    fflush(stdout);
+    elapsed = monotonic_now() - start;
+    fprintf (stderr, "INFO: rendered %ld frames in %.2f s, %.1f fps, %.2fx realtime\n",
+             frame, elapsed, frame / elapsed, frame / (elapsed * fps));
+    fprintf (stderr, "INFO: readback %lu frames, %lu stalls, fence wait %.1f ms total, %.2f ms max\n",
+             readback.stats.frames, readback.stats.stalls,
+             readback.stats.wait_total * 1e3, readback.stats.wait_max * 1e3);
+
+    sf_close(file);
+    readback_destroy(&readback);
+    projectm_destroy(projectm);
+    headless_destroy(&offscreen);
+    free(samples);
+    free(planes);
+    exit (0);
+}
@@ -8,12 +8,25 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
+#include <getopt.h>
+#include <signal.h>
 
 #include <GL/glut.h>
 #include <libprojectM/projectM.h>
 
+#include "headless.h"
+#include "monotonic.h"
+
 projectm_handle projectm;
 
+/* offscreen rendering without a window */
+int headless;
+int window_width = 300;
+int window_height = 300;
+long max_frames;
+headless_t offscreen;
+volatile sig_atomic_t quit;
+
 
 void Display(void)
 {
@@ -50,27 +63,116 @@ void Reshape(int x, int y)
 	glViewport(0,0,x,y);  //Use the whole window for rendering
 }
 
+void Stop(int sig)
+{
+	quit = 1;
+}
+
+/**
+ * Headless replacement for glutMainLoop(): render frames as fast as
+ * the context allows and report the frame rate once per second.
+ */
+void RunHeadless(void)
+{
+    long frames = 0, interval_frames = 0;
+    double start = monotonic_now(), interval_start = start, t;
+
+    signal(SIGINT, Stop);
+    signal(SIGTERM, Stop);
+
+    while (!quit && (max_frames == 0 || frames < max_frames)) {
+        headless_bind(&offscreen);
+        glClear(GL_COLOR_BUFFER_BIT);
+        projectm_render_frame(projectm);
+        glFlush();
+        frames++;
+        interval_frames++;
+
+        t = monotonic_now();
+        if (t - interval_start >= 1.0) {
+            glFinish();
+            t = monotonic_now();
+            printf("INFO: %.1f fps\n", interval_frames / (t - interval_start));
+            interval_frames = 0;
+            interval_start = t;
+        }
+    }
+    glFinish();
+    t = monotonic_now();
+    printf("INFO: rendered %ld frames in %.2f s, %.1f fps\n",
+           frames, t - start, frames / (t - start));
+}
+
+void Usage(const char *name)
+{
+    fprintf (stderr, "usage: %s [--headless] [--size=WxH] [--frames=N] preset.milk\n"
+             "  --headless    render offscreen (EGL/OSMesa) instead of a GLUT window\n"
+             "  --size=WxH    window or framebuffer size (default 300x300)\n"
+             "  --frames=N    in headless mode, stop after N frames\n", name);
+}
+
 int
 main (int argc, char *argv[])
 {
-    if (argc == 1) {
+    int opt;
+    const struct option long_options[] = {
+        {"headless", no_argument, NULL, 'H'},
+        {"size", required_argument, NULL, 's'},
+        {"frames", required_argument, NULL, 'f'},
+        {NULL, 0, NULL, 0}
+    };
+
+    while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+        switch (opt) {
+        case 'H':
+            headless = 1;
+            break;
+        case 's':
+            if (sscanf(optarg, "%dx%d", &window_width, &window_height) != 2
+                || window_width <= 0 || window_height <= 0) {
+                Usage(argv[0]);
+                exit (1);
+            }
+            break;
+        case 'f':
+            max_frames = atol(optarg);
+            break;
+        default:
+            Usage(argv[0]);
+            exit (1);
+        }
+    }
+
+    if (optind >= argc) {
 		fprintf (stderr, "You need to specify a path to a Milkdrop preset\n");
+		Usage(argv[0]);
 		exit (1);
     }
     
     GLuint textureID;
     int rating[1] = {1};
     
+    if (headless) {
+        /* Initialize an offscreen context, no display needed */
+        if (headless_init(&offscreen, window_width, window_height)) {
+            fprintf (stderr, "ERROR: cannot create headless context\n");
+            exit (1);
+        }
+        printf("INFO: headless %dx%d using %s\n", window_width, window_height,
+               headless_backend(&offscreen));
+        glClearColor(0.0,0.0,0.0,0.0);
+    } else {
     /* Initialize GLUT */
 	glutInit(&argc, argv);
 	glutInitDisplayMode(GLUT_SINGLE | GLUT_RGB);
-	glutInitWindowSize(300, 300);
+	glutInitWindowSize(window_width, window_height);
 	//Create a window with rendering context and everything else we need
 	glutCreateWindow("Intro");
 	glClearColor(0.0,0.0,0.0,0.0);
 	//Assign the two used Msg-routines
 	glutDisplayFunc(Display);
 	glutReshapeFunc(Reshape);
+    }
     
     printf("INFO: GL_VERSION: %s\n", glGetString(GL_VERSION));
     printf("INFO: GL_SHADING_LANGUAGE_VERSION: %s\n", glGetString(GL_SHADING_LANGUAGE_VERSION));
@@ -85,17 +187,24 @@ main (int argc, char *argv[])
     }
     //texture_id = projectm_init_render_to_texture(projectm);
     projectm_set_texture_size(projectm, 2048);
-    projectm_set_window_size(projectm, 300, 300);
+    projectm_set_window_size(projectm, window_width, window_height);
     projectm_set_mesh_size(projectm, 128, 128);
     
     /* Preset handling */
     projectm_clear_playlist(projectm);
-    projectm_insert_preset_url(projectm, 0, argv[1], "test", rating, 0);
+    projectm_insert_preset_url(projectm, 0, argv[optind], "test", rating, 0);
     projectm_select_preset(projectm, 0, true);
     
+    if (headless) {
+        RunHeadless();
+    } else {
 	//Let GLUT get the msgs
 	glutMainLoop();
+    }
 
     projectm_destroy(projectm);
+    if (headless) {
+        headless_destroy(&offscreen);
+    }
 	exit (0);
 }
@@ -0,0 +1,139 @@
+/** @file readback.c
+ *
+ * @brief Asynchronous readback of rendered frames through a ring of PBOs
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define GL_GLEXT_PROTOTYPES 1
+#include "readback.h"
+#include "monotonic.h"
+#include <GL/glext.h>
+
+/* a fence that takes longer than this is treated as lost */
+#define READBACK_TIMEOUT_NS 1000000000ull
+
+int readback_init(readback_t *rb, int width, int height, int depth,
+                  readback_callback callback, void *user)
+{
+    int i;
+
+    memset(rb, 0, sizeof(*rb));
+    if (depth < 1) {
+        depth = 1;
+    }
+    rb->width = width;
+    rb->height = height;
+    rb->depth = depth;
+    rb->callback = callback;
+    rb->user = user;
+    rb->pbo = calloc(depth, sizeof(GLuint));
+    rb->fence = calloc(depth, sizeof(GLsync));
+    rb->frame = calloc(depth, sizeof(long));
+    if (rb->pbo == NULL || rb->fence == NULL || rb->frame == NULL) {
+        fprintf(stderr, "ERROR: cannot allocate readback ring\n");
+        readback_destroy(rb);
+        return -1;
+    }
+
+    glGenBuffers(depth, rb->pbo);
+    for (i = 0; i < depth; i++) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, rb->pbo[i]);
+        glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr)width * height * 4,
+                     NULL, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    return 0;
+}
+
+/* map the oldest frame in flight and hand it to the callback */
+static void deliver(readback_t *rb)
+{
+    int slot = rb->delivered % rb->depth;
+    GLsync fence = rb->fence[slot];
+    const uint8_t *pixels;
+
+    if (fence) {
+        GLenum result = glClientWaitSync(fence, 0, 0);
+        if (result == GL_TIMEOUT_EXPIRED) {
+            double start = monotonic_now(), wait;
+            glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, READBACK_TIMEOUT_NS);
+            wait = monotonic_now() - start;
+            rb->stats.stalls++;
+            rb->stats.wait_total += wait;
+            if (wait > rb->stats.wait_max) {
+                rb->stats.wait_max = wait;
+            }
+        }
+        glDeleteSync(fence);
+        rb->fence[slot] = NULL;
+    }
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, rb->pbo[slot]);
+    pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0,
+                              (GLsizeiptr)rb->width * rb->height * 4,
+                              GL_MAP_READ_BIT);
+    if (pixels) {
+        rb->callback(pixels, rb->width, rb->height, rb->frame[slot], rb->user);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    } else {
+        fprintf(stderr, "ERROR: cannot map readback buffer\n");
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    rb->delivered++;
+    rb->stats.frames++;
+}
+
+void readback_frame(readback_t *rb)
+{
+    /* at most depth-1 frames are in flight here, so this slot is free */
+    int slot = rb->issued % rb->depth;
+
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, rb->pbo[slot]);
+    glReadPixels(0, 0, rb->width, rb->height, GL_RGBA, GL_UNSIGNED_BYTE, (void *)0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    rb->fence[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    rb->frame[slot] = rb->issued;
+    rb->issued++;
+
+    /* make sure the GPU starts on the copy now, not when we wait for it */
+    glFlush();
+
+    /* with depth 1 this is the frame just read */
+    if (rb->issued - rb->delivered == rb->depth) {
+        deliver(rb);
+    }
+}
+
+void readback_flush(readback_t *rb)
+{
+    while (rb->delivered < rb->issued) {
+        deliver(rb);
+    }
+}
+
+void readback_destroy(readback_t *rb)
+{
+    int i;
+
+    if (rb->fence) {
+        for (i = 0; i < rb->depth; i++) {
+            if (rb->fence[i]) {
+                glDeleteSync(rb->fence[i]);
+            }
+        }
+    }
+    if (rb->pbo && rb->pbo[0]) {
+        glDeleteBuffers(rb->depth, rb->pbo);
+    }
+    free(rb->pbo);
+    free(rb->fence);
+    free(rb->frame);
+    rb->pbo = NULL;
+    rb->fence = NULL;
+    rb->frame = NULL;
+}
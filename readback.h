@@ -0,0 +1,74 @@
+/** @file readback.h
+ *
+ * @brief Asynchronous readback of rendered frames through a ring of PBOs
+ *
+ * A plain glReadPixels() into client memory waits until the GPU has
+ * finished the frame.  Here every frame is read into its own pixel
+ * buffer object and fenced; the CPU only maps a PBO once its fence has
+ * signalled, depth-1 frames later.  Frames are handed to a callback in
+ * order, with a fixed latency of depth-1 frames and no pipeline stall
+ * as long as the GPU keeps up.
+ *
+ * Usage per frame, with the rendered framebuffer bound for reading:
+ *
+ *   readback_frame(&rb);        // delivers the frame of depth-1 calls ago
+ *   ...
+ *   readback_flush(&rb);        // at the end, deliver what is in flight
+ */
+
+#ifndef READBACK_H
+#define READBACK_H
+
+#include <stdint.h>
+#include <GL/gl.h>
+
+/**
+ * Called with the pixels of a finished frame, bottom row first, tightly
+ * packed RGBA.  The pointer is only valid during the call.
+ */
+typedef void (*readback_callback)(const uint8_t *pixels, int width, int height,
+                                  long frame, void *user);
+
+typedef struct readback_stats {
+    unsigned long frames;       /* frames delivered */
+    unsigned long stalls;       /* frames whose fence had not signalled yet */
+    double wait_total;          /* seconds spent waiting on fences */
+    double wait_max;            /* longest single wait, seconds */
+} readback_stats_t;
+
+typedef struct readback {
+    int width;
+    int height;
+    int depth;                  /* number of PBOs in the ring */
+    GLuint *pbo;
+    struct __GLsync **fence;
+    long *frame;
+    long issued;                /* frames read into a PBO so far */
+    long delivered;             /* frames handed to the callback so far */
+    readback_callback callback;
+    void *user;
+    readback_stats_t stats;
+} readback_t;
+
+/**
+ * Create depth PBOs of width x height RGBA pixels, depth >= 1 (1 makes
+ * it synchronous).  Needs a current context.
+ * Returns 0 on success, -1 on failure.
+ */
+int readback_init(readback_t *rb, int width, int height, int depth,
+                  readback_callback callback, void *user);
+
+/**
+ * Start reading the current read framebuffer into the next PBO, then,
+ * once depth frames are in flight, deliver the oldest: the frame read
+ * depth-1 calls earlier, or this one with depth 1.
+ */
+void readback_frame(readback_t *rb);
+
+/** Deliver every frame still in flight. */
+void readback_flush(readback_t *rb);
+
+/** Release the PBOs and fences.  Frames in flight are dropped. */
+void readback_destroy(readback_t *rb);
+
+#endif /* READBACK_H */
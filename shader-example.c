@@ -4,6 +4,8 @@
 #include <GL/glew.h>
 #include <GL/glut.h>
 
+#include "program-cache.h"
+
 
 const char *vertexSource = "#version 130\n\
 in mediump vec3 point;\n\
@@ -55,34 +57,6 @@ void printError(const char *context)
   };
 }
 
-void printStatus(const char *step, GLuint context, GLuint status)
-{
-  GLint result = GL_FALSE;
-  if (status == GL_COMPILE_STATUS)
-    glGetShaderiv(context, status, &result);
-  else
-    glGetProgramiv(context, status, &result);
-  if (result == GL_FALSE) {
-    char buffer[1024];
-    if (status == GL_COMPILE_STATUS)
-      glGetShaderInfoLog(context, 1024, NULL, buffer);
-    else
-      glGetProgramInfoLog(context, 1024, NULL, buffer);
-    if (buffer[0])
-      fprintf(stderr, "%s: %s\n", step, buffer);
-  };
-}
-
-void printCompileStatus(const char *step, GLuint context)
-{
-  printStatus(step, context, GL_COMPILE_STATUS);
-}
-
-void printLinkStatus(const char *step, GLuint context)
-{
-  printStatus(step, context, GL_LINK_STATUS);
-}
-
 GLfloat vertices[] = {
    0.5f,  0.5f,  0.0f, 1.0f, 1.0f,
   -0.5f,  0.5f,  0.0f, 0.0f, 1.0f,
@@ -106,21 +80,7 @@ int main(int argc, char** argv)
   glewExperimental = GL_TRUE;
   glewInit();
 
-  GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER);
-  glShaderSource(vertexShader, 1, &vertexSource, NULL);
-  glCompileShader(vertexShader);
-  printCompileStatus("Vertex shader", vertexShader);
-
-  GLuint fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-  glShaderSource(fragmentShader, 1, &fragmentSource, NULL);
-  glCompileShader(fragmentShader);
-  printCompileStatus("Fragment shader", fragmentShader);
-
-  program = glCreateProgram();
-  glAttachShader(program, vertexShader);
-  glAttachShader(program, fragmentShader);
-  glLinkProgram(program);
-  printLinkStatus("Shader program", program);
+  program = program_cache_build("Shader", vertexSource, fragmentSource, NULL);
 
   glGenVertexArrays(1, &vao);
   glBindVertexArray(vao);
@@ -172,10 +132,6 @@ int main(int argc, char** argv)
   glBindVertexArray(0);
   glDeleteVertexArrays(1, &vao);
 
-  glDetachShader(program, vertexShader);
-  glDetachShader(program, fragmentShader);
   glDeleteProgram(program);
-  glDeleteShader(vertexShader);
-  glDeleteShader(fragmentShader);
   return 0;
 }
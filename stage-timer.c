@@ -0,0 +1,283 @@
+/** @file stage-timer.c
+ *
+ * @brief CPU and GPU time of the stages of a frame
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define GL_GLEXT_PROTOTYPES 1
+#include "stage-timer.h"
+#include "monotonic.h"
+#include <GL/glext.h>
+
+static const char *stage_names[STAGE_COUNT] = {
+    "audio", "render", "upload", "draw", "readback", "swap"
+};
+
+static int bucket(double seconds)
+{
+    double us = seconds * 1e6;
+    int b = 0;
+
+    while (b < STAGE_TIMER_BUCKETS - 1 && us >= (double)(2u << b)) {
+        b++;
+    }
+    return b;
+}
+
+/* add a sample, replacing the oldest once the window is full; lock held */
+static void add_sample(stage_window_t *w, double seconds)
+{
+    w->sample[w->count % STAGE_TIMER_WINDOW] = seconds;
+    w->count++;
+}
+
+static int has_timer_query(void)
+{
+    const char *version = (const char *)glGetString(GL_VERSION);
+    GLint count = 0, i;
+    int major = 0, minor = 0;
+
+    if (version == NULL) {
+        return 0;
+    }
+    if (sscanf(version, "%d.%d", &major, &minor) == 2 &&
+        (major > 3 || (major == 3 && minor >= 3))) {
+        return 1;
+    }
+    if (major < 3) {
+        const char *extensions = (const char *)glGetString(GL_EXTENSIONS);
+        return extensions != NULL && strstr(extensions, "GL_ARB_timer_query") != NULL;
+    }
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for (i = 0; i < count; i++) {
+        if (strcmp((const char *)glGetStringi(GL_EXTENSIONS, i), "GL_ARB_timer_query") == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void stage_timer_init(stage_timer_t *t)
+{
+    memset(t, 0, sizeof(*t));
+    pthread_mutex_init(&t->lock, NULL);
+    t->active = -1;
+}
+
+void stage_timer_free(stage_timer_t *t)
+{
+    pthread_mutex_destroy(&t->lock);
+}
+
+void stage_timer_release(stage_timer_t *t)
+{
+    if (t->gl_ready && t->timer_query) {
+        glDeleteQueries(2 * STAGE_COUNT, &t->query[0][0]);
+    }
+    memset(t->query, 0, sizeof(t->query));
+    memset(t->pending, 0, sizeof(t->pending));
+    t->gl_ready = 0;
+    t->timer_query = 0;
+    t->active = -1;
+}
+
+void stage_timer_frame(stage_timer_t *t)
+{
+    GLuint64 elapsed;
+    GLint available;
+    int s;
+
+    if (!t->gl_ready) {
+        t->timer_query = has_timer_query();
+        if (t->timer_query) {
+            glGenQueries(2 * STAGE_COUNT, &t->query[0][0]);
+        }
+        t->gl_ready = 1;
+    }
+    t->set ^= 1;
+    t->active = -1;
+
+    pthread_mutex_lock(&t->lock);
+    t->frames++;
+    for (s = 0; s < STAGE_COUNT; s++) {
+        if (!t->pending[t->set][s]) {
+            continue;
+        }
+        t->pending[t->set][s] = 0;
+        glGetQueryObjectiv(t->query[t->set][s], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) {
+            /* the query is reused below, which discards it */
+            t->gpu_dropped++;
+            continue;
+        }
+        glGetQueryObjectui64v(t->query[t->set][s], GL_QUERY_RESULT, &elapsed);
+        add_sample(&t->gpu[s], elapsed * 1e-9);
+    }
+    pthread_mutex_unlock(&t->lock);
+}
+
+void stage_timer_begin(stage_timer_t *t, stage_t stage)
+{
+    /* one GL_TIME_ELAPSED query at a time, nested stages are CPU only */
+    if (t->gl_ready && t->timer_query && t->active < 0) {
+        glBeginQuery(GL_TIME_ELAPSED, t->query[t->set][stage]);
+        t->active = stage;
+    }
+    t->cpu_start[stage] = monotonic_now();
+}
+
+void stage_timer_end(stage_timer_t *t, stage_t stage)
+{
+    double elapsed = monotonic_now() - t->cpu_start[stage];
+
+    if (t->active == (int)stage) {
+        glEndQuery(GL_TIME_ELAPSED);
+        t->pending[t->set][stage] = 1;
+        t->active = -1;
+    }
+    pthread_mutex_lock(&t->lock);
+    add_sample(&t->cpu[stage], elapsed);
+    pthread_mutex_unlock(&t->lock);
+}
+
+const char *stage_timer_name(stage_t stage)
+{
+    return stage < STAGE_COUNT ? stage_names[stage] : "?";
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+void stage_timer_percentiles(double *samples, unsigned int n, stage_summary_t *summary)
+{
+    double sum = 0;
+    unsigned int i;
+
+    memset(summary, 0, sizeof(*summary));
+    if (n == 0) {
+        return;
+    }
+    qsort(samples, n, sizeof(double), compare_doubles);
+    for (i = 0; i < n; i++) {
+        sum += samples[i];
+        summary->histogram[bucket(samples[i])]++;
+    }
+    summary->samples = n;
+    summary->mean = sum / n;
+    summary->p50 = samples[n / 2];
+    summary->p99 = samples[(n * 99) / 100 < n - 1 ? (n * 99) / 100 : n - 1];
+    summary->max = samples[n - 1];
+}
+
+void stage_timer_summary(stage_timer_t *t, stage_t stage, int gpu, stage_summary_t *summary)
+{
+    double sorted[STAGE_TIMER_WINDOW];
+    stage_window_t *w = gpu ? &t->gpu[stage] : &t->cpu[stage];
+    unsigned int n;
+
+    pthread_mutex_lock(&t->lock);
+    n = w->count < STAGE_TIMER_WINDOW ? w->count : STAGE_TIMER_WINDOW;
+    memcpy(sorted, w->sample, n * sizeof(double));
+    pthread_mutex_unlock(&t->lock);
+    stage_timer_percentiles(sorted, n, summary);
+}
+
+/* snprintf() that keeps going after the buffer is full, to get the length */
+#define APPEND(...) do { \
+        int n_ = snprintf(buffer + (length < size ? length : size), \
+                          length < size ? size - length : 0, __VA_ARGS__); \
+        length += n_ > 0 ? n_ : 0; \
+    } while (0)
+
+int stage_timer_format(stage_timer_t *t, char *buffer, size_t size)
+{
+    stage_summary_t s[2];
+    unsigned long frames, dropped;
+    size_t length = 0;
+    int stage, gpu, b;
+
+    pthread_mutex_lock(&t->lock);
+    frames = t->frames;
+    dropped = t->gpu_dropped;
+    pthread_mutex_unlock(&t->lock);
+    APPEND("%lu frames, GPU timer queries %s, %lu GPU results not ready in time\n",
+           frames, t->timer_query ? "on" : "off", dropped);
+
+    for (stage = 0; stage < STAGE_COUNT; stage++) {
+        stage_timer_summary(t, stage, 0, &s[0]);
+        stage_timer_summary(t, stage, 1, &s[1]);
+        if (s[0].samples == 0) {
+            continue;
+        }
+        APPEND("%-8s", stage_names[stage]);
+        for (gpu = 0; gpu < 2; gpu++) {
+            if (s[gpu].samples == 0) {
+                continue;
+            }
+            APPEND(" %s mean %.3f p50 %.3f p99 %.3f max %.3f ms", gpu ? "| gpu" : "cpu",
+                   s[gpu].mean * 1e3, s[gpu].p50 * 1e3, s[gpu].p99 * 1e3, s[gpu].max * 1e3);
+        }
+        APPEND("\n");
+        for (gpu = 0; gpu < 2; gpu++) {
+            if (s[gpu].samples == 0) {
+                continue;
+            }
+            APPEND("         %s us:", gpu ? "gpu" : "cpu");
+            for (b = 0; b < STAGE_TIMER_BUCKETS; b++) {
+                if (s[gpu].histogram[b] == 0) {
+                    continue;
+                }
+                if (b < STAGE_TIMER_BUCKETS - 1) {
+                    APPEND(" <%u:%u", 2u << b, s[gpu].histogram[b]);
+                } else {
+                    APPEND(" >=%u:%u", 1u << b, s[gpu].histogram[b]);
+                }
+            }
+            APPEND("\n");
+        }
+    }
+    return (int)length;
+}
+
+char *stage_timer_text(stage_timer_t *t)
+{
+    size_t size = 4096;
+    char *text = NULL, *grown;
+    int length;
+
+    /* frames that end between two calls can add lines, so format again
+     * until the text fits */
+    for (;;) {
+        if ((grown = realloc(text, size)) == NULL) {
+            free(text);
+            return NULL;
+        }
+        text = grown;
+        length = stage_timer_format(t, text, size);
+        if (length < 0) {
+            free(text);
+            return NULL;
+        }
+        if ((size_t)length < size) {
+            return text;
+        }
+        size = (size_t)length + 1024;
+    }
+}
+
+void stage_timer_dump(stage_timer_t *t, FILE *out)
+{
+    char *text = stage_timer_text(t);
+
+    if (text != NULL) {
+        fputs(text, out);
+        free(text);
+    }
+    fflush(out);
+}
@@ -0,0 +1,128 @@
+/** @file stage-timer.h
+ *
+ * @brief CPU and GPU time of the stages of a frame
+ *
+ * A frame is split into stages (audio drain, projectM rendering,
+ * texture upload, drawing, readback, buffer swap); each client wraps
+ * the ones it has in stage_timer_begin() / stage_timer_end().  Every
+ * stage is timed on the CPU with the monotonic clock and on the GPU
+ * with a GL_TIME_ELAPSED query.
+ *
+ * The queries are double buffered: the results of frame n are collected
+ * when its query set comes round again, by the stage_timer_frame() that
+ * starts frame n + 2.  One whole frame is submitted in between, by
+ * which time the GPU has normally finished them.
+ * Results that are still not available then are dropped and counted,
+ * never waited for, so timing does not stall the pipeline.  Without
+ * timer queries (GL < 3.3 and no GL_ARB_timer_query) only CPU times
+ * are kept.
+ *
+ * Each stage keeps the last STAGE_TIMER_WINDOW samples per clock; the
+ * summary of them includes a histogram in power of two microsecond
+ * buckets.  The stats can be read from any thread; everything
+ * else must be called on the thread whose GL context is current.
+ */
+
+#ifndef STAGE_TIMER_H
+#define STAGE_TIMER_H
+
+#include <stdio.h>
+#include <pthread.h>
+#include <GL/gl.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    STAGE_AUDIO,                /* draining audio into projectM */
+    STAGE_RENDER,               /* projectm_render_frame() */
+    STAGE_UPLOAD,               /* texture upload */
+    STAGE_DRAW,                 /* blit or draw of the texture */
+    STAGE_READBACK,             /* pixels back to the CPU */
+    STAGE_SWAP,                 /* buffer swap */
+    STAGE_COUNT
+} stage_t;
+
+/* samples per stage and clock the stats are computed over */
+#define STAGE_TIMER_WINDOW 512
+
+/* bucket b counts samples below 2^(b+1) us, the last one all above */
+#define STAGE_TIMER_BUCKETS 18
+
+typedef struct stage_window {
+    double sample[STAGE_TIMER_WINDOW];
+    unsigned long count;        /* samples ever added */
+} stage_window_t;
+
+typedef struct stage_summary {
+    unsigned int samples;       /* in the window */
+    double mean;                /* seconds */
+    double p50;
+    double p99;
+    double max;
+    unsigned int histogram[STAGE_TIMER_BUCKETS];
+} stage_summary_t;
+
+typedef struct stage_timer {
+    pthread_mutex_t lock;
+    int gl_ready;               /* queries created in the current context */
+    int timer_query;            /* GL_TIME_ELAPSED available */
+    int set;                    /* query set of the current frame */
+    int active;                 /* stage whose query runs, -1 for none */
+    GLuint query[2][STAGE_COUNT];
+    int pending[2][STAGE_COUNT];
+    double cpu_start[STAGE_COUNT];
+    unsigned long frames;
+    unsigned long gpu_dropped;  /* results not ready one frame later */
+    stage_window_t cpu[STAGE_COUNT];
+    stage_window_t gpu[STAGE_COUNT];
+} stage_timer_t;
+
+/** Empty stats, no GL needed; the queries are created by the first frame. */
+void stage_timer_init(stage_timer_t *t);
+
+/** Free the lock; call stage_timer_release() first if the context lives on. */
+void stage_timer_free(stage_timer_t *t);
+
+/** Delete the queries, with the context current, e.g. before destroying it. */
+void stage_timer_release(stage_timer_t *t);
+
+/** Start of a frame: collect the GPU times of the previous one. */
+void stage_timer_frame(stage_timer_t *t);
+
+void stage_timer_begin(stage_timer_t *t, stage_t stage);
+void stage_timer_end(stage_timer_t *t, stage_t stage);
+
+const char *stage_timer_name(stage_t stage);
+
+/** Summary of the window of one stage, gpu selects the clock. */
+void stage_timer_summary(stage_timer_t *t, stage_t stage, int gpu, stage_summary_t *summary);
+
+/**
+ * The same summary of any n samples in seconds, e.g. frame times
+ * collected elsewhere.  Sorts samples in place.
+ */
+void stage_timer_percentiles(double *samples, unsigned int n, stage_summary_t *summary);
+
+/**
+ * One line per stage with samples: CPU and GPU mean/p50/p99/max in
+ * milliseconds, then the non-empty histogram buckets.  Returns the
+ * length snprintf() would have written.
+ */
+int stage_timer_format(stage_timer_t *t, char *buffer, size_t size);
+
+/**
+ * stage_timer_format() into a buffer of the right size, even if the
+ * stats grow meanwhile.  free() the result; NULL when out of memory.
+ */
+char *stage_timer_text(stage_timer_t *t);
+
+/** stage_timer_format() to a stream. */
+void stage_timer_dump(stage_timer_t *t, FILE *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* STAGE_TIMER_H */
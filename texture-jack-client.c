@@ -8,11 +8,17 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
+#include <signal.h>
 
 #include <jack/jack.h>
 #include <GL/glew.h>
 #include <GL/freeglut.h>
 
+#include "gradient-gen.h"
+#include "program-cache.h"
+#include "stage-timer.h"
+#include "trace.h"
+
 jack_port_t *input_port1;
 jack_port_t *input_port2;
 jack_port_t *output_port1;
@@ -23,10 +29,15 @@ GLuint vao;
 GLuint vbo;
 GLuint idx;
 GLuint texture_id;
+gradient_cache_t gradient_cache;
 GLuint program;
 int width = 320;
 int height = 240;
 
+/* CPU/GPU time of the upload, draw and swap, dumped on SIGUSR1 */
+stage_timer_t stage_timer;
+volatile sig_atomic_t dump_stages;
+
 const char *vertexSource = "#version 330\n\
 in mediump vec3 point;\n\
 in mediump vec2 texcoord;\n\
@@ -66,6 +77,7 @@ int process (jack_nframes_t nframes, void *arg)
 {
 	jack_default_audio_sample_t *in, *out;
 	
+    trace_begin("process");
 	in = jack_port_get_buffer (input_port1, nframes);
 	out = jack_port_get_buffer (output_port1, nframes);
 	memcpy (out, in,
@@ -74,9 +86,16 @@ int process (jack_nframes_t nframes, void *arg)
 	out = jack_port_get_buffer (output_port2, nframes);
 	memcpy (out, in,
 		sizeof (jack_default_audio_sample_t) * nframes);
+    trace_end("process");
 	return 0;
 }
 
+/* JACK calls this in its process thread before the first cycle */
+void jack_thread_init (void *arg)
+{
+    trace_thread_name("JACK process");
+}
+
 /**
  * JACK calls this shutdown_callback if the server ever shuts down or
  * decides to disconnect the client.
@@ -88,12 +107,38 @@ void jack_shutdown (void *arg)
 
 void render(void)
 {
+    stage_timer_frame(&stage_timer);
+    stage_timer_begin(&stage_timer, STAGE_DRAW);
+    trace_begin("draw");
     glBindTexture(GL_TEXTURE_2D, texture_id);
     glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
     glClear(GL_COLOR_BUFFER_BIT);
     glUseProgram(program);
     glDrawElements(GL_TRIANGLES, 3, GL_UNSIGNED_INT, (void *)0);
+    trace_end("draw");
+    stage_timer_end(&stage_timer, STAGE_DRAW);
+    stage_timer_begin(&stage_timer, STAGE_SWAP);
+    trace_begin("swap");
     glutSwapBuffers();
+    trace_end("swap");
+    stage_timer_end(&stage_timer, STAGE_SWAP);
+}
+
+void request_stage_dump(int sig)
+{
+    (void)sig;
+    dump_stages = 1;
+}
+
+/* the window only redraws when exposed, so poll for SIGUSR1 */
+void check_stage_dump(int value)
+{
+    if (dump_stages) {
+        dump_stages = 0;
+        printf("INFO: stage times:\n");
+        stage_timer_dump(&stage_timer, stdout);
+    }
+    glutTimerFunc(250, check_stage_dump, 0);
 }
 
 void reshape(int w, int h)
@@ -110,34 +155,6 @@ void printError(const char *context)
   };
 }
 
-void printStatus(const char *step, GLuint context, GLuint status)
-{
-  GLint result = GL_FALSE;
-  if (status == GL_COMPILE_STATUS)
-    glGetShaderiv(context, status, &result);
-  else
-    glGetProgramiv(context, status, &result);
-  if (result == GL_FALSE) {
-    char buffer[1024];
-    if (status == GL_COMPILE_STATUS)
-      glGetShaderInfoLog(context, 1024, NULL, buffer);
-    else
-      glGetProgramInfoLog(context, 1024, NULL, buffer);
-    if (buffer[0])
-      fprintf(stderr, "%s: %s\n", step, buffer);
-  };
-}
-
-void printCompileStatus(const char *step, GLuint context)
-{
-  printStatus(step, context, GL_COMPILE_STATUS);
-}
-
-void printLinkStatus(const char *step, GLuint context)
-{
-  printStatus(step, context, GL_LINK_STATUS);
-}
-
 int main (int argc, char *argv[])
 {
 	const char **ports;
@@ -147,6 +164,19 @@ int main (int argc, char *argv[])
 	jack_status_t status;
     
     int image_size = 256;
+    int i;
+
+    /* --trace=FILE: a Chrome trace (Perfetto) of the JACK cycles, the
+     * upload, draws and swaps, finished when exit() ends glutMainLoop() */
+    for (i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--trace=", 8) == 0) {
+            if (trace_open(argv[i] + 8)) {
+                exit (1);
+            }
+            trace_thread_name("render");
+            atexit(trace_close);
+        }
+    }
 	
 	/* open a client connection to the JACK server */
 
@@ -172,6 +202,7 @@ int main (int argc, char *argv[])
 	*/
 
 	jack_set_process_callback (client, process, 0);
+	jack_set_thread_init_callback (client, jack_thread_init, 0);
 
 	/* tell the JACK server to call `jack_shutdown()' if
 	   it ever shuts down, either entirely, or if it
@@ -275,21 +306,7 @@ int main (int argc, char *argv[])
     glewExperimental = GL_TRUE;
     glewInit();
 
-    GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vertexShader, 1, &vertexSource, NULL);
-    glCompileShader(vertexShader);
-    printCompileStatus("Vertex shader", vertexShader);
-
-    GLuint fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fragmentShader, 1, &fragmentSource, NULL);
-    glCompileShader(fragmentShader);
-    printCompileStatus("Fragment shader", fragmentShader);
-
-    program = glCreateProgram();
-    glAttachShader(program, vertexShader);
-    glAttachShader(program, fragmentShader);
-    glLinkProgram(program);
-    printLinkStatus("Shader program", program);
+    program = program_cache_build("Shader", vertexSource, fragmentSource, NULL);
 
     glGenVertexArrays(1, &vao);
     glBindVertexArray(vao);
@@ -315,16 +332,16 @@ int main (int argc, char *argv[])
 	//Assign the two used Msg-routines
 	glutDisplayFunc(render);
 	glutReshapeFunc(reshape);
+    stage_timer_init(&stage_timer);
+    signal(SIGUSR1, request_stage_dump);
+    glutTimerFunc(250, check_stage_dump, 0);
     
-    /* Create some dummy image with a color gradient */
-    uint8_t *image_data = malloc(image_size * image_size * 3 * sizeof(uint8_t));
-    for(int i=0;i<image_size;i++) {
-       for(int j=0;j<image_size;j++) {
-           int p = 3*(i*image_size+j);
-           image_data[p+0] = i;
-           image_data[p+1] = j;
-           image_data[p+2] = 255-i;
-       }
+    /* Get the dummy image with a color gradient, generated once per size */
+    gradient_params_t gradient = gradient_params_default();
+    const uint8_t *image_data = gradient_cache_get(&gradient_cache, image_size, &gradient);
+    if (image_data == NULL) {
+        fprintf(stderr, "ERROR: no memory for a %dx%d texture\n", image_size, image_size);
+        exit (1);
     }
     
     /* load a texture */
@@ -337,7 +354,12 @@ int main (int argc, char *argv[])
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, texture_id);
     glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    stage_timer_frame(&stage_timer);
+    stage_timer_begin(&stage_timer, STAGE_UPLOAD);
+    trace_begin("upload");
     glTexImage2D (GL_TEXTURE_2D, 0, GL_RGB, image_size, image_size, 0, GL_RGB, GL_UNSIGNED_BYTE, image_data);
+    trace_end("upload");
+    stage_timer_end(&stage_timer, STAGE_UPLOAD);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
     glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
     glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
@@ -345,8 +367,6 @@ int main (int argc, char *argv[])
     glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
     glGenerateMipmap(GL_TEXTURE_2D);
     
-    free(image_data);
-    
 	/* Let GLUT get the msgs */
 	glutMainLoop();
 
@@ -367,11 +387,9 @@ int main (int argc, char *argv[])
     glBindVertexArray(0);
     glDeleteVertexArrays(1, &vao);
 
-    glDetachShader(program, vertexShader);
-    glDetachShader(program, fragmentShader);
     glDeleteProgram(program);
-    glDeleteShader(vertexShader);
-    glDeleteShader(fragmentShader);
+    stage_timer_release(&stage_timer);
+    stage_timer_free(&stage_timer);
 
 	exit (0);
 }
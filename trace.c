@@ -0,0 +1,236 @@
+/** @file trace.c
+ *
+ * @brief Trace points written to a Chrome trace file (chrome://tracing, Perfetto)
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/syscall.h>
+
+#include "trace.h"
+#include "monotonic.h"
+
+#define TRACE_CACHE_LINE 64
+
+typedef struct trace_record {
+    uint64_t ns;                /* CLOCK_MONOTONIC */
+    const char *name;
+    char phase;                 /* B, E or i */
+} trace_record_t;
+
+typedef struct trace_ring {
+    /* written by the owning thread only */
+    _Alignas(TRACE_CACHE_LINE) atomic_size_t head;
+    atomic_ulong dropped;       /* events that found the ring full */
+    _Atomic(const char *) name;
+    atomic_int ready;           /* tid is set */
+    int tid;
+
+    /* written by the flusher only */
+    _Alignas(TRACE_CACHE_LINE) atomic_size_t tail;
+
+    _Alignas(TRACE_CACHE_LINE) trace_record_t record[TRACE_RING_EVENTS];
+} trace_ring_t;
+
+volatile int trace_enabled;
+
+static trace_ring_t *rings;
+static atomic_int claimed;
+static atomic_ulong unclaimed;  /* events of threads past TRACE_MAX_THREADS */
+static __thread trace_ring_t *own;
+static __thread int overflow;
+
+static FILE *out;
+static const char *out_path;
+static uint64_t start_ns;
+static unsigned long written;
+static int pid;
+static pthread_t flusher;
+static pthread_mutex_t flush_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t flush_cond = PTHREAD_COND_INITIALIZER;
+static int stopping;
+
+/* the ring of the calling thread, claimed on its first event */
+static trace_ring_t *own_ring(void)
+{
+    int i;
+
+    if (own != NULL || overflow) {
+        return own;
+    }
+    i = atomic_fetch_add_explicit(&claimed, 1, memory_order_relaxed);
+    if (i >= TRACE_MAX_THREADS) {
+        overflow = 1;
+        return NULL;
+    }
+    own = &rings[i];
+    own->tid = (int)syscall(SYS_gettid);
+    atomic_store_explicit(&own->ready, 1, memory_order_release);
+    return own;
+}
+
+void trace_event(char phase, const char *name)
+{
+    trace_ring_t *ring = own_ring();
+    size_t head, tail;
+    trace_record_t *r;
+
+    if (ring == NULL) {
+        atomic_fetch_add_explicit(&unclaimed, 1, memory_order_relaxed);
+        return;
+    }
+    head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (head - tail >= TRACE_RING_EVENTS) {
+        atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+        return;
+    }
+    r = &ring->record[head & (TRACE_RING_EVENTS - 1)];
+    r->ns = monotonic_ns();
+    r->name = name;
+    r->phase = phase;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+void trace_thread_name(const char *name)
+{
+    trace_ring_t *ring;
+
+    if (trace_enabled && (ring = own_ring()) != NULL) {
+        atomic_store_explicit(&ring->name, name, memory_order_relaxed);
+    }
+}
+
+static void write_record(const char *format, ...) __attribute__((format(printf, 1, 2)));
+
+static void write_record(const char *format, ...)
+{
+    va_list ap;
+
+    fputs(written++ ? ",\n" : "\n", out);
+    va_start(ap, format);
+    vfprintf(out, format, ap);
+    va_end(ap);
+}
+
+/* write what the threads queued so far; flusher thread or after it stopped */
+static void drain(void)
+{
+    int count = atomic_load_explicit(&claimed, memory_order_relaxed);
+    int i;
+
+    if (count > TRACE_MAX_THREADS) {
+        count = TRACE_MAX_THREADS;
+    }
+    for (i = 0; i < count; i++) {
+        trace_ring_t *ring = &rings[i];
+        size_t head, tail;
+
+        if (!atomic_load_explicit(&ring->ready, memory_order_acquire)) {
+            continue;
+        }
+        head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        for (; tail != head; tail++) {
+            const trace_record_t *r = &ring->record[tail & (TRACE_RING_EVENTS - 1)];
+            write_record("{\"name\":\"%s\",\"ph\":\"%c\",%s\"ts\":%.3f,\"pid\":%d,\"tid\":%d}",
+                         r->name, r->phase, r->phase == 'i' ? "\"s\":\"t\"," : "",
+                         (r->ns - start_ns) * 1e-3, pid, ring->tid);
+        }
+        atomic_store_explicit(&ring->tail, tail, memory_order_release);
+    }
+}
+
+static void *flush_thread(void *arg)
+{
+    struct timespec deadline;
+
+    (void)arg;
+    pthread_mutex_lock(&flush_lock);
+    while (!stopping) {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += TRACE_FLUSH_MS * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&flush_cond, &flush_lock, &deadline);
+        drain();
+    }
+    pthread_mutex_unlock(&flush_lock);
+    return NULL;
+}
+
+int trace_open(const char *path)
+{
+    if (out != NULL) {
+        return -1;
+    }
+    if (rings == NULL && (rings = calloc(TRACE_MAX_THREADS, sizeof(trace_ring_t))) == NULL) {
+        fprintf(stderr, "ERROR: no memory for the trace buffers\n");
+        return -1;
+    }
+    if ((out = fopen(path, "w")) == NULL) {
+        fprintf(stderr, "ERROR: cannot create trace %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", out);
+    out_path = path;
+    written = 0;
+    pid = (int)getpid();
+    start_ns = monotonic_ns();
+    stopping = 0;
+    if (pthread_create(&flusher, NULL, flush_thread, NULL)) {
+        fprintf(stderr, "ERROR: cannot start the trace writer\n");
+        fclose(out);
+        out = NULL;
+        return -1;
+    }
+    trace_enabled = 1;
+    printf("INFO: tracing to %s\n", path);
+    return 0;
+}
+
+void trace_close(void)
+{
+    unsigned long dropped;
+    int count, i;
+
+    if (out == NULL) {
+        return;
+    }
+    trace_enabled = 0;
+    pthread_mutex_lock(&flush_lock);
+    stopping = 1;
+    pthread_cond_signal(&flush_cond);
+    pthread_mutex_unlock(&flush_lock);
+    pthread_join(flusher, NULL);
+    drain();
+
+    /* thread names for the trace viewer */
+    dropped = atomic_load_explicit(&unclaimed, memory_order_relaxed);
+    count = atomic_load_explicit(&claimed, memory_order_relaxed);
+    for (i = 0; i < count && i < TRACE_MAX_THREADS; i++) {
+        const char *name = atomic_load_explicit(&rings[i].name, memory_order_relaxed);
+        dropped += atomic_load_explicit(&rings[i].dropped, memory_order_relaxed);
+        if (name != NULL && atomic_load_explicit(&rings[i].ready, memory_order_acquire)) {
+            write_record("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
+                         "\"args\":{\"name\":\"%s\"}}", pid, rings[i].tid, name);
+        }
+    }
+    fputs("\n]}\n", out);
+    if (fclose(out)) {
+        fprintf(stderr, "ERROR: cannot write trace %s: %s\n", out_path, strerror(errno));
+    } else {
+        printf("INFO: %lu trace events written to %s, %lu dropped\n",
+               written, out_path, dropped);
+    }
+    out = NULL;
+}
@@ -0,0 +1,77 @@
+/** @file trace.h
+ *
+ * @brief Trace points written to a Chrome trace file (chrome://tracing, Perfetto)
+ *
+ * Every thread that emits an event gets a wait-free single-producer/
+ * single-consumer ring of its own, claimed from a pool that trace_open()
+ * allocates up front, so trace points are safe in the JACK process()
+ * callback: no lock, no allocation, one clock_gettime() per event.  A
+ * background thread drains the rings into the JSON file a few times a
+ * second.  Events that find their ring full are dropped and counted.
+ *
+ * Without trace_open() a trace point is a load and a branch.
+ *
+ * Event names are not copied: pass string literals.  Begin and end
+ * events must nest on each thread.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+/* threads that can emit events, later ones are not traced */
+#define TRACE_MAX_THREADS 16
+
+/* events per thread between two flushes, power of two */
+#define TRACE_RING_EVENTS (1 << 14)
+
+/* how often the flusher drains the rings */
+#define TRACE_FLUSH_MS 50
+
+/* non-zero between trace_open() and trace_close() */
+extern volatile int trace_enabled;
+
+/**
+ * Start writing events to path.  Returns 0 on success, -1 if the file
+ * cannot be created or the flusher cannot be started.
+ */
+int trace_open(const char *path);
+
+/**
+ * Stop tracing, write the events still queued and finish the file.  The
+ * rings stay allocated for threads still inside a trace point.  Safe to
+ * call more than once, e.g. from atexit().
+ */
+void trace_close(void);
+
+/** Name the calling thread in the trace; name is not copied. */
+void trace_thread_name(const char *name);
+
+void trace_event(char phase, const char *name);
+
+/** Start of a span on the calling thread. */
+static inline void trace_begin(const char *name)
+{
+    if (trace_enabled) {
+        trace_event('B', name);
+    }
+}
+
+/** End of the span started last by trace_begin() with the same name. */
+static inline void trace_end(const char *name)
+{
+    if (trace_enabled) {
+        trace_event('E', name);
+    }
+}
+
+/** Something happened, without a duration (an underrun, a dropped preset). */
+static inline void trace_instant(const char *name)
+{
+    if (trace_enabled) {
+        trace_event('i', name);
+    }
+}
+
+#endif /* TRACE_H */